@@ -1,113 +1,701 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
+#include <fcntl.h>
 #include <glib.h>
+#include <inttypes.h>
 #include <quickjs-libc.h>
 #include <quickjs.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <uv.h>
 #include <yoga/Yoga.h>
 
+/*-------------------------------------
+ * 定时器
+ * 所有 setTimeout/setInterval 共用一个 uv_timer_t：定时器记录放在带空闲链表的
+ * 池里，按到期时间排成最小堆，uv 定时器只对准堆顶，同一轮到期的定时器一次取出
+ * 依次执行。定时器 id 由池下标和代数组成，记录回收后旧 id 自然失效
+ *-----------------------------------*/
+#define TIMER_INDEX_BITS 24
+#define TIMER_INDEX_LIMIT (1u << TIMER_INDEX_BITS)
+// 代数取 29 位，id 不超过 2^53，在 JS 里能精确表示
+#define TIMER_GENERATION_MASK ((1u << 29) - 1)
+#define TIMER_NONE UINT32_MAX
+
+typedef enum { TIMER_FREE, TIMER_SCHEDULED, TIMER_FIRING } TimerState;
+
 typedef struct {
-  JSContext *ctx;
   JSValue func;
-  uv_timer_t *timer;
-  int is_interval;
-} TimerData;
+  uint64_t due;      // 到期时间，uv_now 毫秒
+  uint64_t seq;      // 到期时间相同时按创建顺序执行
+  uint64_t interval; // 0 表示一次性定时器
+  uint32_t generation;
+  uint32_t heap_index;
+  uint32_t next_free;
+  TimerState state;
+} TimerRecord;
+
+typedef struct {
+  JSContext *ctx;
+  uv_loop_t *loop;
+  uv_timer_t handle;
+  int handle_open;
+  int armed;          // handle 是否已对准某个到期时间
+  uint64_t armed_due;
+  TimerRecord *records;
+  uint32_t record_count; // 用过的记录数，其中空闲的挂在 free_head 链表上
+  uint32_t capacity;
+  uint32_t free_head;
+  uint32_t *heap; // 记录下标，按 (due, seq) 排成最小堆
+  uint32_t heap_count;
+  uint64_t next_seq;
+  int64_t *batch; // 本轮到期的定时器 id
+  uint32_t batch_capacity;
+  Uint64 deadline; // 超过该时刻剩下的回调留到下一轮，0 表示不限
+} TimerManager;
+
+static TimerManager timers;
+
+static int64_t timer_id(TimerManager *m, uint32_t index) {
+  return ((int64_t)m->records[index].generation << TIMER_INDEX_BITS) | index;
+}
+
+static TimerRecord *timer_lookup(TimerManager *m, int64_t id) {
+  if (id <= 0)
+    return NULL;
+  uint32_t index = (uint32_t)(id & (TIMER_INDEX_LIMIT - 1));
+  uint32_t generation = (uint32_t)(id >> TIMER_INDEX_BITS);
+  if (index >= m->record_count)
+    return NULL;
+  TimerRecord *rec = &m->records[index];
+  if (rec->state == TIMER_FREE || rec->generation != generation)
+    return NULL;
+  return rec;
+}
+
+static int timer_before(TimerManager *m, uint32_t a, uint32_t b) {
+  const TimerRecord *ra = &m->records[a];
+  const TimerRecord *rb = &m->records[b];
+  return ra->due < rb->due || (ra->due == rb->due && ra->seq < rb->seq);
+}
 
-// 新增：统一资源释放回调
-static void timer_close_cb(uv_handle_t *handle) {
-  TimerData *td = (TimerData *)handle->data;
-  JS_FreeValue(td->ctx, td->func);
-  free(td);
-  free(handle);
+static void timer_heap_set(TimerManager *m, uint32_t pos, uint32_t index) {
+  m->heap[pos] = index;
+  m->records[index].heap_index = pos;
 }
 
-// ---------------------- 遍历关闭所有定时器 ----------------------
-void close_timers_cb(uv_handle_t *handle, void *arg) {
-  if (uv_handle_get_type(handle) == UV_TIMER && !uv_is_closing(handle)) {
-    uv_timer_stop((uv_timer_t *)handle);
-    uv_close(handle, timer_close_cb);
+static void timer_heap_up(TimerManager *m, uint32_t pos) {
+  uint32_t index = m->heap[pos];
+  while (pos > 0) {
+    uint32_t parent = (pos - 1) / 2;
+    if (!timer_before(m, index, m->heap[parent]))
+      break;
+    timer_heap_set(m, pos, m->heap[parent]);
+    pos = parent;
+  }
+  timer_heap_set(m, pos, index);
+}
+
+static void timer_heap_down(TimerManager *m, uint32_t pos) {
+  uint32_t index = m->heap[pos];
+  for (;;) {
+    uint32_t child = pos * 2 + 1;
+    if (child >= m->heap_count)
+      break;
+    if (child + 1 < m->heap_count &&
+        timer_before(m, m->heap[child + 1], m->heap[child]))
+      child++;
+    if (!timer_before(m, m->heap[child], index))
+      break;
+    timer_heap_set(m, pos, m->heap[child]);
+    pos = child;
   }
+  timer_heap_set(m, pos, index);
 }
 
-static void timer_cb(uv_timer_t *handle) {
-  TimerData *td = (TimerData *)handle->data;
-  JSContext *ctx = td->ctx;
+static void timer_heap_push(TimerManager *m, uint32_t index) {
+  m->heap[m->heap_count] = index;
+  timer_heap_up(m, m->heap_count++);
+}
 
-  JSValue ret = JS_Call(ctx, td->func, JS_UNDEFINED, 0, NULL);
-  if (JS_IsException(ret)) {
-    js_std_dump_error(ctx);
+static void timer_heap_remove(TimerManager *m, uint32_t pos) {
+  uint32_t last = m->heap[--m->heap_count];
+  if (pos == m->heap_count)
+    return;
+  timer_heap_set(m, pos, last);
+  timer_heap_up(m, pos);
+  timer_heap_down(m, m->records[last].heap_index);
+}
+
+static void timers_cb(uv_timer_t *handle);
+
+// 让 uv 定时器对准堆顶；到期时间没变时不碰 libuv
+static void timers_rearm(TimerManager *m) {
+  if (m->heap_count == 0) {
+    if (m->armed) {
+      uv_timer_stop(&m->handle);
+      m->armed = 0;
+    }
+    return;
   }
-  JS_FreeValue(ctx, ret);
+  uint64_t due = m->records[m->heap[0]].due;
+  if (m->armed && m->armed_due == due)
+    return;
+  uint64_t now = uv_now(m->loop);
+  uv_timer_start(&m->handle, timers_cb, due > now ? due - now : 0, 0);
+  m->armed = 1;
+  m->armed_due = due;
+}
 
-  if (!td->is_interval) {
-    uv_timer_stop(handle);
-    uv_close((uv_handle_t *)handle, timer_close_cb);
+// 记录回收进空闲链表，代数加一让旧 id 失效；回调由调用方处理
+static void timer_release(TimerManager *m, TimerRecord *rec) {
+  uint32_t index = (uint32_t)(rec - m->records);
+  rec->state = TIMER_FREE;
+  rec->func = JS_UNDEFINED;
+  rec->generation = (rec->generation + 1) & TIMER_GENERATION_MASK;
+  if (rec->generation == 0)
+    rec->generation = 1;
+  rec->next_free = m->free_head;
+  m->free_head = index;
+}
+
+static int timers_grow(TimerManager *m) {
+  if (m->capacity >= TIMER_INDEX_LIMIT)
+    return -1;
+  uint32_t capacity = m->capacity ? m->capacity * 2 : 64;
+  TimerRecord *records = realloc(m->records, capacity * sizeof(TimerRecord));
+  if (!records)
+    return -1;
+  m->records = records;
+  uint32_t *heap = realloc(m->heap, capacity * sizeof(uint32_t));
+  if (!heap)
+    return -1;
+  m->heap = heap;
+  m->capacity = capacity;
+  return 0;
+}
+
+// 返回新定时器的 id，池满时返回 -1
+int64_t timers_add(TimerManager *m, JSValueConst func, int64_t delay,
+                   int repeat) {
+  if (delay < 0)
+    delay = 0;
+  uint32_t index = m->free_head;
+  if (index != TIMER_NONE) {
+    m->free_head = m->records[index].next_free;
+  } else {
+    if (m->record_count == m->capacity && timers_grow(m) != 0)
+      return -1;
+    index = m->record_count++;
+    m->records[index].generation = 1;
   }
+  TimerRecord *rec = &m->records[index];
+  rec->func = JS_DupValue(m->ctx, func);
+  rec->due = uv_now(m->loop) + (uint64_t)delay;
+  rec->seq = m->next_seq++;
+  rec->interval = repeat ? (uint64_t)(delay > 0 ? delay : 1) : 0;
+  rec->state = TIMER_SCHEDULED;
+  timer_heap_push(m, index);
+  timers_rearm(m);
+  return timer_id(m, index);
 }
 
-static JSValue js_setTimeout(JSContext *ctx, JSValue this_val, int argc,
-                             JSValue *argv) {
-  int64_t delay;
-  if (JS_ToInt64(ctx, &delay, argv[1]) != 0) {
-    return JS_EXCEPTION;
+// id 无效或定时器已结束时什么也不做
+void timers_clear(TimerManager *m, int64_t id) {
+  TimerRecord *rec = timer_lookup(m, id);
+  if (!rec)
+    return;
+  if (rec->state == TIMER_SCHEDULED)
+    timer_heap_remove(m, rec->heap_index);
+  JSValue func = rec->func;
+  timer_release(m, rec);
+  JS_FreeValue(m->ctx, func);
+  timers_rearm(m);
+}
+
+static void timers_cb(uv_timer_t *handle) {
+  TimerManager *m = handle->data;
+  JSContext *ctx = m->ctx;
+  uint64_t now = uv_now(m->loop);
+  m->armed = 0;
+
+  // 先把本轮到期的全部取出，回调里新建的 0 延迟定时器留到下一轮
+  if (m->batch_capacity < m->heap_count) {
+    int64_t *batch = realloc(m->batch, m->capacity * sizeof(int64_t));
+    if (!batch) {
+      timers_rearm(m);
+      return;
+    }
+    m->batch = batch;
+    m->batch_capacity = m->capacity;
   }
+  uint32_t count = 0;
+  while (m->heap_count > 0 && m->records[m->heap[0]].due <= now) {
+    uint32_t index = m->heap[0];
+    timer_heap_remove(m, 0);
+    m->records[index].state = TIMER_FIRING;
+    m->batch[count++] = timer_id(m, index);
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (i > 0 && m->deadline && SDL_GetPerformanceCounter() >= m->deadline) {
+      // 超出预算，剩下的按原顺序放回堆中，1ms 后（即下一帧）继续
+      for (; i < count; i++) {
+        TimerRecord *rest = timer_lookup(m, m->batch[i]);
+        if (rest && rest->state == TIMER_FIRING) {
+          rest->state = TIMER_SCHEDULED;
+          timer_heap_push(m, (uint32_t)(rest - m->records));
+        }
+      }
+      if (m->heap_count == 0) {
+        timers_rearm(m);
+        return;
+      }
+      uv_timer_start(&m->handle, timers_cb, 1, 0);
+      m->armed = 1;
+      m->armed_due = m->records[m->heap[0]].due;
+      return;
+    }
+    // 前面的回调可能已经清除了这个定时器
+    TimerRecord *rec = timer_lookup(m, m->batch[i]);
+    if (!rec || rec->state != TIMER_FIRING)
+      continue;
+    JSValue func;
+    if (rec->interval) {
+      rec->due = now + rec->interval;
+      rec->seq = m->next_seq++;
+      rec->state = TIMER_SCHEDULED;
+      timer_heap_push(m, (uint32_t)(rec - m->records));
+      func = JS_DupValue(ctx, rec->func); // 回调里可能 clearInterval
+    } else {
+      func = rec->func;
+      timer_release(m, rec);
+    }
+    JSValue ret = JS_Call(ctx, func, JS_UNDEFINED, 0, NULL);
+    if (JS_IsException(ret)) {
+      js_std_dump_error(ctx);
+    }
+    JS_FreeValue(ctx, ret);
+    JS_FreeValue(ctx, func);
+  }
+  timers_rearm(m);
+}
 
-  JSValue func = JS_DupValue(ctx, argv[0]);
+void timers_init(TimerManager *m, JSContext *ctx, uv_loop_t *loop) {
+  memset(m, 0, sizeof(*m));
+  m->ctx = ctx;
+  m->loop = loop;
+  m->free_head = TIMER_NONE;
+  uv_timer_init(loop, &m->handle);
+  m->handle.data = m;
+  m->handle_open = 1;
+  JS_SetContextOpaque(ctx, m);
+}
 
-  uv_timer_t *timer = malloc(sizeof(uv_timer_t));
-  TimerData *td = malloc(sizeof(TimerData));
-  td->ctx = ctx;
-  td->func = func;
-  td->timer = timer;
-  td->is_interval = 0;
+// 释放所有未触发的定时器并关闭 uv 句柄，之后需要跑一次事件循环完成关闭
+void timers_close(TimerManager *m) {
+  for (uint32_t i = 0; i < m->record_count; i++) {
+    if (m->records[i].state != TIMER_FREE) {
+      JS_FreeValue(m->ctx, m->records[i].func);
+    }
+  }
+  free(m->records);
+  free(m->heap);
+  free(m->batch);
+  m->records = NULL;
+  m->heap = NULL;
+  m->batch = NULL;
+  m->record_count = m->capacity = m->heap_count = m->batch_capacity = 0;
+  m->free_head = TIMER_NONE;
+  if (m->handle_open) {
+    uv_timer_stop(&m->handle);
+    uv_close((uv_handle_t *)&m->handle, NULL);
+    m->handle_open = 0;
+    m->armed = 0;
+  }
+}
 
-  uv_timer_init(uv_default_loop(), timer);
-  timer->data = td;
-  uv_timer_start(timer, timer_cb, delay, 0);
+static JSValue js_setTimer(JSContext *ctx, int argc, JSValue *argv,
+                           int repeat) {
+  TimerManager *m = JS_GetContextOpaque(ctx);
+  if (argc < 1 || !JS_IsFunction(ctx, argv[0])) {
+    return JS_ThrowTypeError(ctx, "%s: expected a function",
+                             repeat ? "setInterval" : "setTimeout");
+  }
+  int64_t delay = 0;
+  if (argc > 1 && JS_ToInt64(ctx, &delay, argv[1]) != 0) {
+    return JS_EXCEPTION;
+  }
+  if (!m || !m->handle_open) {
+    return JS_ThrowInternalError(ctx, "timers are shut down");
+  }
+  int64_t id = timers_add(m, argv[0], delay, repeat);
+  if (id < 0) {
+    return JS_ThrowRangeError(ctx, "too many active timers");
+  }
+  return JS_NewInt64(ctx, id);
+}
 
-  return JS_NewInt64(ctx, (int64_t)timer);
+static JSValue js_setTimeout(JSContext *ctx, JSValue this_val, int argc,
+                             JSValue *argv) {
+  return js_setTimer(ctx, argc, argv, 0);
 }
 
 static JSValue js_setInterval(JSContext *ctx, JSValue this_val, int argc,
                               JSValue *argv) {
-  int64_t interval;
-  if (JS_ToInt64(ctx, &interval, argv[1]) != 0) {
+  return js_setTimer(ctx, argc, argv, 1);
+}
+
+static JSValue js_clearTimer(JSContext *ctx, JSValue this_val, int argc,
+                             JSValue *argv) {
+  TimerManager *m = JS_GetContextOpaque(ctx);
+  int64_t id;
+  if (argc < 1 || !JS_IsNumber(argv[0]) || !m) {
+    return JS_UNDEFINED; // clearTimeout(undefined) 等同于什么也不做
+  }
+  if (JS_ToInt64(ctx, &id, argv[0]) != 0) {
     return JS_EXCEPTION;
   }
+  timers_clear(m, id);
+  return JS_UNDEFINED;
+}
+
+/*-------------------------------------
+ * 帧调度
+ * 每帧给 Promise 任务和定时器回调一个时间预算，超出的部分留到下一帧继续；
+ * 呈现之后到本帧结束前的空闲时间用来执行 requestIdleCallback 回调和 GC。
+ * 自动 GC 的阈值调高，只作为内存持续增长时的兜底
+ *-----------------------------------*/
+#define FRAME_INTERVAL_MS 16
+#define FRAME_JOB_BUDGET_MS 8    // 每帧 JS 任务和定时器回调的预算
+#define IDLE_GC_INTERVAL_MS 1000 // 空闲 GC 的最短间隔
+#define IDLE_GC_MIN_MS 4         // 空闲时间不足时不做 GC
+#define IDLE_CALLBACK_MIN_MS 1   // 剩余时间不足时空闲回调留到下一帧
+#define GC_THRESHOLD (32 * 1024 * 1024)
 
-  JSValue func = JS_DupValue(ctx, argv[0]);
+typedef struct {
+  uint32_t id;
+  JSValue callback; // 已执行或已取消时为 JS_UNDEFINED
+  Uint64 timeout_at; // 超过该时刻即使没有空闲也要执行，0 表示不限
+} IdleCallback;
 
-  uv_timer_t *timer = malloc(sizeof(uv_timer_t));
-  TimerData *td = malloc(sizeof(TimerData));
-  td->ctx = ctx;
-  td->func = func;
-  td->timer = timer;
-  td->is_interval = 1;
+typedef struct {
+  Uint64 frame_start;
+  Uint64 frame_end;     // 本帧结束时刻，呈现之后到此为空闲时间
+  Uint64 job_deadline;  // Promise 任务和定时器回调的截止时刻
+  Uint64 idle_deadline; // 当前空闲回调 timeRemaining() 的参照
+  Uint64 last_gc;
+  IdleCallback *idle;
+  size_t idle_count;
+  size_t idle_capacity;
+  uint32_t next_idle_id;
+} FrameScheduler;
+
+static FrameScheduler scheduler;
+
+static Uint64 scheduler_ticks(double ms) {
+  return (Uint64)(ms * (double)SDL_GetPerformanceFrequency() / 1000.0);
+}
 
-  uv_timer_init(uv_default_loop(), timer);
-  timer->data = td;
-  uv_timer_start(timer, timer_cb, interval, interval);
+static double scheduler_ms_until(Uint64 deadline) {
+  Uint64 now = SDL_GetPerformanceCounter();
+  if (now >= deadline)
+    return 0;
+  return (double)(deadline - now) * 1000.0 /
+         (double)SDL_GetPerformanceFrequency();
+}
 
-  return JS_NewInt64(ctx, (int64_t)timer);
+// QuickJS 每次自动 GC 后会把阈值改成堆大小的 1.5 倍，空闲 GC 之后重新设回：
+// 至少 GC_THRESHOLD，堆已经更大时取两倍，避免紧接着又触发自动 GC
+static void scheduler_reset_gc_threshold(JSRuntime *rt) {
+  JSMemoryUsage usage;
+  JS_ComputeMemoryUsage(rt, &usage);
+  size_t threshold = GC_THRESHOLD;
+  if (usage.malloc_size > 0 && (size_t)usage.malloc_size * 2 > threshold)
+    threshold = (size_t)usage.malloc_size * 2;
+  JS_SetGCThreshold(rt, threshold);
 }
 
-static JSValue js_clearTimer(JSContext *ctx, JSValue this_val, int argc,
-                             JSValue *argv) {
-  int64_t timer_ptr;
-  if (JS_ToInt64(ctx, &timer_ptr, argv[0]) != 0) {
+void scheduler_init(JSRuntime *rt) {
+  JS_SetGCThreshold(rt, GC_THRESHOLD);
+  scheduler.last_gc = SDL_GetPerformanceCounter();
+  scheduler.next_idle_id = 1;
+}
+
+void scheduler_begin_frame(void) {
+  Uint64 now = SDL_GetPerformanceCounter();
+  scheduler.frame_start = now;
+  scheduler.frame_end = now + scheduler_ticks(FRAME_INTERVAL_MS);
+  scheduler.job_deadline = now + scheduler_ticks(FRAME_JOB_BUDGET_MS);
+}
+
+// 在 deadline 之前执行 Promise 任务，至少执行一个。
+// 返回 -1 表示出错，1 表示还有剩余，0 表示已清空
+int scheduler_run_jobs(JSRuntime *rt, Uint64 deadline) {
+  JSContext *ctx;
+  do {
+    int ret = JS_ExecutePendingJob(rt, &ctx);
+    if (ret < 0) {
+      js_std_dump_error(ctx);
+      return -1;
+    }
+    if (ret == 0)
+      return 0;
+  } while (SDL_GetPerformanceCounter() < deadline);
+  return JS_IsJobPending(rt);
+}
+
+static JSValue js_idleTimeRemaining(JSContext *ctx, JSValue this_val, int argc,
+                                    JSValue *argv) {
+  return JS_NewFloat64(ctx, scheduler_ms_until(scheduler.idle_deadline));
+}
+
+// 呈现之后调用：执行空闲回调，仍有空闲时做 GC。返回 -1 表示任务出错
+int scheduler_idle(JSContext *ctx) {
+  JSRuntime *rt = JS_GetRuntime(ctx);
+  scheduler.idle_deadline = scheduler.frame_end;
+
+  // 只处理进入本次空闲前注册的回调，回调里新注册的留到下一帧
+  size_t pending = scheduler.idle_count;
+  for (size_t i = 0; i < pending; i++) {
+    JSValue callback = scheduler.idle[i].callback;
+    if (JS_IsUndefined(callback))
+      continue;
+    Uint64 timeout_at = scheduler.idle[i].timeout_at;
+    int timed_out = timeout_at && SDL_GetPerformanceCounter() >= timeout_at;
+    if (!timed_out &&
+        scheduler_ms_until(scheduler.idle_deadline) < IDLE_CALLBACK_MIN_MS)
+      continue;
+
+    scheduler.idle[i].callback = JS_UNDEFINED;
+    JSValue deadline = JS_NewObject(ctx);
+    JS_SetPropertyStr(ctx, deadline, "didTimeout", JS_NewBool(ctx, timed_out));
+    JS_SetPropertyStr(
+        ctx, deadline, "timeRemaining",
+        JS_NewCFunction(ctx, js_idleTimeRemaining, "timeRemaining", 0));
+    JSValue ret = JS_Call(ctx, callback, JS_UNDEFINED, 1, &deadline);
+    if (JS_IsException(ret)) {
+      js_std_dump_error(ctx);
+    }
+    JS_FreeValue(ctx, ret);
+    JS_FreeValue(ctx, deadline);
+    JS_FreeValue(ctx, callback);
+  }
+
+  // 去掉已执行和已取消的回调
+  size_t kept = 0;
+  for (size_t i = 0; i < scheduler.idle_count; i++) {
+    if (!JS_IsUndefined(scheduler.idle[i].callback))
+      scheduler.idle[kept++] = scheduler.idle[i];
+  }
+  scheduler.idle_count = kept;
+
+  // 上一阶段剩下的 Promise 任务也在空闲时间里继续
+  if (JS_IsJobPending(rt) && scheduler_run_jobs(rt, scheduler.frame_end) < 0)
+    return -1;
+
+  Uint64 now = SDL_GetPerformanceCounter();
+  if (scheduler_ms_until(scheduler.frame_end) >= IDLE_GC_MIN_MS &&
+      now - scheduler.last_gc >= scheduler_ticks(IDLE_GC_INTERVAL_MS)) {
+    JS_RunGC(rt);
+    scheduler_reset_gc_threshold(rt);
+    scheduler.last_gc = SDL_GetPerformanceCounter();
+  }
+  return 0;
+}
+
+// 有窗口时睡到本帧结束，代替固定的 SDL_Delay(16)
+void scheduler_end_frame(void) {
+  double ms = scheduler_ms_until(scheduler.frame_end);
+  if (ms >= 1)
+    SDL_Delay((Uint32)ms);
+}
+
+void scheduler_free(JSContext *ctx) {
+  for (size_t i = 0; i < scheduler.idle_count; i++) {
+    JS_FreeValue(ctx, scheduler.idle[i].callback);
+  }
+  free(scheduler.idle);
+  scheduler.idle = NULL;
+  scheduler.idle_count = scheduler.idle_capacity = 0;
+}
+
+static JSValue js_requestIdleCallback(JSContext *ctx, JSValue this_val,
+                                      int argc, JSValue *argv) {
+  if (argc < 1 || !JS_IsFunction(ctx, argv[0])) {
+    return JS_ThrowTypeError(ctx, "requestIdleCallback: expected a function");
+  }
+  Uint64 timeout_at = 0;
+  if (argc > 1 && JS_IsObject(argv[1])) {
+    JSValue timeout = JS_GetPropertyStr(ctx, argv[1], "timeout");
+    double ms = 0;
+    int ret = JS_IsUndefined(timeout) ? 0 : JS_ToFloat64(ctx, &ms, timeout);
+    JS_FreeValue(ctx, timeout);
+    if (ret != 0)
+      return JS_EXCEPTION;
+    if (ms > 0)
+      timeout_at = SDL_GetPerformanceCounter() + scheduler_ticks(ms);
+  }
+  if (scheduler.idle_count == scheduler.idle_capacity) {
+    size_t capacity =
+        scheduler.idle_capacity ? scheduler.idle_capacity * 2 : 16;
+    IdleCallback *idle =
+        realloc(scheduler.idle, capacity * sizeof(IdleCallback));
+    if (!idle)
+      return JS_ThrowOutOfMemory(ctx);
+    scheduler.idle = idle;
+    scheduler.idle_capacity = capacity;
+  }
+  uint32_t id = scheduler.next_idle_id++;
+  if (scheduler.next_idle_id == 0)
+    scheduler.next_idle_id = 1;
+  scheduler.idle[scheduler.idle_count++] =
+      (IdleCallback){id, JS_DupValue(ctx, argv[0]), timeout_at};
+  return JS_NewUint32(ctx, id);
+}
+
+static JSValue js_cancelIdleCallback(JSContext *ctx, JSValue this_val,
+                                     int argc, JSValue *argv) {
+  uint32_t id;
+  if (JS_ToUint32(ctx, &id, argv[0]) != 0) {
     return JS_EXCEPTION;
   }
+  for (size_t i = 0; i < scheduler.idle_count; i++) {
+    if (scheduler.idle[i].id == id) {
+      JSValue callback = scheduler.idle[i].callback;
+      scheduler.idle[i].callback = JS_UNDEFINED;
+      JS_FreeValue(ctx, callback);
+      break;
+    }
+  }
+  return JS_UNDEFINED;
+}
+
+/*-------------------------------------
+ * 动画帧回调
+ * requestAnimationFrame 的回调在主循环里每帧执行一次，时机在布局和绘制之前，
+ * 同一帧内的所有修改只触发一次布局和绘制。回调执行期间新注册的回调留到下一帧
+ *-----------------------------------*/
+typedef struct {
+  uint32_t id;
+  JSValue callback; // 已取消或正在执行时为 JS_UNDEFINED
+} FrameCallback;
+
+static struct {
+  FrameCallback *items;
+  size_t count;
+  size_t capacity;
+  uint32_t next_id;
+  Uint64 origin; // 时间戳的零点，与 performance.now() 一致
+} frame_callbacks;
+
+void animation_frames_init(void) {
+  frame_callbacks.origin = SDL_GetPerformanceCounter();
+  frame_callbacks.next_id = 1;
+}
+
+// 从启动开始经过的毫秒数，精度取决于性能计数器
+double animation_frame_now(void) {
+  Uint64 elapsed = SDL_GetPerformanceCounter() - frame_callbacks.origin;
+  return (double)elapsed * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+// 执行本帧之前注册的回调，返回执行的回调数；所有回调拿到同一个帧时间戳。
+// 随后的 Promise 任务出错时返回 -1，与主循环处理任务出错的方式一致
+int run_animation_frames(JSContext *ctx) {
+  size_t pending = frame_callbacks.count;
+  if (pending == 0)
+    return 0;
+
+  int ran = 0;
+  JSValue timestamp = JS_NewFloat64(ctx, animation_frame_now());
+  for (size_t i = 0; i < pending; i++) {
+    // 回调里可能注册新回调导致数组扩容，每次都按下标重新取
+    JSValue callback = frame_callbacks.items[i].callback;
+    if (JS_IsUndefined(callback))
+      continue;
+    frame_callbacks.items[i].callback = JS_UNDEFINED;
+    JSValue ret = JS_Call(ctx, callback, JS_UNDEFINED, 1, &timestamp);
+    if (JS_IsException(ret)) {
+      js_std_dump_error(ctx);
+    }
+    JS_FreeValue(ctx, ret);
+    JS_FreeValue(ctx, callback);
+    ran++;
+  }
+  JS_FreeValue(ctx, timestamp);
+
+  frame_callbacks.count -= pending;
+  memmove(frame_callbacks.items, frame_callbacks.items + pending,
+          frame_callbacks.count * sizeof(FrameCallback));
+
+  // 回调里产生的 Promise 任务也要在本帧布局之前完成，但不超过本帧
+  if (scheduler_run_jobs(JS_GetRuntime(ctx), scheduler.frame_end) < 0)
+    return -1;
+  return ran;
+}
+
+void animation_frames_free(JSContext *ctx) {
+  for (size_t i = 0; i < frame_callbacks.count; i++) {
+    JS_FreeValue(ctx, frame_callbacks.items[i].callback);
+  }
+  free(frame_callbacks.items);
+  frame_callbacks.items = NULL;
+  frame_callbacks.count = 0;
+  frame_callbacks.capacity = 0;
+}
 
-  uv_timer_t *timer = (uv_timer_t *)timer_ptr;
-  uv_timer_stop(timer);
-  uv_close((uv_handle_t *)timer, timer_close_cb); // 使用统一回调
+static JSValue js_requestAnimationFrame(JSContext *ctx, JSValue this_val,
+                                        int argc, JSValue *argv) {
+  if (argc < 1 || !JS_IsFunction(ctx, argv[0])) {
+    return JS_ThrowTypeError(ctx, "requestAnimationFrame: expected a function");
+  }
+  if (frame_callbacks.count == frame_callbacks.capacity) {
+    size_t capacity =
+        frame_callbacks.capacity ? frame_callbacks.capacity * 2 : 16;
+    FrameCallback *items =
+        realloc(frame_callbacks.items, capacity * sizeof(FrameCallback));
+    if (!items)
+      return JS_ThrowOutOfMemory(ctx);
+    frame_callbacks.items = items;
+    frame_callbacks.capacity = capacity;
+  }
+  uint32_t id = frame_callbacks.next_id++;
+  if (frame_callbacks.next_id == 0)
+    frame_callbacks.next_id = 1;
+  frame_callbacks.items[frame_callbacks.count++] =
+      (FrameCallback){id, JS_DupValue(ctx, argv[0])};
+  return JS_NewUint32(ctx, id);
+}
 
+static JSValue js_cancelAnimationFrame(JSContext *ctx, JSValue this_val,
+                                       int argc, JSValue *argv) {
+  uint32_t id;
+  if (JS_ToUint32(ctx, &id, argv[0]) != 0) {
+    return JS_EXCEPTION;
+  }
+  for (size_t i = 0; i < frame_callbacks.count; i++) {
+    if (frame_callbacks.items[i].id == id) {
+      JSValue callback = frame_callbacks.items[i].callback;
+      frame_callbacks.items[i].callback = JS_UNDEFINED;
+      JS_FreeValue(ctx, callback);
+      break;
+    }
+  }
   return JS_UNDEFINED;
 }
 
+static JSValue js_performanceNow(JSContext *ctx, JSValue this_val, int argc,
+                                 JSValue *argv) {
+  return JS_NewFloat64(ctx, animation_frame_now());
+}
+
 int readfile(const char *filename, char **out) {
   FILE *f = fopen(filename, "rb");
   if (!f)
@@ -153,736 +741,6549 @@ void cleanup_resources(JSRuntime *rt, JSContext *ctx, uv_loop_t *loop,
 }
 
 /*-------------------------------------
- * 颜色结构体定义
+ * 字节码缓存
+ * 脚本编译成 QuickJS 字节码（JS_WriteObject）后写入缓存文件，
+ * 文件头记录源码的哈希和长度以及构建标识。之后启动时 mmap 缓存，
+ * 校验通过就用 JS_ReadObject 直接载入，省去解析和编译；
+ * 源码变化或换了构建则回退到源码编译并重写缓存。
+ * 源码文件不存在时直接信任缓存，便于只部署预编译结果（--precompile）
  *-----------------------------------*/
-typedef struct {
-  Uint8 r, g, b, a;
-} Color;
+#define BYTECODE_MAGIC 0x43424459u // "YDBC"
+#define BYTECODE_VERSION 1
 
-// 预设颜色
-static const Color COLOR_TRANSPARENT = {255, 255, 255, 0};
-static const Color COLOR_WHITE = {255, 255, 255, 255};
-static const Color COLOR_BLACK = {0, 0, 0, 255};
-static const Color COLOR_RED = {255, 0, 0, 255};
-static const Color COLOR_HIGHLIGHT = {255, 255, 0, 255}; // 选中高亮色
-
-/*-------------------------------------
- * 样式结构体定义
- *-----------------------------------*/
-typedef struct NodeStyle {
-  // 布局属性
-  float flex;
-  float margin;
-  YGFlexDirection flexDirection;
-  YGJustify justifyContent;
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t build_hash; // 字节码格式随 QuickJS 构建变化，换构建后缓存作废
+  uint64_t source_hash;
+  uint64_t source_size;
+  uint64_t bytecode_size;
+} BytecodeHeader;
+
+static uint64_t fnv1a64(const void *data, size_t size, uint64_t hash) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
 
-  // 渲染属性
-  Color backgroundColor;
-  Color borderColor;
-} NodeStyle;
+// 由构建脚本传入链接的 QuickJS 版本
+#ifndef QUICKJS_VERSION
+#define QUICKJS_VERSION "unknown"
+#endif
+
+// 构建标识：QuickJS 版本和指针宽度，再加上当前 QuickJS 序列化一个
+// 小函数得到的字节码，版本号没变但字节码格式变了也能察觉。不混入编译
+// 时间，重新编译宿主不会让已有缓存全部失效
+static uint64_t bytecode_build_hash(JSContext *ctx) {
+  static const char build[] = QUICKJS_VERSION;
+  uint64_t hash = fnv1a64(build, sizeof(build), 14695981039346656037ull);
+  size_t word = sizeof(void *);
+  hash = fnv1a64(&word, sizeof(word), hash);
+
+  static const char probe_source[] = "(a, b) => a + b";
+  JSValue probe = JS_Eval(ctx, probe_source, sizeof(probe_source) - 1,
+                          "<build>", JS_EVAL_FLAG_COMPILE_ONLY);
+  if (JS_IsException(probe)) {
+    JSValue error = JS_GetException(ctx);
+    JS_FreeValue(ctx, error);
+    return hash;
+  }
+  size_t size;
+  uint8_t *bytecode = JS_WriteObject(ctx, &size, probe, JS_WRITE_OBJ_BYTECODE);
+  JS_FreeValue(ctx, probe);
+  if (bytecode) {
+    hash = fnv1a64(bytecode, size, hash);
+    js_free(ctx, bytecode);
+  }
+  return hash;
+}
 
-// 定义事件监听器结构体
-typedef struct EventListener {
-  char *event_type; // 事件类型
-  JSValue callback; // 回调函数
-  struct EventListener *next;
-} EventListener;
+// 默认缓存路径：脚本路径加 .qbc 后缀，调用方 free
+char *bytecode_cache_path(const char *script_path) {
+  size_t len = strlen(script_path);
+  char *path = malloc(len + 5);
+  memcpy(path, script_path, len);
+  memcpy(path + len, ".qbc", 5);
+  return path;
+}
 
-typedef enum {
-  NODE, // 普通节点
-  TEXT  // 文字节点
-} NodeType;
+// 校验通过时返回读入的模块函数；缓存不存在或过期时返回 JS_UNDEFINED。
+// source 为 NULL 表示没有源码可比对
+JSValue bytecode_cache_load(JSContext *ctx, const char *cache_path,
+                            const char *source, size_t source_size) {
+  int fd = open(cache_path, O_RDONLY);
+  if (fd < 0)
+    return JS_UNDEFINED;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BytecodeHeader)) {
+    close(fd);
+    return JS_UNDEFINED;
+  }
+  size_t size = (size_t)st.st_size;
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return JS_UNDEFINED;
 
-/*-------------------------------------
- * 树节点结构体定义
- *-----------------------------------*/
-typedef struct TreeNode {
-  int id;
-  NodeType node_type;
-  char *text;
-  // int js_refcount; // 新增：JavaScript引用计数
-  NodeStyle *style;
-  int childCount;
-  struct TreeNode **children;
-  struct TreeNode *parent;
-  YGNodeRef yogaNode;
-  EventListener *event_listeners; // 存储事件监听器
-} TreeNode;
+  JSValue func = JS_UNDEFINED;
+  BytecodeHeader header;
+  memcpy(&header, map, sizeof(header));
+  int valid = header.magic == BYTECODE_MAGIC &&
+              header.version == BYTECODE_VERSION &&
+              header.build_hash == bytecode_build_hash(ctx) &&
+              header.bytecode_size == size - sizeof(header);
+  if (valid && source) {
+    valid = header.source_size == source_size &&
+            header.source_hash ==
+                fnv1a64(source, source_size, 14695981039346656037ull);
+  }
+  if (valid) {
+    // JS_ReadObject 会复制所需的数据，读完即可解除映射
+    func = JS_ReadObject(ctx, (const uint8_t *)map + sizeof(header),
+                         header.bytecode_size, JS_READ_OBJ_BYTECODE);
+    if (JS_IsException(func)) {
+      // 缓存损坏时当作过期处理
+      JSValue error = JS_GetException(ctx);
+      JS_FreeValue(ctx, error);
+      func = JS_UNDEFINED;
+    }
+  }
+  munmap(map, size);
+  return func;
+}
 
-/*-------------------------------------
- * 全局状态
- *-----------------------------------*/
-GHashTable *nodeIdMap = NULL;
-TreeNode *selectedNode = NULL;
-YGNodeRef yogaRoot = NULL;
-TreeNode *root_data = NULL;
-int nextNodeId = 0;
-int VIEW_WIDTH = 1000;
-int VIEW_HEIGHT = 600;
+// 先写临时文件再改名，并发启动时不会读到写了一半的缓存
+int bytecode_cache_store(JSContext *ctx, const char *cache_path,
+                         JSValueConst func, const char *source,
+                         size_t source_size) {
+  size_t bytecode_size;
+  uint8_t *bytecode =
+      JS_WriteObject(ctx, &bytecode_size, func, JS_WRITE_OBJ_BYTECODE);
+  if (!bytecode)
+    return -1;
 
-/*-------------------------------------
- * 核心功能实现
- *-----------------------------------*/
-Color parse_color(const char *hex) {
-  Color color = COLOR_BLACK;
-  if (hex && hex[0] == '#') {
-    unsigned int rgb = 0;
-    sscanf(hex + 1, "%x", &rgb);
-    if (strlen(hex + 1) == 6) {
-      color.r = (rgb >> 16) & 0xFF;
-      color.g = (rgb >> 8) & 0xFF;
-      color.b = rgb & 0xFF;
-    } else if (strlen(hex + 1) == 3) {
-      color.r = ((rgb >> 8) & 0xF) * 17;
-      color.g = ((rgb >> 4) & 0xF) * 17;
-      color.b = (rgb & 0xF) * 17;
+  BytecodeHeader header = {
+      .magic = BYTECODE_MAGIC,
+      .version = BYTECODE_VERSION,
+      .build_hash = bytecode_build_hash(ctx),
+      .source_hash = fnv1a64(source, source_size, 14695981039346656037ull),
+      .source_size = source_size,
+      .bytecode_size = bytecode_size,
+  };
+  // 临时文件名由 mkstemp 生成，同时启动的多个进程不会写到同一个文件
+  size_t path_len = strlen(cache_path);
+  char *tmp_path = malloc(path_len + 8);
+  memcpy(tmp_path, cache_path, path_len);
+  memcpy(tmp_path + path_len, ".XXXXXX", 8);
+
+  int ret = -1;
+  int fd = mkstemp(tmp_path);
+  FILE *f = NULL;
+  if (fd >= 0) {
+    fchmod(fd, 0644);
+    f = fdopen(fd, "wb");
+    if (!f) {
+      close(fd);
+      remove(tmp_path);
     }
   }
-  return color;
+  if (f) {
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fwrite(bytecode, bytecode_size, 1, f) == 1;
+    ok = fclose(f) == 0 && ok;
+    if (ok && rename(tmp_path, cache_path) == 0)
+      ret = 0;
+    else
+      remove(tmp_path);
+  }
+  free(tmp_path);
+  js_free(ctx, bytecode);
+  return ret;
 }
 
-YGNodeRef create_yoga_node(TreeNode *data) {
-  YGNodeRef yogaNode = YGNodeNew();
-  YGNodeStyleSetFlex(yogaNode, data->style->flex);
-  YGNodeStyleSetMargin(yogaNode, YGEdgeAll, data->style->margin);
-  YGNodeStyleSetFlexDirection(yogaNode, data->style->flexDirection);
-  YGNodeStyleSetJustifyContent(yogaNode, data->style->justifyContent);
-  return yogaNode;
+// 只编译不执行，返回模块函数
+static JSValue compile_module(JSContext *ctx, const char *source,
+                              size_t source_size, const char *script_path) {
+  return JS_Eval(ctx, source, source_size, script_path,
+                 JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
 }
 
-TreeNode *create_node(NodeType node_type, const char *text, float flex,
-                      float margin, YGFlexDirection flexDirection,
-                      YGJustify justifyContent) {
-  TreeNode *node = (TreeNode *)malloc(sizeof(TreeNode));
-  node->id = ++nextNodeId;
-  g_hash_table_insert(nodeIdMap, &node->id, node);
+// 执行脚本：优先使用有效的缓存，否则编译源码并更新缓存（cache_path 为 NULL
+// 时不使用缓存）。source 为 NULL 时只能从缓存载入
+JSValue eval_script(JSContext *ctx, const char *script_path,
+                    const char *cache_path, const char *source,
+                    size_t source_size) {
+  JSValue func = JS_UNDEFINED;
+  if (cache_path)
+    func = bytecode_cache_load(ctx, cache_path, source, source_size);
+  if (JS_IsUndefined(func)) {
+    if (!source)
+      return JS_ThrowInternalError(ctx, "no source or valid bytecode for %s",
+                                   script_path);
+    func = compile_module(ctx, source, source_size, script_path);
+    if (JS_IsException(func))
+      return func;
+    if (cache_path && bytecode_cache_store(ctx, cache_path, func, source,
+                                           source_size) != 0) {
+      fprintf(stderr, "Warning: failed to write bytecode cache %s\n",
+              cache_path);
+    }
+  }
+  if (JS_ResolveModule(ctx, func) < 0) {
+    JS_FreeValue(ctx, func);
+    return JS_EXCEPTION;
+  }
+  return JS_EvalFunction(ctx, func);
+}
 
-  node->node_type = node_type;
-  if (node_type == TEXT) {
-    node->text = strdup(text); // 复制文字内容
-  } else {
-    node->text = NULL;
+// --precompile：编译并写出缓存后退出
+int precompile_script(JSContext *ctx, const char *script_path,
+                      const char *cache_path, const char *source,
+                      size_t source_size) {
+  JSValue func = compile_module(ctx, source, source_size, script_path);
+  if (JS_IsException(func)) {
+    js_std_dump_error(ctx);
+    return -1;
+  }
+  int ret = bytecode_cache_store(ctx, cache_path, func, source, source_size);
+  JS_FreeValue(ctx, func);
+  if (ret != 0) {
+    fprintf(stderr, "Error writing bytecode cache: %s\n", cache_path);
   }
+  return ret;
+}
 
-  node->style = (NodeStyle *)malloc(sizeof(NodeStyle));
-  node->style->flex = flex;
-  node->style->margin = margin;
-  node->style->flexDirection = flexDirection;
-  node->style->justifyContent = justifyContent;
-  // 初始化白底黑边
-  node->style->backgroundColor = COLOR_WHITE;
-  node->style->borderColor = COLOR_BLACK;
-  node->childCount = 0;
-  node->children = NULL;
-  node->parent = NULL;
-  node->event_listeners = NULL;
+/*-------------------------------------
+ * Worker
+ * new Worker(path) 在独立线程上创建一套 QuickJS 运行时执行脚本，
+ * 与 UI 线程之间只通过消息通信：消息用 JS_WriteObject/JS_ReadObject 结构化克隆，
+ * 放进对方的收件队列后用 uv_async_t 唤醒对方的事件循环。
+ * transfer 列表里的 ArrayBuffer 不参与序列化，内存块直接移交给接收方：
+ * 消息中引用这些缓冲区（或其上的类型化数组）的位置先记下路径，序列化时这些位置
+ * 为 undefined，接收方反序列化后按路径放回移交过来的缓冲区
+ *-----------------------------------*/
+typedef struct {
+  uint8_t *data;
+  size_t size;
+} TransferBlock;
 
-  node->yogaNode = create_yoga_node(node);
+// 消息中引用被转移缓冲区的一处位置
+typedef struct {
+  uint32_t transfer; // transfers 下标
+  char **path;       // 自消息根起的属性名，path_len 为 0 表示消息本身
+  uint32_t path_len;
+  int view;          // transfer_view_ctors 下标，-1 表示 ArrayBuffer 本身
+  size_t offset;     // 视图的字节偏移
+  size_t length;     // 视图的元素个数
+} TransferSlot;
+
+typedef struct WorkerMessage {
+  struct WorkerMessage *next;
+  uint8_t *data; // 序列化后的消息，NULL 表示 worker 线程已退出
+  size_t size;
+  uint32_t transfer_count;
+  TransferBlock *transfers;
+  uint32_t slot_count;
+  TransferSlot *slots;
+} WorkerMessage;
 
-  return node;
+typedef struct {
+  SDL_mutex *lock;
+  WorkerMessage *head;
+  WorkerMessage *tail;
+  int closed;       // 接收方已关闭 async 句柄，不能再投递
+  uv_async_t async; // 挂在接收方的事件循环上
+} MessageQueue;
+
+typedef struct Worker {
+  char *script_path;
+  SDL_Thread *thread;
+  SDL_atomic_t terminating;
+  uv_loop_t loop;      // worker 线程自己的事件循环
+  MessageQueue inbox;  // UI → worker
+  MessageQueue outbox; // worker → UI，挂在主循环上
+  uv_prepare_t jobs;   // 每轮循环前执行 Promise 任务
+
+  // 以下只在 worker 线程访问
+  JSContext *ctx;
+  TimerManager timers;
+  int stopping;
+
+  // 以下只在 UI 线程访问
+  JSContext *ui_ctx;
+  JSValue object; // UI 侧的 Worker 对象，线程运行期间保持存活
+  int joined;
+  struct Worker *next;
+} Worker;
+
+static JSClassID worker_class_id;
+static JSClassDef worker_class = {"Worker"};
+static Worker *workers;                      // UI 线程上所有未结束的 worker
+static _Thread_local Worker *worker_current; // worker 线程内指向自身
+
+/*
+ * 转移过来的 ArrayBuffer 由 transfer_owners 登记，再次转移时直接交出内存块。
+ * JS 自己分配的 ArrayBuffer 的内存由 QuickJS 的分配器管理，分离时随即释放，
+ * 没有接口可以接管，因此第一次转移时复制一次；之后在线程间往返不再复制
+ */
+typedef struct {
+  int moved; // 内存块已交给别的消息，分离时不释放
+} TransferOwner;
+
+static SDL_mutex *transfer_lock;
+static GHashTable *transfer_owners; // data → TransferOwner
+
+static void transfer_buffer_free(JSRuntime *rt, void *opaque, void *ptr) {
+  TransferOwner *owner = opaque;
+  SDL_LockMutex(transfer_lock);
+  if (g_hash_table_lookup(transfer_owners, ptr) == owner)
+    g_hash_table_remove(transfer_owners, ptr);
+  SDL_UnlockMutex(transfer_lock);
+  if (!owner->moved)
+    free(ptr);
+  free(owner);
 }
 
-void set_node_text(TreeNode *node, const char *text) {
-  if (!node || node->node_type != TEXT) {
-    return;
+// 把发送方的 ArrayBuffer 交出去并分离，失败时已抛出异常
+static int transfer_block_take(JSContext *ctx, JSValueConst buffer,
+                               TransferBlock *block) {
+  size_t size;
+  uint8_t *data = JS_GetArrayBuffer(ctx, &size, buffer);
+  if (!data)
+    return -1;
+  SDL_LockMutex(transfer_lock);
+  TransferOwner *owner = g_hash_table_lookup(transfer_owners, data);
+  if (owner)
+    owner->moved = 1;
+  SDL_UnlockMutex(transfer_lock);
+  if (owner) {
+    block->data = data;
+  } else {
+    block->data = malloc(size ? size : 1);
+    memcpy(block->data, data, size);
   }
-  free(node->text);          // 释放旧的文字内容
-  node->text = strdup(text); // 复制新的文字内容
+  block->size = size;
+  JS_DetachArrayBuffer(ctx, buffer);
+  return 0;
 }
 
-void free_tree(JSContext *ctx, TreeNode *node) {
-  if (node) {
-    if (node->node_type == TEXT) {
-      free(node->text);
-    }
-    EventListener *listener = node->event_listeners;
-    while (listener) {
-      EventListener *next = listener->next;
-      JS_FreeValue(ctx, listener->callback);
-      free(listener->event_type);
-      free(listener);
-      listener = next;
-    }
-    node->event_listeners = NULL;
-    for (int i = 0; i < node->childCount; i++) {
-      free_tree(ctx, node->children[i]);
-    }
-    YGNodeFree(node->yogaNode);
-    free(node->children);
-    g_hash_table_remove(nodeIdMap, &node->id);
-    free(node->style);
-    free(node);
+// 接收方用内存块直接创建 ArrayBuffer，不复制
+static JSValue transfer_block_wrap(JSContext *ctx, TransferBlock *block) {
+  TransferOwner *owner = malloc(sizeof(TransferOwner));
+  owner->moved = 0;
+  SDL_LockMutex(transfer_lock);
+  g_hash_table_insert(transfer_owners, block->data, owner);
+  SDL_UnlockMutex(transfer_lock);
+  JSValue buffer = JS_NewArrayBuffer(ctx, block->data, block->size,
+                                     transfer_buffer_free, owner, 0);
+  if (JS_IsException(buffer)) {
+    transfer_buffer_free(JS_GetRuntime(ctx), owner, block->data);
   }
+  block->data = NULL;
+  return buffer;
 }
 
-void add_listener(JSContext *ctx, TreeNode *node, const char *event_type,
-                  JSValue callback) {
-  if (!node || !event_type || JS_IsNull(callback) || JS_IsUndefined(callback)) {
-    return;
+static void worker_message_free(WorkerMessage *msg) {
+  for (uint32_t i = 0; i < msg->transfer_count; i++) {
+    free(msg->transfers[i].data); // 未被接收方接管的内存块
   }
-  // printf("step into add_listener %s id: %d\n", event_type, node->id);
-  // 分配内存并初始化新的事件监听器
-  EventListener *new_listener = malloc(sizeof(EventListener));
-  new_listener->event_type = strdup(event_type);
-  new_listener->callback = JS_DupValue(ctx, callback);
-  new_listener->next = NULL;
-  // 将新监听器添加到链表头部
-  EventListener *current = node->event_listeners;
-  if (current == NULL) {
-    node->event_listeners = new_listener;
-  } else {
-    new_listener->next = current;
-    node->event_listeners = new_listener;
+  free(msg->transfers);
+  for (uint32_t i = 0; i < msg->slot_count; i++) {
+    for (uint32_t j = 0; j < msg->slots[i].path_len; j++)
+      free(msg->slots[i].path[j]);
+    free(msg->slots[i].path);
   }
+  free(msg->slots);
+  free(msg->data);
+  free(msg);
 }
 
-void remove_listener(JSContext *ctx, TreeNode *node, const char *event_type,
-                     JSValue callback) {
-  if (!node || !event_type || JS_IsNull(callback) || JS_IsUndefined(callback)) {
-    return;
+/*
+ * 类型化数组的内建构造函数和原型，在各线程的上下文创建后、脚本运行前取得。
+ * 识别视图只比较原型，重建视图只用这里的构造函数，脚本改写全局的
+ * Uint8Array、ArrayBuffer.isView 等都不影响
+ */
+static const char *const transfer_view_names[] = {
+    "Uint8Array",   "Uint8ClampedArray", "Int8Array",
+    "Uint16Array",  "Int16Array",        "Uint32Array",
+    "Int32Array",   "Float32Array",      "Float64Array",
+    "BigInt64Array", "BigUint64Array"};
+#define TRANSFER_VIEW_COUNT                                                    \
+  (int)(sizeof(transfer_view_names) / sizeof(transfer_view_names[0]))
+
+static _Thread_local JSValue transfer_view_ctors[TRANSFER_VIEW_COUNT];
+static _Thread_local JSValue transfer_view_protos[TRANSFER_VIEW_COUNT];
+
+static void transfer_views_init(JSContext *ctx) {
+  JSValue global = JS_GetGlobalObject(ctx);
+  for (int i = 0; i < TRANSFER_VIEW_COUNT; i++) {
+    JSValue ctor = JS_GetPropertyStr(ctx, global, transfer_view_names[i]);
+    transfer_view_ctors[i] = ctor;
+    transfer_view_protos[i] = JS_IsObject(ctor)
+                                  ? JS_GetPropertyStr(ctx, ctor, "prototype")
+                                  : JS_UNDEFINED;
   }
+  JS_FreeValue(ctx, global);
+}
 
-  // printf("step into remove_listener %s id: %d\n", event_type, node->id);
-
-  EventListener **prev_ptr = &node->event_listeners;
-  EventListener *current = node->event_listeners;
-
-  while (current) {
-    if (strcmp(current->event_type, event_type) == 0 &&
-        JS_VALUE_GET_OBJ(current->callback) == JS_VALUE_GET_OBJ(callback)) {
-      // 移除当前节点
-      *prev_ptr = current->next;
-      JS_FreeValue(ctx, current->callback); // 使用传入的 ctx
-      free(current->event_type);
-      free(current);
-      break;
-    }
-    prev_ptr = &current->next;
-    current = current->next;
+// 必须在 JS_FreeContext 之前调用
+void transfer_views_free(JSContext *ctx) {
+  for (int i = 0; i < TRANSFER_VIEW_COUNT; i++) {
+    JS_FreeValue(ctx, transfer_view_ctors[i]);
+    JS_FreeValue(ctx, transfer_view_protos[i]);
+    transfer_view_ctors[i] = JS_UNDEFINED;
+    transfer_view_protos[i] = JS_UNDEFINED;
   }
 }
 
-static JSClassID tree_node_class_id;
-
-JSValue wrap_node(JSContext *ctx, TreeNode *node) {
-  // 创建对象并关联类
-  JSValue obj = JS_NewObjectClass(ctx, tree_node_class_id);
-  if (JS_IsException(obj))
-    return obj;
-
-  // 绑定 C 指针到 JS 对象
-  JS_SetOpaque(obj, node);
-  // node->js_refcount++; // 增加引用计数
-  return obj;
+// value 是 ArrayBuffer 或类型化数组时返回 1：*data 为其内存块，*view 为
+// transfer_view_ctors 下标（ArrayBuffer 本身为 -1）。原型不是内建原型的视图
+// 无法在接收方重建，*data 置为 NULL，按值复制。不是缓冲区时清除异常返回 0
+static int transfer_classify(JSContext *ctx, JSValueConst value,
+                             uint8_t **data, int *view, size_t *offset,
+                             size_t *length) {
+  size_t size;
+  *view = -1;
+  *offset = *length = 0;
+  *data = JS_GetArrayBuffer(ctx, &size, value);
+  if (*data)
+    return 1;
+  JS_FreeValue(ctx, JS_GetException(ctx));
+
+  size_t byte_length, element_size;
+  JSValue buffer = JS_GetTypedArrayBuffer(ctx, value, offset, &byte_length,
+                                          &element_size);
+  if (JS_IsException(buffer)) {
+    // DataView 也走这里，与普通对象一样交给结构化克隆
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    return 0;
+  }
+  *data = JS_GetArrayBuffer(ctx, &size, buffer);
+  JS_FreeValue(ctx, buffer);
+  if (!*data) {
+    JS_FreeValue(ctx, JS_GetException(ctx)); // 已分离
+    return 1;
+  }
+  // 类型化数组一定是普通对象，返回的原型不增加引用计数，也不会调用脚本
+  JSValue proto = JS_GetPrototype(ctx, value);
+  for (int i = 0; i < TRANSFER_VIEW_COUNT; i++) {
+    if (JS_IsObject(transfer_view_protos[i]) &&
+        JS_VALUE_GET_PTR(proto) == JS_VALUE_GET_PTR(transfer_view_protos[i]))
+      *view = i;
+  }
+  if (*view < 0)
+    *data = NULL;
+  *length = byte_length / element_size;
+  return 1;
 }
 
-void dispatch_event(JSContext *ctx, TreeNode *node, const char *event_type) {
-  if (!node || !event_type)
-    return;
+/*
+ * 发送方只读地遍历消息图，找出引用被转移缓冲区的属性并记下路径。
+ * 发送方的对象不做任何改动：从消息根到这些属性的一条条路径上的对象
+ * 各做一份浅拷贝（替身），替身里这些属性为 undefined，序列化的是替身。
+ * 只遍历自有的可枚举字符串属性，与结构化克隆的范围一致
+ */
+#define TRANSFER_WALK_MAX_DEPTH 64
 
-  // 创建合成事件对象（仅包含必要字段）
-  JSValue event_obj = JS_NewObject(ctx);
-  JS_SetPropertyStr(ctx, event_obj, "type", JS_NewString(ctx, event_type));
-  JS_SetPropertyStr(ctx, event_obj, "target",
-                    wrap_node(ctx, node)); // wrap_node 需提前实现
-
-  // 遍历当前节点的监听器
-  EventListener *listener = node->event_listeners;
-  while (listener) {
-    if (strcmp(listener->event_type, event_type) == 0) {
-      // 调用 JS 回调函数
-      JSValue ret =
-          JS_Call(ctx, listener->callback, JS_UNDEFINED, 1, &event_obj);
-      if (JS_IsException(ret)) {
-        // 处理异常（例如打印错误）
-        js_std_dump_error(ctx);
-      }
-      JS_FreeValue(ctx, ret);
-    }
-    listener = listener->next;
+typedef struct {
+  JSContext *ctx;
+  WorkerMessage *msg;
+  uint8_t **buffers; // 被转移缓冲区的内存块，下标即 transfers 下标
+  uint32_t buffer_count;
+  GHashTable *active; // 当前路径上的对象，遇到环时不再深入
+  JSAtom path[TRANSFER_WALK_MAX_DEPTH];
+  uint32_t depth;
+} TransferWalk;
+
+static int transfer_walk_index(TransferWalk *w, const uint8_t *data) {
+  for (uint32_t i = 0; data && i < w->buffer_count; i++) {
+    if (w->buffers[i] == data)
+      return (int)i;
   }
-
-  // 释放事件对象
-  JS_FreeValue(ctx, event_obj);
+  return -1;
 }
 
-// 解包 JS 对象为 TreeNode*
-TreeNode *unwrap_node(JSContext *ctx, JSValueConst val) {
-  if (!JS_IsObject(val)) {
-    JS_ThrowTypeError(ctx, "Expected TreeNode object");
-    return NULL;
+static void transfer_walk_add_slot(TransferWalk *w, int index, int view,
+                                   size_t offset, size_t length) {
+  WorkerMessage *msg = w->msg;
+  msg->slots = realloc(msg->slots, sizeof(TransferSlot) * (msg->slot_count + 1));
+  TransferSlot *slot = &msg->slots[msg->slot_count++];
+  slot->transfer = (uint32_t)index;
+  slot->path_len = w->depth;
+  slot->path = w->depth ? malloc(sizeof(char *) * w->depth) : NULL;
+  for (uint32_t i = 0; i < w->depth; i++) {
+    const char *key = JS_AtomToCString(w->ctx, w->path[i]);
+    slot->path[i] = strdup(key ? key : "");
+    JS_FreeCString(w->ctx, key);
   }
-  return JS_GetOpaque(val, tree_node_class_id);
+  slot->view = view;
+  slot->offset = offset;
+  slot->length = length;
 }
 
-int append_child(TreeNode *parent, TreeNode *child) {
-  if (!parent || !child || child->parent)
+static JSValue transfer_walk(TransferWalk *w, JSValueConst obj);
+
+// 判断 value 在序列化时是否要换掉：引用被转移的缓冲区时记下路径，
+// *replacement 为 undefined；子树中有这样的引用时 *replacement 为替身。
+// 返回 1 表示需要替换，0 表示保持原值，-1 表示已抛出异常
+static int transfer_walk_value(TransferWalk *w, JSValueConst value,
+                               JSValue *replacement) {
+  uint8_t *data;
+  int view;
+  size_t offset, length;
+  if (transfer_classify(w->ctx, value, &data, &view, &offset, &length)) {
+    // 没有被转移的缓冲区（或无法重建的视图）按值复制，下标属性不必遍历
+    int index = transfer_walk_index(w, data);
+    if (index < 0)
+      return 0;
+    transfer_walk_add_slot(w, index, view, offset, length);
+    *replacement = JS_UNDEFINED;
+    return 1;
+  }
+  JSValue clone = transfer_walk(w, value);
+  if (JS_IsException(clone))
+    return -1;
+  if (JS_IsUndefined(clone))
     return 0;
-  parent->children =
-      realloc(parent->children, sizeof(TreeNode *) * (parent->childCount + 1));
-  parent->children[parent->childCount++] = child;
-  child->parent = parent;
-  YGNodeInsertChild(parent->yogaNode, child->yogaNode, parent->childCount - 1);
+  *replacement = clone;
   return 1;
 }
 
-int insert_before(TreeNode *parent, TreeNode *newChild, TreeNode *refChild) {
-  if (!parent || !newChild || !refChild || parent != refChild->parent)
-    return 0;
+// 返回 obj 的替身；子树中没有被转移的缓冲区时返回 JS_UNDEFINED
+static JSValue transfer_walk(TransferWalk *w, JSValueConst obj) {
+  JSContext *ctx = w->ctx;
+  if (w->depth == TRANSFER_WALK_MAX_DEPTH ||
+      g_hash_table_contains(w->active, JS_VALUE_GET_PTR(obj)))
+    return JS_UNDEFINED;
 
-  int index = -1;
-  for (int i = 0; i < parent->childCount; i++) {
-    if (parent->children[i] == refChild) {
-      index = i;
-      break;
+  JSPropertyEnum *props = NULL;
+  uint32_t count = 0;
+  if (JS_GetOwnPropertyNames(ctx, &props, &count, obj,
+                             JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY) != 0) {
+    // 留给 JS_WriteObject 按原样处理
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    return JS_UNDEFINED;
+  }
+  g_hash_table_add(w->active, JS_VALUE_GET_PTR(obj));
+
+  // 先取出所有属性值，有需要替换的再建替身
+  JSValue *values = count ? calloc(count, sizeof(JSValue)) : NULL;
+  uint8_t *accessor = count ? calloc(count, 1) : NULL;
+  int replaced = 0, failed = 0;
+  for (uint32_t i = 0; i < count && !failed; i++) {
+    values[i] = JS_UNDEFINED;
+    JSPropertyDescriptor desc;
+    int found = JS_GetOwnProperty(ctx, &desc, obj, props[i].atom);
+    if (found <= 0) {
+      if (found < 0)
+        JS_FreeValue(ctx, JS_GetException(ctx));
+      continue;
+    }
+    JS_FreeValue(ctx, desc.getter);
+    JS_FreeValue(ctx, desc.setter);
+    if (desc.flags & JS_PROP_GETSET) {
+      accessor[i] = 1;
+      continue;
+    }
+    values[i] = desc.value;
+    if (!JS_IsObject(desc.value))
+      continue;
+
+    JSValue replacement;
+    w->path[w->depth++] = props[i].atom;
+    int ret = transfer_walk_value(w, desc.value, &replacement);
+    w->depth--;
+    if (ret < 0) {
+      failed = 1;
+    } else if (ret > 0) {
+      JS_FreeValue(ctx, values[i]);
+      values[i] = replacement;
+      replaced = 1;
+    }
+  }
+  g_hash_table_remove(w->active, JS_VALUE_GET_PTR(obj));
+
+  JSValue clone = JS_UNDEFINED;
+  if (failed) {
+    clone = JS_EXCEPTION;
+  } else if (replaced) {
+    int array = JS_IsArray(ctx, obj) > 0;
+    clone = array ? JS_NewArray(ctx) : JS_NewObject(ctx);
+    for (uint32_t i = 0; i < count; i++) {
+      if (accessor[i]) {
+        // 与 JS_WriteObject 对原对象的处理一致
+        JS_FreeValue(ctx, clone);
+        clone = JS_ThrowTypeError(ctx, "only value properties are supported");
+        break;
+      }
+      JS_DefinePropertyValue(ctx, clone, props[i].atom, values[i],
+                             JS_PROP_C_W_E);
+      values[i] = JS_UNDEFINED;
+    }
+    if (array && !JS_IsException(clone)) {
+      // 末尾的空位也要保留
+      JS_SetPropertyStr(ctx, clone, "length",
+                        JS_GetPropertyStr(ctx, obj, "length"));
     }
   }
-  if (index == -1)
-    return 0;
 
-  parent->children =
-      realloc(parent->children, sizeof(TreeNode *) * (parent->childCount + 1));
-  memmove(&parent->children[index + 1], &parent->children[index],
-          sizeof(TreeNode *) * (parent->childCount - index));
-  parent->children[index] = newChild;
-  parent->childCount++;
-  newChild->parent = parent;
-  YGNodeInsertChild(parent->yogaNode, newChild->yogaNode, index);
-  return 1;
+  for (uint32_t i = 0; i < count; i++) {
+    if (values)
+      JS_FreeValue(ctx, values[i]);
+    JS_FreeAtom(ctx, props[i].atom);
+  }
+  free(values);
+  free(accessor);
+  js_free(ctx, props);
+  return clone;
 }
 
-int remove_child(JSContext *ctx, TreeNode *parent, TreeNode *child) {
-  if (!parent || !child || parent != child->parent)
-    return 0;
+// 接收方：按路径把移交过来的缓冲区（或新建的视图）放回反序列化的消息中。
+// 反序列化得到的都是新建的普通对象，路径上的属性一定存在。
+// transfers 为已包装好的 ArrayBuffer 数组，返回新的消息根
+static JSValue transfer_slots_apply(JSContext *ctx, WorkerMessage *msg,
+                                    JSValue data, JSValueConst transfers) {
+  for (uint32_t i = 0; i < msg->slot_count; i++) {
+    TransferSlot *slot = &msg->slots[i];
+    JSValue value = JS_GetPropertyUint32(ctx, transfers, slot->transfer);
+    if (slot->view >= 0) {
+      JSValue args[3] = {value, JS_NewInt64(ctx, (int64_t)slot->offset),
+                         JS_NewInt64(ctx, (int64_t)slot->length)};
+      JSValue view = JS_CallConstructor(
+          ctx, transfer_view_ctors[slot->view], 3, args);
+      JS_FreeValue(ctx, value);
+      if (JS_IsException(view)) {
+        js_std_dump_error(ctx);
+        continue;
+      }
+      value = view;
+    }
+    if (slot->path_len == 0) {
+      JS_FreeValue(ctx, data);
+      data = value;
+      continue;
+    }
+    JSValue holder = JS_DupValue(ctx, data);
+    for (uint32_t j = 0; j + 1 < slot->path_len && JS_IsObject(holder); j++) {
+      JSValue next = JS_GetPropertyStr(ctx, holder, slot->path[j]);
+      JS_FreeValue(ctx, holder);
+      holder = next;
+    }
+    if (JS_IsObject(holder))
+      JS_DefinePropertyValueStr(ctx, holder, slot->path[slot->path_len - 1],
+                                value, JS_PROP_C_W_E);
+    else
+      JS_FreeValue(ctx, value);
+    JS_FreeValue(ctx, holder);
+  }
+  return data;
+}
 
-  int index = -1;
-  for (int i = 0; i < parent->childCount; i++) {
-    if (parent->children[i] == child) {
-      index = i;
-      break;
+// 序列化 value 并接管 transfer 列表中的缓冲区；失败时返回 NULL 并抛出异常
+static WorkerMessage *worker_message_create(JSContext *ctx, JSValueConst value,
+                                            JSValueConst transfer) {
+  uint32_t count = 0;
+  if (!JS_IsUndefined(transfer)) {
+    if (!JS_IsArray(ctx, transfer)) {
+      JS_ThrowTypeError(ctx, "postMessage: transfer must be an array");
+      return NULL;
     }
+    JSValue length = JS_GetPropertyStr(ctx, transfer, "length");
+    int ret = JS_ToUint32(ctx, &count, length);
+    JS_FreeValue(ctx, length);
+    if (ret != 0)
+      return NULL;
   }
-  if (index == -1)
-    return 0;
 
-  YGNodeRemoveChild(parent->yogaNode, child->yogaNode);
-  memmove(&parent->children[index], &parent->children[index + 1],
-          sizeof(TreeNode *) * (parent->childCount - index - 1));
-  parent->childCount--;
-  parent->children =
-      realloc(parent->children, sizeof(TreeNode *) * parent->childCount);
-  free_tree(ctx, child);
-  return 1;
-}
+  WorkerMessage *msg = calloc(1, sizeof(WorkerMessage));
+  JSValue *buffers = count ? calloc(count, sizeof(JSValue)) : NULL;
+  uint8_t **seen = count ? calloc(count, sizeof(uint8_t *)) : NULL;
+  uint32_t fetched = 0;
+  int ok = 1;
+
+  // 先全部校验，任何一项不合法时不分离已处理的缓冲区
+  for (uint32_t i = 0; i < count && ok; i++) {
+    buffers[i] = JS_GetPropertyUint32(ctx, transfer, i);
+    fetched = i + 1;
+    size_t size;
+    seen[i] = JS_GetArrayBuffer(ctx, &size, buffers[i]);
+    if (!seen[i]) {
+      ok = 0;
+      break;
+    }
+    for (uint32_t j = 0; j < i; j++) {
+      if (seen[j] == seen[i]) {
+        JS_ThrowTypeError(ctx,
+                          "postMessage: duplicate ArrayBuffer in transfer");
+        ok = 0;
+        break;
+      }
+    }
+  }
 
-/*-------------------------------------
- * 新增：样式属性设置函数
- * 参数说明：
- * - node: 目标节点
- * - attr: 属性名（字符串）
- * - value: 属性值（字符串形式）
- * 返回值：1成功 0失败
- *-----------------------------------*/
-int set_attribute(TreeNode *node, const char *attr, const char *value) {
-  if (!node || !attr || !value)
-    return 0;
+  // 找出消息中引用被转移缓冲区的位置，序列化换掉这些位置的替身；
+  // 消息本身就是被转移的缓冲区（或其视图）时序列化 undefined
+  JSValue root = JS_UNDEFINED;
+  int replaced = 0;
+  if (ok && count && JS_IsObject(value)) {
+    TransferWalk walk = {ctx, msg, seen, count};
+    walk.active = g_hash_table_new(g_direct_hash, g_direct_equal);
+    replaced = transfer_walk_value(&walk, value, &root);
+    g_hash_table_destroy(walk.active);
+    if (replaced < 0)
+      ok = 0;
+  }
 
-  // 布局属性处理
-  if (strcmp(attr, "flex") == 0) {
-    float flex = atof(value);
-    node->style->flex = flex;
-    YGNodeStyleSetFlex(node->yogaNode, flex);
-    return 1;
-  } else if (strcmp(attr, "margin") == 0) {
-    float margin = atof(value);
-    node->style->margin = margin;
-    YGNodeStyleSetMargin(node->yogaNode, YGEdgeAll, margin);
-    return 1;
-  } else if (strcmp(attr, "flexDirection") == 0) {
-    if (strcmp(value, "row") == 0) {
-      node->style->flexDirection = YGFlexDirectionRow;
-      YGNodeStyleSetFlexDirection(node->yogaNode, YGFlexDirectionRow);
-    } else if (strcmp(value, "column") == 0) {
-      node->style->flexDirection = YGFlexDirectionColumn;
-      YGNodeStyleSetFlexDirection(node->yogaNode, YGFlexDirectionColumn);
+  if (ok) {
+    size_t size;
+    uint8_t *data = JS_WriteObject(ctx, &size, replaced ? root : value, 0);
+    if (data) {
+      // 序列化结果来自发送方运行时的分配器，复制一份才能跨线程释放
+      msg->data = malloc(size ? size : 1);
+      memcpy(msg->data, data, size);
+      msg->size = size;
+      js_free(ctx, data);
     } else {
-      return 0;
+      ok = 0;
     }
-    return 1;
-  } else if (strcmp(attr, "justifyContent") == 0) {
-    if (strcmp(value, "flex-start") == 0) {
-      node->style->justifyContent = YGJustifyFlexStart;
-      YGNodeStyleSetJustifyContent(node->yogaNode, YGJustifyFlexStart);
-    } else if (strcmp(value, "center") == 0) {
-      node->style->justifyContent = YGJustifyCenter;
-      YGNodeStyleSetJustifyContent(node->yogaNode, YGJustifyCenter);
-    } else if (strcmp(value, "flex-end") == 0) {
-      node->style->justifyContent = YGJustifyFlexEnd;
-      YGNodeStyleSetJustifyContent(node->yogaNode, YGJustifyFlexEnd);
-    } else if (strcmp(value, "space-between") == 0) {
-      node->style->justifyContent = YGJustifySpaceBetween;
-      YGNodeStyleSetJustifyContent(node->yogaNode, YGJustifySpaceBetween);
-    } else if (strcmp(value, "space-around") == 0) {
-      node->style->justifyContent = YGJustifySpaceAround;
-      YGNodeStyleSetJustifyContent(node->yogaNode, YGJustifySpaceAround);
-    } else {
-      return 0;
+  }
+  JS_FreeValue(ctx, root);
+
+  if (ok && count) {
+    msg->transfers = calloc(count, sizeof(TransferBlock));
+    for (uint32_t i = 0; i < count; i++) {
+      transfer_block_take(ctx, buffers[i], &msg->transfers[i]);
+      msg->transfer_count++;
     }
-    return 1;
   }
 
-  // 渲染属性处理
-  else if (strcmp(attr, "backgroundColor") == 0) {
-    node->style->backgroundColor = parse_color(value);
-    return 1;
-  } else if (strcmp(attr, "borderColor") == 0) {
-    node->style->borderColor = parse_color(value);
-    return 1;
+  for (uint32_t i = 0; i < fetched; i++) {
+    JS_FreeValue(ctx, buffers[i]);
+  }
+  free(buffers);
+  free(seen);
+  if (!ok) {
+    worker_message_free(msg);
+    return NULL;
+  }
+  return msg;
+}
+
+// 在接收方反序列化并调用 target.onmessage({data, transfer})
+static void worker_message_dispatch(JSContext *ctx, JSValueConst target,
+                                    WorkerMessage *msg) {
+  JSValue transfers = JS_NewArray(ctx);
+  for (uint32_t i = 0; i < msg->transfer_count; i++) {
+    JS_SetPropertyUint32(ctx, transfers, i,
+                         transfer_block_wrap(ctx, &msg->transfers[i]));
+  }
+  JSValue data = JS_ReadObject(ctx, msg->data, msg->size, 0);
+  if (JS_IsException(data)) {
+    js_std_dump_error(ctx);
+    JS_FreeValue(ctx, transfers);
+    return;
+  }
+  data = transfer_slots_apply(ctx, msg, data, transfers);
+
+  JSValue handler = JS_GetPropertyStr(ctx, target, "onmessage");
+  if (JS_IsFunction(ctx, handler)) {
+    JSValue event = JS_NewObject(ctx);
+    JS_SetPropertyStr(ctx, event, "data", data);
+    JS_SetPropertyStr(ctx, event, "transfer", transfers);
+    JSValue ret = JS_Call(ctx, handler, target, 1, &event);
+    if (JS_IsException(ret)) {
+      js_std_dump_error(ctx);
+    }
+    JS_FreeValue(ctx, ret);
+    JS_FreeValue(ctx, event);
+  } else {
+    JS_FreeValue(ctx, data);
+    JS_FreeValue(ctx, transfers);
   }
+  JS_FreeValue(ctx, handler);
+}
 
-  return 0; // 未知属性
+static int message_queue_init(MessageQueue *q, uv_loop_t *loop,
+                              uv_async_cb cb, Worker *w) {
+  q->lock = SDL_CreateMutex();
+  q->head = q->tail = NULL;
+  q->closed = 0;
+  if (!q->lock || uv_async_init(loop, &q->async, cb) != 0)
+    return -1;
+  q->async.data = w;
+  return 0;
 }
 
-void update_yoga_layout(int force) {
-  if (YGNodeIsDirty(yogaRoot) || force) {
-    fprintf(stdout, "systemp ========>:  Update Layout\n");
-    YGNodeCalculateLayout(yogaRoot, VIEW_WIDTH, VIEW_HEIGHT, YGDirectionLTR);
+// 接收方已关闭时直接丢弃
+static void message_queue_push(MessageQueue *q, WorkerMessage *msg) {
+  SDL_LockMutex(q->lock);
+  if (q->closed) {
+    SDL_UnlockMutex(q->lock);
+    worker_message_free(msg);
+    return;
   }
+  if (q->tail)
+    q->tail->next = msg;
+  else
+    q->head = msg;
+  q->tail = msg;
+  uv_async_send(&q->async);
+  SDL_UnlockMutex(q->lock);
 }
 
-TreeNode *find_node_by_id(int nodeId) {
-  return g_hash_table_lookup(nodeIdMap, &nodeId);
+static WorkerMessage *message_queue_take(MessageQueue *q) {
+  SDL_LockMutex(q->lock);
+  WorkerMessage *head = q->head;
+  q->head = q->tail = NULL;
+  SDL_UnlockMutex(q->lock);
+  return head;
 }
 
-TreeNode *find_node_at_position(TreeNode *dataNode, YGNodeRef yogaNode, int x,
-                                int y) {
-  float left = YGNodeLayoutGetLeft(yogaNode);
-  float top = YGNodeLayoutGetTop(yogaNode);
-  float width = YGNodeLayoutGetWidth(yogaNode);
-  float height = YGNodeLayoutGetHeight(yogaNode);
+// 标记关闭并丢弃剩余消息，之后由调用方关闭 async 句柄
+static void message_queue_close(MessageQueue *q) {
+  SDL_LockMutex(q->lock);
+  q->closed = 1;
+  SDL_UnlockMutex(q->lock);
+  for (WorkerMessage *msg = message_queue_take(q); msg;) {
+    WorkerMessage *next = msg->next;
+    worker_message_free(msg);
+    msg = next;
+  }
+}
 
-  if (dataNode->node_type == TEXT) {
-    return NULL;
+// 唤醒 worker 线程，让它检查 terminating 标记
+static void worker_wake(Worker *w) {
+  SDL_LockMutex(w->inbox.lock);
+  if (!w->inbox.closed)
+    uv_async_send(&w->inbox.async);
+  SDL_UnlockMutex(w->inbox.lock);
+}
+
+/* worker 线程 */
+
+// terminate() 时打断正在执行的长任务
+static int worker_interrupt(JSRuntime *rt, void *opaque) {
+  Worker *w = opaque;
+  return SDL_AtomicGet(&w->terminating);
+}
+
+// 关闭 worker 循环上的所有句柄，uv_run 随后返回
+static void worker_stop(Worker *w) {
+  if (w->stopping)
+    return;
+  w->stopping = 1;
+  timers_close(&w->timers);
+  message_queue_close(&w->inbox);
+  uv_close((uv_handle_t *)&w->inbox.async, NULL);
+  uv_close((uv_handle_t *)&w->jobs, NULL);
+}
+
+static void worker_jobs_cb(uv_prepare_t *handle) {
+  Worker *w = handle->data;
+  JSContext *job_ctx;
+  int ret;
+  while ((ret = JS_ExecutePendingJob(JS_GetRuntime(w->ctx), &job_ctx)) > 0) {
   }
-  if (x < left || x > left + width || y < top || y > top + height)
-    return NULL;
+  if (ret < 0 && !SDL_AtomicGet(&w->terminating)) {
+    js_std_dump_error(job_ctx);
+  }
+}
 
-  int localX = x - left;
-  int localY = y - top;
-  for (int i = 0; i < dataNode->childCount; i++) {
-    TreeNode *found = find_node_at_position(
-        dataNode->children[i], YGNodeGetChild(yogaNode, i), localX, localY);
-    if (found)
-      return found;
+static void worker_inbox_cb(uv_async_t *handle) {
+  Worker *w = handle->data;
+  WorkerMessage *msg = message_queue_take(&w->inbox);
+  while (msg) {
+    WorkerMessage *next = msg->next;
+    if (!SDL_AtomicGet(&w->terminating)) {
+      JSValue global = JS_GetGlobalObject(w->ctx);
+      worker_message_dispatch(w->ctx, global, msg);
+      JS_FreeValue(w->ctx, global);
+    }
+    worker_message_free(msg);
+    msg = next;
   }
-  return dataNode;
+  if (SDL_AtomicGet(&w->terminating))
+    worker_stop(w);
 }
 
-void render_text(TTF_Font *font, SDL_Renderer *renderer, TreeNode *node, int x,
-                 int y, int w, int h) {
+static JSValue js_worker_postMessage(JSContext *ctx, JSValue this_val,
+                                     int argc, JSValue *argv) {
+  Worker *w = worker_current;
+  WorkerMessage *msg =
+      worker_message_create(ctx, argc > 0 ? argv[0] : JS_UNDEFINED,
+                            argc > 1 ? argv[1] : JS_UNDEFINED);
+  if (!msg)
+    return JS_EXCEPTION;
+  message_queue_push(&w->outbox, msg);
+  return JS_UNDEFINED;
+}
 
-  // 设置文字颜色
-  SDL_Color color = {0, 0, 0, 255}; // 黑色文字
-  // 渲染文字表面
-  SDL_Surface *text_surface =
-      TTF_RenderText_Blended_Wrapped(font, node->text, color, w);
-  // 创建纹理
-  SDL_Texture *text_texture =
-      SDL_CreateTextureFromSurface(renderer, text_surface);
-  // 设置文字位置
-  SDL_Rect text_rect = {x, // x 坐标
-                        y, // y 坐标
-                        text_surface->w, text_surface->h};
-  // 绘制文字
-  SDL_RenderCopy(renderer, text_texture, NULL, &text_rect);
+static JSValue js_worker_close(JSContext *ctx, JSValue this_val, int argc,
+                               JSValue *argv) {
+  worker_stop(worker_current);
+  return JS_UNDEFINED;
+}
+
+static int worker_thread_main(void *arg) {
+  Worker *w = arg;
+  worker_current = w;
+
+  JSRuntime *rt = JS_NewRuntime();
+  JSContext *ctx = rt ? JS_NewContext(rt) : NULL;
+  if (ctx) {
+    transfer_views_init(ctx);
+    JS_SetInterruptHandler(rt, worker_interrupt, w);
+    js_std_init_handlers(rt);
+    js_std_add_helpers(ctx, 0, NULL);
+    w->ctx = ctx;
+    timers_init(&w->timers, ctx, &w->loop);
+    uv_prepare_init(&w->loop, &w->jobs);
+    w->jobs.data = w;
+    uv_prepare_start(&w->jobs, worker_jobs_cb);
+
+    JSValue global = JS_GetGlobalObject(ctx);
+    JS_SetPropertyStr(ctx, global, "self", JS_DupValue(ctx, global));
+    JS_SetPropertyStr(
+        ctx, global, "postMessage",
+        JS_NewCFunction(ctx, js_worker_postMessage, "postMessage", 2));
+    JS_SetPropertyStr(ctx, global, "close",
+                      JS_NewCFunction(ctx, js_worker_close, "close", 0));
+    JS_SetPropertyStr(ctx, global, "setTimeout",
+                      JS_NewCFunction(ctx, js_setTimeout, "setTimeout", 2));
+    JS_SetPropertyStr(ctx, global, "setInterval",
+                      JS_NewCFunction(ctx, js_setInterval, "setInterval", 2));
+    JS_SetPropertyStr(ctx, global, "clearTimeout",
+                      JS_NewCFunction(ctx, js_clearTimer, "clearTimeout", 1));
+    JS_SetPropertyStr(ctx, global, "clearInterval",
+                      JS_NewCFunction(ctx, js_clearTimer, "clearInterval", 1));
+    JS_FreeValue(ctx, global);
+
+    char *code = NULL;
+    int len = readfile(w->script_path, &code);
+    if (len == -1) {
+      fprintf(stderr, "Error reading worker script: %s\n", w->script_path);
+      worker_stop(w);
+    } else {
+      JSValue val = eval_script(ctx, w->script_path, NULL, code, len);
+      if (JS_IsException(val)) {
+        if (!SDL_AtomicGet(&w->terminating))
+          js_std_dump_error(ctx);
+        worker_stop(w);
+      }
+      JS_FreeValue(ctx, val);
+      free(code);
+    }
+    // 收件箱的 async 句柄让循环一直运行，直到 close() 或 terminate()
+    uv_run(&w->loop, UV_RUN_DEFAULT);
+  } else {
+    fprintf(stderr, "Error creating worker runtime: %s\n", w->script_path);
+    message_queue_close(&w->inbox);
+    uv_close((uv_handle_t *)&w->inbox.async, NULL);
+    uv_run(&w->loop, UV_RUN_DEFAULT);
+  }
+
+  if (ctx) {
+    js_std_free_handlers(rt);
+    transfer_views_free(ctx);
+    JS_FreeContext(ctx);
+  }
+  if (rt)
+    JS_FreeRuntime(rt);
+  uv_loop_close(&w->loop);
 
-  // 清理资源
-  SDL_DestroyTexture(text_texture);
-  SDL_FreeSurface(text_surface);
+  // 通知 UI 线程回收
+  message_queue_push(&w->outbox, calloc(1, sizeof(WorkerMessage)));
+  return 0;
 }
 
-/*-------------------------------------
- * 渲染系统
- *-----------------------------------*/
-void render_tree(TTF_Font *font, SDL_Renderer *renderer, TreeNode *dataNode,
-                 int parentX, int parentY) {
-  if (!dataNode)
-    return;
-  YGNodeRef yogaNode = dataNode->yogaNode;
+/* UI 线程 */
 
-  int x = parentX + (int)YGNodeLayoutGetLeft(yogaNode);
-  int y = parentY + (int)YGNodeLayoutGetTop(yogaNode);
-  int w = (int)YGNodeLayoutGetWidth(yogaNode);
-  int h = (int)YGNodeLayoutGetHeight(yogaNode);
+static void worker_free_cb(uv_handle_t *handle) {
+  Worker *w = handle->data;
+  SDL_DestroyMutex(w->inbox.lock);
+  SDL_DestroyMutex(w->outbox.lock);
+  free(w->script_path);
+  free(w);
+}
 
-  // 如果是 TEXT 节点，渲染文字
-  if (dataNode->node_type == TEXT && dataNode->text) {
-    render_text(font, renderer, dataNode, x, y, w, h);
+// 结束并回收 worker 线程，结构体在 outbox 句柄关闭后释放
+static void worker_finish(Worker *w) {
+  if (w->joined)
     return;
+  SDL_AtomicSet(&w->terminating, 1);
+  worker_wake(w);
+  SDL_WaitThread(w->thread, NULL);
+  w->joined = 1;
+  message_queue_close(&w->outbox);
+  uv_close((uv_handle_t *)&w->outbox.async, worker_free_cb);
+
+  for (Worker **p = &workers; *p; p = &(*p)->next) {
+    if (*p == w) {
+      *p = w->next;
+      break;
+    }
   }
+  if (!JS_IsUndefined(w->object)) {
+    JS_SetOpaque(w->object, NULL);
+    JS_FreeValue(w->ui_ctx, w->object);
+    w->object = JS_UNDEFINED;
+  }
+}
 
-  // 绘制背景
-  Color bg = dataNode->style->backgroundColor;
-  // 开启透明
-  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-  SDL_SetRenderDrawColor(renderer, bg.r, bg.g, bg.b, bg.a);
-  SDL_Rect rect = {x, y, w, h};
-  SDL_RenderFillRect(renderer, &rect);
+static void worker_outbox_cb(uv_async_t *handle) {
+  Worker *w = handle->data;
+  WorkerMessage *msg = message_queue_take(&w->outbox);
+  while (msg) {
+    WorkerMessage *next = msg->next;
+    if (!msg->data) {
+      worker_finish(w);
+    } else if (!w->joined) {
+      // 回调里可能调用 terminate()，之后的消息直接丢弃
+      worker_message_dispatch(w->ui_ctx, w->object, msg);
+    }
+    worker_message_free(msg);
+    msg = next;
+  }
+}
 
-  // 绘制边框
-  Color border = (dataNode == selectedNode) ? COLOR_HIGHLIGHT
-                                            : dataNode->style->borderColor;
-  SDL_SetRenderDrawColor(renderer, border.r, border.g, border.b, border.a);
-  SDL_RenderDrawRect(renderer, &rect);
+static Worker *worker_get(JSContext *ctx, JSValueConst this_val) {
+  Worker *w = JS_GetOpaque(this_val, worker_class_id);
+  if (!w)
+    JS_ThrowTypeError(ctx, "Worker has been terminated");
+  return w;
+}
 
-  // 递归渲染子节点
-  for (int i = 0; i < dataNode->childCount; i++) {
-    render_tree(font, renderer, dataNode->children[i], x, y);
+static JSValue js_Worker(JSContext *ctx, JSValue new_target, int argc,
+                         JSValue *argv) {
+  const char *path = argc > 0 ? JS_ToCString(ctx, argv[0]) : NULL;
+  if (!path)
+    return JS_ThrowTypeError(ctx, "Worker: expected a script path");
+
+  Worker *w = calloc(1, sizeof(Worker));
+  w->script_path = strdup(path);
+  JS_FreeCString(ctx, path);
+  w->ui_ctx = ctx;
+  w->object = JS_UNDEFINED;
+
+  if (uv_loop_init(&w->loop) != 0 ||
+      message_queue_init(&w->inbox, &w->loop, worker_inbox_cb, w) != 0) {
+    free(w->script_path);
+    free(w);
+    return JS_ThrowInternalError(ctx, "Worker: failed to create event loop");
   }
+  message_queue_init(&w->outbox, uv_default_loop(), worker_outbox_cb, w);
+
+  JSValue obj = JS_NewObjectClass(ctx, worker_class_id);
+  if (!JS_IsException(obj))
+    w->thread = SDL_CreateThread(worker_thread_main, "worker", w);
+  if (!w->thread) {
+    message_queue_close(&w->inbox);
+    uv_close((uv_handle_t *)&w->inbox.async, NULL);
+    uv_run(&w->loop, UV_RUN_DEFAULT);
+    uv_loop_close(&w->loop);
+    message_queue_close(&w->outbox);
+    uv_close((uv_handle_t *)&w->outbox.async, worker_free_cb);
+    if (JS_IsException(obj))
+      return obj;
+    JS_FreeValue(ctx, obj);
+    return JS_ThrowInternalError(ctx, "Worker: failed to start thread: %s",
+                                 SDL_GetError());
+  }
+  JS_SetOpaque(obj, w);
+  w->object = JS_DupValue(ctx, obj);
+  w->next = workers;
+  workers = w;
+  return obj;
 }
 
-static JSValue js_createNode(JSContext *ctx, JSValue this_val, int argc,
-                             JSValue *argv) {
-  // 创建 C 层对象
-  TreeNode *node = create_node(NODE, NULL, 1.0f, 10.0f, YGFlexDirectionRow,
-                               YGJustifyFlexStart);
-  if (!node)
-    return JS_ThrowOutOfMemory(ctx);
+static JSValue js_Worker_postMessage(JSContext *ctx, JSValue this_val,
+                                     int argc, JSValue *argv) {
+  Worker *w = worker_get(ctx, this_val);
+  if (!w)
+    return JS_EXCEPTION;
+  WorkerMessage *msg =
+      worker_message_create(ctx, argc > 0 ? argv[0] : JS_UNDEFINED,
+                            argc > 1 ? argv[1] : JS_UNDEFINED);
+  if (!msg)
+    return JS_EXCEPTION;
+  message_queue_push(&w->inbox, msg);
+  return JS_UNDEFINED;
+}
 
-  // 包装为 JS 对象
-  return wrap_node(ctx, node);
+static JSValue js_Worker_terminate(JSContext *ctx, JSValue this_val, int argc,
+                                   JSValue *argv) {
+  Worker *w = JS_GetOpaque(this_val, worker_class_id);
+  if (w)
+    worker_finish(w);
+  return JS_UNDEFINED;
 }
 
-static JSValue js_createTextNode(JSContext *ctx, JSValue this_val, int argc,
-                                 JSValue *argv) {
-  if (argc < 1) {
-    return JS_ThrowTypeError(ctx,
-                             "createNode requires at least 1 argument: text");
+int worker_class_init(JSRuntime *rt) {
+  if (worker_class_id == 0)
+    JS_NewClassID(&worker_class_id);
+  return JS_NewClass(rt, worker_class_id, &worker_class);
+}
+
+// 与 transfer_views_free 配对
+void workers_init(JSContext *ctx) {
+  transfer_lock = SDL_CreateMutex();
+  transfer_owners = g_hash_table_new(g_direct_hash, g_direct_equal);
+  transfer_views_init(ctx);
+
+  JSValue proto = JS_NewObject(ctx);
+  JS_SetPropertyStr(
+      ctx, proto, "postMessage",
+      JS_NewCFunction(ctx, js_Worker_postMessage, "postMessage", 2));
+  JS_SetPropertyStr(ctx, proto, "terminate",
+                    JS_NewCFunction(ctx, js_Worker_terminate, "terminate", 0));
+  JS_SetClassProto(ctx, worker_class_id, proto);
+
+  JSValue global = JS_GetGlobalObject(ctx);
+  JS_SetPropertyStr(ctx, global, "Worker",
+                    JS_NewCFunction2(ctx, js_Worker, "Worker", 1,
+                                     JS_CFUNC_constructor, 0));
+  JS_FreeValue(ctx, global);
+}
+
+// 退出前结束所有 worker，之后需要跑一次主循环完成句柄关闭
+void workers_shutdown(void) {
+  while (workers)
+    worker_finish(workers);
+}
+
+// 所有 worker 线程结束后调用
+void workers_free(void) {
+  if (transfer_owners) {
+    g_hash_table_destroy(transfer_owners);
+    transfer_owners = NULL;
+  }
+  if (transfer_lock) {
+    SDL_DestroyMutex(transfer_lock);
+    transfer_lock = NULL;
+  }
+}
+
+/*-------------------------------------
+ * 颜色结构体定义
+ *-----------------------------------*/
+typedef struct {
+  Uint8 r, g, b, a;
+} Color;
+
+// 预设颜色
+static const Color COLOR_TRANSPARENT = {255, 255, 255, 0};
+static const Color COLOR_WHITE = {255, 255, 255, 255};
+static const Color COLOR_BLACK = {0, 0, 0, 255};
+static const Color COLOR_RED = {255, 0, 0, 255};
+static const Color COLOR_HIGHLIGHT = {255, 255, 0, 255}; // 选中高亮色
+
+/*-------------------------------------
+ * 样式结构体定义
+ * 样式是共享的只读值：相同的样式在共享表中只存一份，节点持有引用。
+ * 修改时先拷贝出值、改完再重新入表（写时复制），见 node_set_style。
+ * 值字段全部是 4 字节类型，没有填充，按字节比较和哈希
+ *-----------------------------------*/
+// 长度值：点、百分比或 auto，unit 为 YGUnitUndefined 表示未设置
+typedef struct {
+  float value;
+  YGUnit unit;
+} StyleLength;
+
+#define STYLE_EDGE_COUNT (YGEdgeAll + 1) // 按 YGEdge 下标存放四边及简写
+
+typedef struct NodeStyle {
+  // 布局属性
+  float flex;
+  float flexGrow, flexShrink; // 未设置时为 YGUndefined
+  StyleLength flexBasis;
+  YGFlexDirection flexDirection;
+  YGJustify justifyContent;
+  YGAlign alignItems, alignSelf, alignContent;
+  YGWrap flexWrap;
+  YGPositionType positionType;
+  YGDisplay display;
+  YGOverflow overflow; // hidden / scroll 时裁剪子节点
+  float aspectRatio;
+  StyleLength width, height;
+  StyleLength minWidth, minHeight, maxWidth, maxHeight;
+  StyleLength position[STYLE_EDGE_COUNT]; // left / top / right / bottom
+  StyleLength margin[STYLE_EDGE_COUNT];
+  StyleLength padding[STYLE_EDGE_COUNT];
+
+  // 渲染属性
+  Color backgroundColor;
+  Color borderColor;
+
+  // 共享表的簿记字段，不参与比较和哈希
+  int refcount;
+  YGNodeRef yoga; // 已写入上面布局属性的 Yoga 模板节点，应用时整体拷贝
+} NodeStyle;
+
+#define STYLE_LAYOUT_SIZE offsetof(NodeStyle, backgroundColor)
+#define STYLE_VALUE_SIZE offsetof(NodeStyle, refcount)
+
+// 定义事件监听器结构体
+typedef struct {
+  JSValue callback; // 回调函数
+  int capture;      // 在捕获阶段而不是冒泡阶段触发
+} EventListener;
+
+// 同一事件类型的监听器放在一个桶里，类型用 JSAtom 比较
+typedef struct {
+  JSAtom type;
+  int count;
+  int capacity;
+  EventListener *listeners; // 按注册顺序
+} ListenerBucket;
+
+// 相对父节点的布局矩形
+typedef struct {
+  float left, top, width, height;
+} LayoutBox;
+
+typedef enum {
+  NODE, // 普通节点
+  TEXT  // 文字节点
+} NodeType;
+
+/*-------------------------------------
+ * slab 分配器
+ * 固定大小的记录按块批量申请，块内顺次切分；释放的记录挂进空闲链表，
+ * 下次分配直接复用。同一批创建的记录在内存中相邻，遍历时缓存更友好
+ *-----------------------------------*/
+#define SLAB_ALIGN 16
+
+typedef struct SlabChunk {
+  struct SlabChunk *next;
+} SlabChunk;
+
+typedef struct {
+  size_t item_size;   // 按 SLAB_ALIGN 对齐后的记录大小
+  size_t chunk_items; // 每块的记录数
+  SlabChunk *chunks;
+  char *bump; // 当前块中尚未切分部分的起点
+  char *bump_end;
+  void *free_list; // 空闲记录的第一个字存放下一个空闲记录
+  size_t live;
+  size_t chunk_count;
+} Slab;
+
+#define SLAB_INIT(size, items)                                                 \
+  {(((size) + SLAB_ALIGN - 1) / SLAB_ALIGN) * SLAB_ALIGN, (items)}
+
+#define SLAB_CHUNK_HEADER                                                      \
+  (((sizeof(SlabChunk) + SLAB_ALIGN - 1) / SLAB_ALIGN) * SLAB_ALIGN)
+
+void *slab_alloc(Slab *slab) {
+  void *item = slab->free_list;
+  if (item) {
+    slab->free_list = *(void **)item;
+  } else {
+    if (slab->bump == slab->bump_end) {
+      SlabChunk *chunk =
+          malloc(SLAB_CHUNK_HEADER + slab->item_size * slab->chunk_items);
+      if (!chunk)
+        return NULL;
+      chunk->next = slab->chunks;
+      slab->chunks = chunk;
+      slab->chunk_count++;
+      slab->bump = (char *)chunk + SLAB_CHUNK_HEADER;
+      slab->bump_end = slab->bump + slab->item_size * slab->chunk_items;
+    }
+    item = slab->bump;
+    slab->bump += slab->item_size;
+  }
+  slab->live++;
+  return item;
+}
+
+void slab_free(Slab *slab, void *item) {
+  if (!item)
+    return;
+  *(void **)item = slab->free_list;
+  slab->free_list = item;
+  slab->live--;
+}
+
+size_t slab_bytes(const Slab *slab) {
+  return slab->chunk_count *
+         (SLAB_CHUNK_HEADER + slab->item_size * slab->chunk_items);
+}
+
+// 一次性归还所有块，调用前记录应已全部释放
+void slab_destroy(Slab *slab) {
+  if (slab->live > 0) {
+    fprintf(stderr, "slab: %zu records of %zu bytes still allocated\n",
+            slab->live, slab->item_size);
+  }
+  while (slab->chunks) {
+    SlabChunk *next = slab->chunks->next;
+    free(slab->chunks);
+    slab->chunks = next;
+  }
+  slab->bump = slab->bump_end = NULL;
+  slab->free_list = NULL;
+  slab->live = 0;
+  slab->chunk_count = 0;
+}
+
+/*-------------------------------------
+ * 树节点结构体定义
+ *-----------------------------------*/
+typedef struct TreeNode {
+  int id;
+  NodeType node_type;
+  char *text;
+  JSValue wrapper; // 唯一的 JS 包装对象，不持有引用；JS_UNDEFINED 表示尚未创建
+  const NodeStyle *style; // 共享表中的样式，只读
+  const NodeStyle *base_style; // 创建时的初始样式，移除属性时恢复到这里
+  int childCount;
+  struct TreeNode **children;
+  struct TreeNode *parent;
+  YGNodeRef yogaNode; // 样式树，只由主线程修改
+  YGNodeRef shadow;   // 布局线程计算用的影子节点
+  int shadow_dirty;   // 尚未同步到影子节点的变化，SHADOW_* 的组合
+  int shadow_descendant_dirty; // 子树中有节点需要同步
+  LayoutBox layout;   // 已发布的布局结果，渲染和命中测试只读这里
+  int has_layout;     // 加入后是否已经完成过一次布局
+  ListenerBucket *listener_buckets; // 按事件类型分桶存储的事件监听器
+  int listener_bucket_count;
+  struct TextLayout *text_layout; // 文字节点的排版结果
+  int dirty;          // 自上次绘制以来是否被修改
+  SDL_Rect layout_box; // 上次记录的绝对布局矩形
+  SDL_Rect paint_box;  // 上次实际绘制覆盖的矩形（文字可能超出布局矩形）
+  int geometry_index;   // 在几何缓冲中的下标，尚未布局时为 -1
+  int scroll_x, scroll_y; // overflow: scroll 容器的滚动偏移
+  struct Layer *layer; // 缓存图层，仅在设置了 layer: "cache" 时存在
+} TreeNode;
+
+/*-------------------------------------
+ * 全局状态
+ *-----------------------------------*/
+TreeNode *selectedNode = NULL;
+TreeNode *hoveredNode = NULL; // 鼠标当前所在的最深节点
+YGNodeRef yogaRoot = NULL;
+TreeNode *root_data = NULL;
+int VIEW_WIDTH = 1000;
+int VIEW_HEIGHT = 600;
+int FONT_SIZE = 24;
+int geometry_dirty = 1; // 布局、滚动或结构变化后需要重建几何缓冲
+
+// 创建和释放时维护的存活对象计数，供内存统计和退出时的泄漏检查使用
+#define NODE_TYPE_COUNT 2
+typedef struct {
+  int nodes[NODE_TYPE_COUNT]; // 按 NodeType 统计
+  int listeners;
+  int wrappers; // 尚未被回收的 JS 包装对象
+} MemoryCounters;
+
+MemoryCounters memory_counters;
+
+// 节点、监听器数组和短文字的 slab
+#define LISTENER_SLAB_CAPACITY 2 // 监听器数组的初始容量，扩容后改用 malloc
+#define TEXT_SLAB_SIZE 32        // 不超过该长度（含结尾 0）的文字放进 slab
+Slab node_slab = SLAB_INIT(sizeof(TreeNode), 256);
+Slab listener_slab =
+    SLAB_INIT(sizeof(EventListener) * LISTENER_SLAB_CAPACITY, 256);
+Slab text_slab = SLAB_INIT(TEXT_SLAB_SIZE, 512);
+
+/*-------------------------------------
+ * 节点 id 表
+ * 节点 id 由槽位下标和代数组成：id = 代数 << NODE_SLOT_BITS | 下标。
+ * 槽位释放后代数加一，旧 id 查不到新节点；空闲槽位按先进先出复用，
+ * 推迟代数回绕。存活节点另存一份紧凑数组，删除时用末尾元素填补，
+ * 遍历全部节点不必跳过空槽
+ *-----------------------------------*/
+#define NODE_SLOT_BITS 20 // 最多约一百万个同时存活（含已预留）的节点
+#define NODE_SLOT_LIMIT (1u << NODE_SLOT_BITS)
+// 代数占剩下的位，id 始终为正的 int32
+#define NODE_GENERATION_MASK ((1u << (31 - NODE_SLOT_BITS)) - 1)
+#define NODE_SLOT_NONE UINT32_MAX
+
+typedef struct {
+  TreeNode *node; // NULL 表示空闲或已预留
+  uint32_t generation;
+  uint32_t dense_index; // node 在 dense 数组中的位置
+  uint32_t next_free;
+  int reserved; // 已分配 id、节点尚未创建
+} NodeSlot;
+
+typedef struct {
+  NodeSlot *slots;
+  uint32_t slot_count;
+  uint32_t slot_capacity;
+  uint32_t free_head; // 空闲槽位队列，从头取、往尾放
+  uint32_t free_tail;
+  TreeNode **dense; // 存活节点，顺序不固定
+  uint32_t dense_count;
+  uint32_t dense_capacity;
+} NodeSlotMap;
+
+static NodeSlotMap node_slots = {.free_head = NODE_SLOT_NONE,
+                                 .free_tail = NODE_SLOT_NONE};
+
+static NodeSlot *node_slot_get(int id) {
+  if (id <= 0)
+    return NULL;
+  uint32_t index = (uint32_t)id & (NODE_SLOT_LIMIT - 1);
+  if (index >= node_slots.slot_count)
+    return NULL;
+  NodeSlot *slot = &node_slots.slots[index];
+  if (slot->generation != ((uint32_t)id >> NODE_SLOT_BITS))
+    return NULL;
+  return slot;
+}
+
+// 分配一个 id 并预留槽位，槽位用尽时返回 -1
+int node_id_reserve(void) {
+  uint32_t index = node_slots.free_head;
+  if (index != NODE_SLOT_NONE) {
+    node_slots.free_head = node_slots.slots[index].next_free;
+    if (node_slots.free_head == NODE_SLOT_NONE)
+      node_slots.free_tail = NODE_SLOT_NONE;
+  } else {
+    if (node_slots.slot_count == NODE_SLOT_LIMIT)
+      return -1;
+    if (node_slots.slot_count == node_slots.slot_capacity) {
+      uint32_t capacity =
+          node_slots.slot_capacity ? node_slots.slot_capacity * 2 : 1024;
+      NodeSlot *slots = realloc(node_slots.slots, capacity * sizeof(NodeSlot));
+      if (!slots)
+        return -1;
+      node_slots.slots = slots;
+      node_slots.slot_capacity = capacity;
+    }
+    index = node_slots.slot_count++;
+    node_slots.slots[index].generation = 1;
+  }
+  NodeSlot *slot = &node_slots.slots[index];
+  slot->node = NULL;
+  slot->reserved = 1;
+  return (int)(slot->generation << NODE_SLOT_BITS | index);
+}
+
+int node_id_is_reserved(int id) {
+  NodeSlot *slot = node_slot_get(id);
+  return slot && slot->reserved;
+}
+
+// 槽位代数加一让旧 id 失效，放回空闲队列尾部
+static void node_slot_release(NodeSlot *slot) {
+  uint32_t index = (uint32_t)(slot - node_slots.slots);
+  slot->node = NULL;
+  slot->reserved = 0;
+  slot->generation = (slot->generation + 1) & NODE_GENERATION_MASK;
+  if (slot->generation == 0)
+    slot->generation = 1;
+  slot->next_free = NODE_SLOT_NONE;
+  if (node_slots.free_tail != NODE_SLOT_NONE)
+    node_slots.slots[node_slots.free_tail].next_free = index;
+  else
+    node_slots.free_head = index;
+  node_slots.free_tail = index;
+}
+
+// 归还预留了但不会再用来创建节点的 id；已占用或已失效的 id 不受影响
+void node_id_unreserve(int id) {
+  NodeSlot *slot = node_slot_get(id);
+  if (slot && slot->reserved)
+    node_slot_release(slot);
+}
+
+// 节点占用已预留的 id
+void node_slots_insert(TreeNode *node) {
+  NodeSlot *slot = node_slot_get(node->id);
+  if (!slot || !slot->reserved) {
+    fprintf(stderr, "node id %d was not reserved\n", node->id);
+    abort();
+  }
+  if (node_slots.dense_count == node_slots.dense_capacity) {
+    node_slots.dense_capacity =
+        node_slots.dense_capacity ? node_slots.dense_capacity * 2 : 1024;
+    node_slots.dense = realloc(node_slots.dense, node_slots.dense_capacity *
+                                                     sizeof(TreeNode *));
+  }
+  slot->reserved = 0;
+  slot->node = node;
+  slot->dense_index = node_slots.dense_count;
+  node_slots.dense[node_slots.dense_count++] = node;
+}
+
+// 释放节点的 id，代数加一让旧 id 失效
+void node_slots_remove(TreeNode *node) {
+  NodeSlot *slot = node_slot_get(node->id);
+  if (!slot || slot->node != node)
+    return;
+  TreeNode *last = node_slots.dense[--node_slots.dense_count];
+  node_slots.dense[slot->dense_index] = last;
+  node_slot_get(last->id)->dense_index = slot->dense_index;
+  node_slot_release(slot);
+}
+
+TreeNode *find_node_by_id(int nodeId) {
+  NodeSlot *slot = node_slot_get(nodeId);
+  return slot ? slot->node : NULL;
+}
+
+// 紧凑数组中的下一个节点（到末尾后回到开头），用于键盘切换选中节点
+TreeNode *node_slots_next(TreeNode *node) {
+  if (node_slots.dense_count == 0)
+    return NULL;
+  NodeSlot *slot = node ? node_slot_get(node->id) : NULL;
+  uint32_t next = slot && slot->node == node ? slot->dense_index + 1 : 0;
+  return node_slots.dense[next % node_slots.dense_count];
+}
+
+void node_slots_free(void) {
+  free(node_slots.slots);
+  free(node_slots.dense);
+  node_slots = (NodeSlotMap){.free_head = NODE_SLOT_NONE,
+                             .free_tail = NODE_SLOT_NONE};
+}
+
+/*-------------------------------------
+ * 渲染后端
+ * render_range / render_text 只通过这组接口绘制，
+ * SDL 窗口渲染和无窗口的软件光栅化各实现一份。
+ *-----------------------------------*/
+typedef struct RenderBackend {
+  const char *name;
+  // 仅 SDL 后端非空，离屏图层依赖渲染目标纹理
+  SDL_Renderer *renderer;
+  // 开始一帧，返回 0 表示上一帧内容没有保留，需要整屏重绘
+  int (*begin_frame)(struct RenderBackend *backend);
+  void (*end_frame)(struct RenderBackend *backend);
+  void (*present)(struct RenderBackend *backend);
+  void (*resize)(struct RenderBackend *backend, int width, int height);
+  void (*set_clip)(struct RenderBackend *backend, const SDL_Rect *clip);
+  void (*fill_rects)(struct RenderBackend *backend, const SDL_Rect *rects,
+                     const Color *colors, int count, SDL_BlendMode blend);
+  // 位图（文字）由 SDL_Surface 转成后端自己的图像句柄，不接管 surface
+  void *(*load_image)(struct RenderBackend *backend, SDL_Surface *surface);
+  void (*free_image)(struct RenderBackend *backend, void *image);
+  void (*draw_image)(struct RenderBackend *backend, void *image,
+                     const SDL_Rect *dst);
+  // 字形图集页：创建空白图像，按区域写入 ARGB8888 位图
+  void *(*create_image)(struct RenderBackend *backend, int width, int height);
+  void (*update_image)(struct RenderBackend *backend, void *image,
+                       const SDL_Rect *rect, SDL_Surface *surface);
+  // 从同一张图集页取 count 个子矩形 1:1 绘制，位图只取 alpha，颜色统一为 color
+  void (*draw_glyphs)(struct RenderBackend *backend, void *image,
+                      const SDL_Rect *src, const SDL_Rect *dst, int count,
+                      Color color);
+  void (*destroy)(struct RenderBackend *backend);
+} RenderBackend;
+
+/*-------------------------------------
+ * SDL 渲染后端
+ * 帧缓冲纹理跨帧保留上一帧内容，局部重绘只需更新重绘区域
+ *-----------------------------------*/
+typedef struct {
+  RenderBackend base;
+  SDL_Texture *frame_texture;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  SDL_Vertex *vertices;
+  int *indices;
+  int quad_capacity;
+#endif
+} SDLBackend;
+
+static SDL_Texture *sdl_backend_create_frame_texture(SDL_Renderer *renderer,
+                                                     int width, int height) {
+  if (!SDL_RenderTargetSupported(renderer))
+    return NULL;
+  return SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                           SDL_TEXTUREACCESS_TARGET, width, height);
+}
+
+static int sdl_backend_begin_frame(RenderBackend *backend) {
+  SDLBackend *sdl = (SDLBackend *)backend;
+  if (!sdl->frame_texture)
+    return 0;
+  SDL_SetRenderTarget(backend->renderer, sdl->frame_texture);
+  return 1;
+}
+
+static void sdl_backend_end_frame(RenderBackend *backend) {
+  SDLBackend *sdl = (SDLBackend *)backend;
+  SDL_RenderSetClipRect(backend->renderer, NULL);
+  if (sdl->frame_texture) {
+    SDL_SetRenderTarget(backend->renderer, NULL);
+  }
+}
+
+static void sdl_backend_present(RenderBackend *backend) {
+  SDLBackend *sdl = (SDLBackend *)backend;
+  if (sdl->frame_texture) {
+    SDL_RenderCopy(backend->renderer, sdl->frame_texture, NULL, NULL);
+  }
+  SDL_RenderPresent(backend->renderer);
+}
+
+static void sdl_backend_resize(RenderBackend *backend, int width, int height) {
+  SDLBackend *sdl = (SDLBackend *)backend;
+  if (sdl->frame_texture) {
+    SDL_DestroyTexture(sdl->frame_texture);
+  }
+  sdl->frame_texture =
+      sdl_backend_create_frame_texture(backend->renderer, width, height);
+}
+
+static void sdl_backend_set_clip(RenderBackend *backend, const SDL_Rect *clip) {
+  SDL_RenderSetClipRect(backend->renderer, clip);
+}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+static void sdl_backend_reserve_quads(SDLBackend *sdl, int count) {
+  if (count <= sdl->quad_capacity)
+    return;
+  int capacity = sdl->quad_capacity ? sdl->quad_capacity : 256;
+  while (capacity < count)
+    capacity *= 2;
+  sdl->vertices =
+      realloc(sdl->vertices, sizeof(SDL_Vertex) * 4 * (size_t)capacity);
+  sdl->indices = realloc(sdl->indices, sizeof(int) * 6 * (size_t)capacity);
+  // 索引只依赖四边形序号，扩容时一次性生成
+  for (int q = sdl->quad_capacity; q < capacity; q++) {
+    int *idx = &sdl->indices[q * 6];
+    int base = q * 4;
+    idx[0] = base;
+    idx[1] = base + 1;
+    idx[2] = base + 2;
+    idx[3] = base;
+    idx[4] = base + 2;
+    idx[5] = base + 3;
+  }
+  sdl->quad_capacity = capacity;
+}
+#endif
+
+static void sdl_backend_fill_rects(RenderBackend *backend, const SDL_Rect *rects,
+                                   const Color *colors, int count,
+                                   SDL_BlendMode blend) {
+  SDL_Renderer *renderer = backend->renderer;
+  // 每批只设置一次混合模式
+  SDL_SetRenderDrawBlendMode(renderer, blend);
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  SDLBackend *sdl = (SDLBackend *)backend;
+  sdl_backend_reserve_quads(sdl, count);
+  for (int i = 0; i < count; i++) {
+    SDL_Color c = {colors[i].r, colors[i].g, colors[i].b, colors[i].a};
+    float x0 = (float)rects[i].x, y0 = (float)rects[i].y;
+    float x1 = x0 + rects[i].w, y1 = y0 + rects[i].h;
+    SDL_Vertex *v = &sdl->vertices[i * 4];
+    v[0] = (SDL_Vertex){{x0, y0}, c, {0, 0}};
+    v[1] = (SDL_Vertex){{x1, y0}, c, {0, 0}};
+    v[2] = (SDL_Vertex){{x1, y1}, c, {0, 0}};
+    v[3] = (SDL_Vertex){{x0, y1}, c, {0, 0}};
+  }
+  SDL_RenderGeometry(renderer, NULL, sdl->vertices, count * 4, sdl->indices,
+                     count * 6);
+#else
+  // 旧版本 SDL 没有 SDL_RenderGeometry，合并相邻同色矩形走 SDL_RenderFillRects
+  int start = 0;
+  for (int i = 1; i <= count; i++) {
+    if (i == count ||
+        memcmp(&colors[i], &colors[start], sizeof(Color)) != 0) {
+      Color c = colors[start];
+      SDL_SetRenderDrawColor(renderer, c.r, c.g, c.b, c.a);
+      SDL_RenderFillRects(renderer, &rects[start], i - start);
+      start = i;
+    }
+  }
+#endif
+}
+
+static void *sdl_backend_load_image(RenderBackend *backend,
+                                    SDL_Surface *surface) {
+  return SDL_CreateTextureFromSurface(backend->renderer, surface);
+}
+
+static void sdl_backend_free_image(RenderBackend *backend, void *image) {
+  SDL_DestroyTexture((SDL_Texture *)image);
+}
+
+static void sdl_backend_draw_image(RenderBackend *backend, void *image,
+                                   const SDL_Rect *dst) {
+  SDL_RenderCopy(backend->renderer, (SDL_Texture *)image, NULL, dst);
+}
+
+static void *sdl_backend_create_image(RenderBackend *backend, int width,
+                                      int height) {
+  SDL_Texture *texture =
+      SDL_CreateTexture(backend->renderer, SDL_PIXELFORMAT_ARGB8888,
+                        SDL_TEXTUREACCESS_STATIC, width, height);
+  if (texture)
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+  return texture;
+}
+
+static void sdl_backend_update_image(RenderBackend *backend, void *image,
+                                     const SDL_Rect *rect,
+                                     SDL_Surface *surface) {
+  SDL_UpdateTexture((SDL_Texture *)image, rect, surface->pixels,
+                    surface->pitch);
+}
+
+static void sdl_backend_draw_glyphs(RenderBackend *backend, void *image,
+                                    const SDL_Rect *src, const SDL_Rect *dst,
+                                    int count, Color color) {
+  SDL_Renderer *renderer = backend->renderer;
+  SDL_Texture *texture = image;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  // 顶点颜色与白色字形相乘得到文字颜色，整页一次 SDL_RenderGeometry
+  SDLBackend *sdl = (SDLBackend *)backend;
+  int tw, th;
+  SDL_QueryTexture(texture, NULL, NULL, &tw, &th);
+  sdl_backend_reserve_quads(sdl, count);
+  SDL_Color c = {color.r, color.g, color.b, color.a};
+  for (int i = 0; i < count; i++) {
+    float x0 = (float)dst[i].x, y0 = (float)dst[i].y;
+    float x1 = x0 + dst[i].w, y1 = y0 + dst[i].h;
+    float u0 = (float)src[i].x / tw, v0 = (float)src[i].y / th;
+    float u1 = (float)(src[i].x + src[i].w) / tw;
+    float v1 = (float)(src[i].y + src[i].h) / th;
+    SDL_Vertex *v = &sdl->vertices[i * 4];
+    v[0] = (SDL_Vertex){{x0, y0}, c, {u0, v0}};
+    v[1] = (SDL_Vertex){{x1, y0}, c, {u1, v0}};
+    v[2] = (SDL_Vertex){{x1, y1}, c, {u1, v1}};
+    v[3] = (SDL_Vertex){{x0, y1}, c, {u0, v1}};
+  }
+  SDL_RenderGeometry(renderer, texture, sdl->vertices, count * 4, sdl->indices,
+                     count * 6);
+#else
+  SDL_SetTextureColorMod(texture, color.r, color.g, color.b);
+  SDL_SetTextureAlphaMod(texture, color.a);
+  for (int i = 0; i < count; i++) {
+    SDL_RenderCopy(renderer, texture, &src[i], &dst[i]);
+  }
+  SDL_SetTextureColorMod(texture, 255, 255, 255);
+  SDL_SetTextureAlphaMod(texture, 255);
+#endif
+}
+
+static void sdl_backend_destroy(RenderBackend *backend) {
+  SDLBackend *sdl = (SDLBackend *)backend;
+  if (sdl->frame_texture) {
+    SDL_DestroyTexture(sdl->frame_texture);
+  }
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  free(sdl->vertices);
+  free(sdl->indices);
+#endif
+  free(sdl);
+}
+
+RenderBackend *sdl_backend_create(SDL_Renderer *renderer, int width,
+                                  int height) {
+  SDLBackend *sdl = calloc(1, sizeof(SDLBackend));
+  RenderBackend *backend = &sdl->base;
+  backend->name = "sdl";
+  backend->renderer = renderer;
+  backend->begin_frame = sdl_backend_begin_frame;
+  backend->end_frame = sdl_backend_end_frame;
+  backend->present = sdl_backend_present;
+  backend->resize = sdl_backend_resize;
+  backend->set_clip = sdl_backend_set_clip;
+  backend->fill_rects = sdl_backend_fill_rects;
+  backend->load_image = sdl_backend_load_image;
+  backend->free_image = sdl_backend_free_image;
+  backend->draw_image = sdl_backend_draw_image;
+  backend->create_image = sdl_backend_create_image;
+  backend->update_image = sdl_backend_update_image;
+  backend->draw_glyphs = sdl_backend_draw_glyphs;
+  backend->destroy = sdl_backend_destroy;
+  sdl->frame_texture = sdl_backend_create_frame_texture(renderer, width, height);
+  return backend;
+}
+
+/*-------------------------------------
+ * 软件渲染后端（无窗口）
+ * 一帧内的绘制命令先记录下来，帧结束时按 64x64 分块，
+ * 由线程池并行光栅化到内存中的 ARGB8888 帧缓冲。
+ * 矩形混合填充使用 SSE2 / NEON 内核。
+ *-----------------------------------*/
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RASTER_SIMD_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RASTER_SIMD_NEON 1
+#endif
+
+#define RASTER_TILE_SIZE 64
+
+enum { RASTER_FILL, RASTER_IMAGE, RASTER_GLYPH };
+
+typedef struct {
+  int kind;
+  SDL_BlendMode blend;
+  SDL_Rect rect; // 已与记录时的裁剪矩形求交
+  SDL_Rect dst;  // 图像完整的目标矩形，用于计算源坐标
+  SDL_Point src; // 字形在图集页中的左上角
+  Uint32 color;  // ARGB8888
+  SDL_Surface *image;
+} RasterCommand;
+
+typedef struct SoftwareBackend SoftwareBackend;
+
+typedef struct {
+  SDL_Thread **threads;
+  int thread_count;
+  SDL_mutex *lock;
+  SDL_cond *start_cond;
+  SDL_cond *done_cond;
+  int generation;  // 每提交一帧加一，唤醒工作线程
+  int busy_workers;
+  int quit;
+  SDL_atomic_t next_tile;
+  SoftwareBackend *frame;
+} RasterPool;
+
+struct SoftwareBackend {
+  RenderBackend base;
+  Uint32 *pixels;
+  int width, height;
+  SDL_Rect clip;
+  int has_clip;
+
+  RasterCommand *commands;
+  int command_count;
+  int command_capacity;
+
+  // 分块索引：tile_start[t] .. tile_start[t + 1] 为第 t 块涉及的命令
+  int tiles_x, tiles_y;
+  int *tile_start;
+  int *tile_commands;
+  int tile_command_capacity;
+
+  RasterPool pool;
+
+  const char *dump_dir; // 非空时每次 present 把帧写成 BMP
+  int frame_index;
+  int report_stats;    // 退出时把光栅化耗时写到 stderr（--raster-stats）
+  Uint64 raster_ticks; // 累计光栅化耗时
+  int raster_frames;
+};
+
+static inline Uint32 raster_pack(Color c) {
+  return ((Uint32)c.a << 24) | ((Uint32)c.r << 16) | ((Uint32)c.g << 8) | c.b;
+}
+
+// 标量混合：out = (src * a + dst * (256 - a)) >> 8，a 已从 0..255 映射到 0..256
+static inline Uint32 raster_blend_pixel(Uint32 dst, Uint32 src, Uint32 a) {
+  Uint32 ia = 256 - a;
+  Uint32 rb = (((src & 0x00FF00FF) * a + (dst & 0x00FF00FF) * ia) >> 8) &
+              0x00FF00FF;
+  Uint32 ag = ((((src >> 8) & 0x00FF00FF) * a +
+                ((dst >> 8) & 0x00FF00FF) * ia)) &
+              0xFF00FF00;
+  return rb | ag;
+}
+
+// 一行像素的纯色填充；alpha 为 255 时原样写入 src，否则 src 的 alpha 通道须为 255
+static void raster_fill_span(Uint32 *row, int count, Uint32 src, int alpha) {
+  int i = 0;
+  if (alpha >= 255) {
+#if defined(RASTER_SIMD_SSE2)
+    __m128i s = _mm_set1_epi32((int)src);
+    for (; i + 4 <= count; i += 4)
+      _mm_storeu_si128((__m128i *)(row + i), s);
+#elif defined(RASTER_SIMD_NEON)
+    uint32x4_t s = vdupq_n_u32(src);
+    for (; i + 4 <= count; i += 4)
+      vst1q_u32(row + i, s);
+#endif
+    for (; i < count; i++)
+      row[i] = src;
+    return;
+  }
+  if (alpha <= 0)
+    return;
+
+  Uint32 a = (Uint32)alpha + ((Uint32)alpha >> 7); // 1..254 -> 1..255
+#if defined(RASTER_SIMD_SSE2)
+  __m128i zero = _mm_setzero_si128();
+  __m128i sa =
+      _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set1_epi32((int)src), zero),
+                      _mm_set1_epi16((short)a));
+  __m128i ia = _mm_set1_epi16((short)(256 - a));
+  for (; i + 4 <= count; i += 4) {
+    __m128i d = _mm_loadu_si128((__m128i *)(row + i));
+    __m128i lo = _mm_unpacklo_epi8(d, zero);
+    __m128i hi = _mm_unpackhi_epi8(d, zero);
+    lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, ia), sa), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, ia), sa), 8);
+    _mm_storeu_si128((__m128i *)(row + i), _mm_packus_epi16(lo, hi));
+  }
+#elif defined(RASTER_SIMD_NEON)
+  uint16x8_t sa = vmull_u8(vreinterpret_u8_u32(vdup_n_u32(src)),
+                           vdup_n_u8((uint8_t)a));
+  uint8x8_t ia = vdup_n_u8((uint8_t)(256 - a));
+  for (; i + 4 <= count; i += 4) {
+    uint8x16_t d = vld1q_u8((const uint8_t *)(row + i));
+    uint8x8_t lo = vshrn_n_u16(vmlal_u8(sa, vget_low_u8(d), ia), 8);
+    uint8x8_t hi = vshrn_n_u16(vmlal_u8(sa, vget_high_u8(d), ia), 8);
+    vst1q_u8((uint8_t *)(row + i), vcombine_u8(lo, hi));
+  }
+#endif
+  for (; i < count; i++)
+    row[i] = raster_blend_pixel(row[i], src, a);
+}
+
+static void raster_fill(SoftwareBackend *sw, const RasterCommand *cmd,
+                        const SDL_Rect *area) {
+  for (int y = area->y; y < area->y + area->h; y++) {
+    Uint32 *row = sw->pixels + (size_t)y * sw->width + area->x;
+    if (cmd->blend == SDL_BLENDMODE_NONE) {
+      // 不混合时连同 alpha 通道原样写入
+      raster_fill_span(row, area->w, cmd->color, 255);
+    } else {
+      raster_fill_span(row, area->w, cmd->color | 0xFF000000,
+                       (int)(cmd->color >> 24));
+    }
+  }
+}
+
+static void raster_image(SoftwareBackend *sw, const RasterCommand *cmd,
+                         const SDL_Rect *area) {
+  SDL_Surface *image = cmd->image;
+  for (int y = area->y; y < area->y + area->h; y++) {
+    const Uint32 *src = (const Uint32 *)((const Uint8 *)image->pixels +
+                                         (size_t)(y - cmd->dst.y) *
+                                             image->pitch) +
+                        (area->x - cmd->dst.x);
+    Uint32 *row = sw->pixels + (size_t)y * sw->width + area->x;
+    for (int x = 0; x < area->w; x++) {
+      Uint32 s = src[x];
+      Uint32 alpha = s >> 24;
+      if (alpha == 0)
+        continue;
+      if (alpha == 255) {
+        row[x] = s;
+      } else {
+        row[x] = raster_blend_pixel(row[x], s | 0xFF000000,
+                                    alpha + (alpha >> 7));
+      }
+    }
+  }
+}
+
+// 图集中的白色字形只取 alpha 作为覆盖率，颜色来自命令
+static void raster_glyph(SoftwareBackend *sw, const RasterCommand *cmd,
+                         const SDL_Rect *area) {
+  SDL_Surface *image = cmd->image;
+  Uint32 color = cmd->color | 0xFF000000;
+  Uint32 color_alpha = cmd->color >> 24;
+  for (int y = area->y; y < area->y + area->h; y++) {
+    const Uint32 *src =
+        (const Uint32 *)((const Uint8 *)image->pixels +
+                         (size_t)(cmd->src.y + y - cmd->dst.y) *
+                             image->pitch) +
+        cmd->src.x + (area->x - cmd->dst.x);
+    Uint32 *row = sw->pixels + (size_t)y * sw->width + area->x;
+    for (int x = 0; x < area->w; x++) {
+      Uint32 alpha = (src[x] >> 24) * color_alpha / 255;
+      if (alpha == 0)
+        continue;
+      row[x] = raster_blend_pixel(row[x], color, alpha + (alpha >> 7));
+    }
+  }
+}
+
+static void raster_tile(SoftwareBackend *sw, int tile) {
+  SDL_Rect bounds = {(tile % sw->tiles_x) * RASTER_TILE_SIZE,
+                     (tile / sw->tiles_x) * RASTER_TILE_SIZE,
+                     RASTER_TILE_SIZE, RASTER_TILE_SIZE};
+  for (int i = sw->tile_start[tile]; i < sw->tile_start[tile + 1]; i++) {
+    const RasterCommand *cmd = &sw->commands[sw->tile_commands[i]];
+    SDL_Rect area;
+    if (!SDL_IntersectRect(&cmd->rect, &bounds, &area))
+      continue;
+    switch (cmd->kind) {
+    case RASTER_FILL:
+      raster_fill(sw, cmd, &area);
+      break;
+    case RASTER_IMAGE:
+      raster_image(sw, cmd, &area);
+      break;
+    case RASTER_GLYPH:
+      raster_glyph(sw, cmd, &area);
+      break;
+    }
+  }
+}
+
+// 工作线程和主线程共用：抢占下一个分块直到全部完成
+static void raster_run_tiles(SoftwareBackend *sw) {
+  int tile_count = sw->tiles_x * sw->tiles_y;
+  for (;;) {
+    int tile = SDL_AtomicAdd(&sw->pool.next_tile, 1);
+    if (tile >= tile_count)
+      break;
+    if (sw->tile_start[tile] != sw->tile_start[tile + 1])
+      raster_tile(sw, tile);
+  }
+}
+
+static int raster_worker(void *arg) {
+  RasterPool *pool = arg;
+  int seen = 0;
+  SDL_LockMutex(pool->lock);
+  for (;;) {
+    while (!pool->quit && pool->generation == seen)
+      SDL_CondWait(pool->start_cond, pool->lock);
+    if (pool->quit)
+      break;
+    seen = pool->generation;
+    SDL_UnlockMutex(pool->lock);
+
+    raster_run_tiles(pool->frame);
+
+    SDL_LockMutex(pool->lock);
+    if (--pool->busy_workers == 0)
+      SDL_CondSignal(pool->done_cond);
+  }
+  SDL_UnlockMutex(pool->lock);
+  return 0;
+}
+
+static void raster_pool_init(RasterPool *pool, SoftwareBackend *sw,
+                             int thread_count) {
+  memset(pool, 0, sizeof(RasterPool));
+  pool->frame = sw;
+  pool->lock = SDL_CreateMutex();
+  pool->start_cond = SDL_CreateCond();
+  pool->done_cond = SDL_CreateCond();
+  pool->threads = calloc(thread_count > 0 ? thread_count : 1,
+                         sizeof(SDL_Thread *));
+  for (int i = 0; i < thread_count; i++) {
+    SDL_Thread *thread = SDL_CreateThread(raster_worker, "raster", pool);
+    if (!thread)
+      break;
+    pool->threads[pool->thread_count++] = thread;
+  }
+}
+
+static void raster_pool_destroy(RasterPool *pool) {
+  SDL_LockMutex(pool->lock);
+  pool->quit = 1;
+  SDL_CondBroadcast(pool->start_cond);
+  SDL_UnlockMutex(pool->lock);
+  for (int i = 0; i < pool->thread_count; i++) {
+    SDL_WaitThread(pool->threads[i], NULL);
+  }
+  free(pool->threads);
+  SDL_DestroyCond(pool->start_cond);
+  SDL_DestroyCond(pool->done_cond);
+  SDL_DestroyMutex(pool->lock);
+}
+
+// 把命令按覆盖的分块分桶：先计数，再前缀和，最后填充
+static void raster_bin_commands(SoftwareBackend *sw) {
+  int tile_count = sw->tiles_x * sw->tiles_y;
+  memset(sw->tile_start, 0, sizeof(int) * (size_t)(tile_count + 1));
+  int total = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < sw->command_count; i++) {
+      const SDL_Rect *r = &sw->commands[i].rect;
+      int tx0 = r->x / RASTER_TILE_SIZE;
+      int ty0 = r->y / RASTER_TILE_SIZE;
+      int tx1 = (r->x + r->w - 1) / RASTER_TILE_SIZE;
+      int ty1 = (r->y + r->h - 1) / RASTER_TILE_SIZE;
+      for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+          int tile = ty * sw->tiles_x + tx;
+          if (pass == 0)
+            sw->tile_start[tile + 1]++;
+          else
+            sw->tile_commands[sw->tile_start[tile]++] = i;
+        }
+      }
+    }
+    if (pass == 0) {
+      for (int t = 0; t < tile_count; t++)
+        sw->tile_start[t + 1] += sw->tile_start[t];
+      total = sw->tile_start[tile_count];
+      if (total > sw->tile_command_capacity) {
+        sw->tile_command_capacity = total;
+        sw->tile_commands =
+            realloc(sw->tile_commands, sizeof(int) * (size_t)total);
+      }
+    } else {
+      // 填充时 tile_start 被推进到了下一块的起点，整体后移一位复原
+      memmove(&sw->tile_start[1], &sw->tile_start[0],
+              sizeof(int) * (size_t)tile_count);
+      sw->tile_start[0] = 0;
+    }
+  }
+}
+
+static RasterCommand *software_backend_push(SoftwareBackend *sw,
+                                            const SDL_Rect *rect) {
+  SDL_Rect bounds = {0, 0, sw->width, sw->height};
+  SDL_Rect area;
+  if (!SDL_IntersectRect(rect, &bounds, &area))
+    return NULL;
+  if (sw->has_clip && !SDL_IntersectRect(&area, &sw->clip, &area))
+    return NULL;
+  if (sw->command_count == sw->command_capacity) {
+    sw->command_capacity = sw->command_capacity ? sw->command_capacity * 2 : 1024;
+    sw->commands = realloc(sw->commands, sizeof(RasterCommand) *
+                                             (size_t)sw->command_capacity);
+  }
+  RasterCommand *cmd = &sw->commands[sw->command_count++];
+  cmd->rect = area;
+  return cmd;
+}
+
+static int software_backend_begin_frame(RenderBackend *backend) {
+  SoftwareBackend *sw = (SoftwareBackend *)backend;
+  sw->command_count = 0;
+  sw->has_clip = 0;
+  return 1; // 帧缓冲常驻内存，上一帧内容一直保留
+}
+
+static void software_backend_end_frame(RenderBackend *backend) {
+  SoftwareBackend *sw = (SoftwareBackend *)backend;
+  if (sw->command_count == 0)
+    return;
+  Uint64 start = SDL_GetPerformanceCounter();
+  raster_bin_commands(sw);
+
+  RasterPool *pool = &sw->pool;
+  SDL_AtomicSet(&pool->next_tile, 0);
+  SDL_LockMutex(pool->lock);
+  pool->busy_workers = pool->thread_count;
+  pool->generation++;
+  SDL_CondBroadcast(pool->start_cond);
+  SDL_UnlockMutex(pool->lock);
+
+  raster_run_tiles(sw);
+
+  SDL_LockMutex(pool->lock);
+  while (pool->busy_workers > 0)
+    SDL_CondWait(pool->done_cond, pool->lock);
+  SDL_UnlockMutex(pool->lock);
+
+  sw->command_count = 0;
+  sw->raster_ticks += SDL_GetPerformanceCounter() - start;
+  sw->raster_frames++;
+}
+
+static void software_backend_present(RenderBackend *backend) {
+  SoftwareBackend *sw = (SoftwareBackend *)backend;
+  if (!sw->dump_dir)
+    return;
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/frame_%05d.bmp", sw->dump_dir,
+           sw->frame_index++);
+  SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(
+      sw->pixels, sw->width, sw->height, 32, sw->width * 4,
+      SDL_PIXELFORMAT_ARGB8888);
+  if (surface) {
+    if (SDL_SaveBMP(surface, path) != 0) {
+      fprintf(stderr, "Error writing frame %s: %s\n", path, SDL_GetError());
+    }
+    SDL_FreeSurface(surface);
+  }
+}
+
+static void software_backend_resize(RenderBackend *backend, int width,
+                                    int height) {
+  SoftwareBackend *sw = (SoftwareBackend *)backend;
+  free(sw->pixels);
+  sw->width = width;
+  sw->height = height;
+  sw->pixels = calloc((size_t)width * height, sizeof(Uint32));
+  sw->tiles_x = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+  sw->tiles_y = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+  free(sw->tile_start);
+  sw->tile_start =
+      malloc(sizeof(int) * (size_t)(sw->tiles_x * sw->tiles_y + 1));
+}
+
+static void software_backend_set_clip(RenderBackend *backend,
+                                      const SDL_Rect *clip) {
+  SoftwareBackend *sw = (SoftwareBackend *)backend;
+  sw->has_clip = clip != NULL;
+  if (clip)
+    sw->clip = *clip;
+}
+
+static void software_backend_fill_rects(RenderBackend *backend,
+                                        const SDL_Rect *rects,
+                                        const Color *colors, int count,
+                                        SDL_BlendMode blend) {
+  SoftwareBackend *sw = (SoftwareBackend *)backend;
+  for (int i = 0; i < count; i++) {
+    if (blend != SDL_BLENDMODE_NONE && colors[i].a == 0)
+      continue;
+    RasterCommand *cmd = software_backend_push(sw, &rects[i]);
+    if (!cmd)
+      continue;
+    cmd->kind = RASTER_FILL;
+    cmd->blend = blend;
+    cmd->color = raster_pack(colors[i]);
+    cmd->image = NULL;
+  }
+}
+
+static void *software_backend_load_image(RenderBackend *backend,
+                                         SDL_Surface *surface) {
+  return SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+}
+
+static void software_backend_free_image(RenderBackend *backend, void *image) {
+  SDL_FreeSurface((SDL_Surface *)image);
+}
+
+static void software_backend_draw_image(RenderBackend *backend, void *image,
+                                        const SDL_Rect *dst) {
+  SoftwareBackend *sw = (SoftwareBackend *)backend;
+  SDL_Surface *surface = image;
+  SDL_Rect full = {dst->x, dst->y, surface->w, surface->h};
+  SDL_Rect target;
+  if (!SDL_IntersectRect(dst, &full, &target))
+    return;
+  RasterCommand *cmd = software_backend_push(sw, &target);
+  if (!cmd)
+    return;
+  cmd->kind = RASTER_IMAGE;
+  cmd->blend = SDL_BLENDMODE_BLEND;
+  cmd->dst = *dst;
+  cmd->color = 0;
+  cmd->image = surface;
+}
+
+static void *software_backend_create_image(RenderBackend *backend, int width,
+                                           int height) {
+  return SDL_CreateRGBSurfaceWithFormat(0, width, height, 32,
+                                        SDL_PIXELFORMAT_ARGB8888);
+}
+
+// 图集页只会写入本帧尚未引用过的区域，已记录的命令不受影响
+static void software_backend_update_image(RenderBackend *backend, void *image,
+                                          const SDL_Rect *rect,
+                                          SDL_Surface *surface) {
+  SDL_Surface *page = image;
+  for (int y = 0; y < rect->h; y++) {
+    memcpy((Uint8 *)page->pixels + (size_t)(rect->y + y) * page->pitch +
+               (size_t)rect->x * 4,
+           (const Uint8 *)surface->pixels + (size_t)y * surface->pitch,
+           (size_t)rect->w * 4);
+  }
+}
+
+static void software_backend_draw_glyphs(RenderBackend *backend, void *image,
+                                         const SDL_Rect *src,
+                                         const SDL_Rect *dst, int count,
+                                         Color color) {
+  SoftwareBackend *sw = (SoftwareBackend *)backend;
+  for (int i = 0; i < count; i++) {
+    RasterCommand *cmd = software_backend_push(sw, &dst[i]);
+    if (!cmd)
+      continue;
+    cmd->kind = RASTER_GLYPH;
+    cmd->blend = SDL_BLENDMODE_BLEND;
+    cmd->dst = dst[i];
+    cmd->src = (SDL_Point){src[i].x, src[i].y};
+    cmd->color = raster_pack(color);
+    cmd->image = image;
+  }
+}
+
+static void software_backend_destroy(RenderBackend *backend) {
+  SoftwareBackend *sw = (SoftwareBackend *)backend;
+  raster_pool_destroy(&sw->pool);
+  if (sw->report_stats && sw->raster_frames > 0) {
+    double ms = (double)sw->raster_ticks * 1000.0 /
+                (double)SDL_GetPerformanceFrequency() / sw->raster_frames;
+    fprintf(stderr, "software backend: %d frames, %.3f ms/frame raster\n",
+            sw->raster_frames, ms);
+  }
+  free(sw->pixels);
+  free(sw->commands);
+  free(sw->tile_start);
+  free(sw->tile_commands);
+  free(sw);
+}
+
+RenderBackend *software_backend_create(int width, int height,
+                                       const char *dump_dir,
+                                       int report_stats) {
+  SoftwareBackend *sw = calloc(1, sizeof(SoftwareBackend));
+  RenderBackend *backend = &sw->base;
+  backend->name = "software";
+  backend->renderer = NULL;
+  backend->begin_frame = software_backend_begin_frame;
+  backend->end_frame = software_backend_end_frame;
+  backend->present = software_backend_present;
+  backend->resize = software_backend_resize;
+  backend->set_clip = software_backend_set_clip;
+  backend->fill_rects = software_backend_fill_rects;
+  backend->load_image = software_backend_load_image;
+  backend->free_image = software_backend_free_image;
+  backend->draw_image = software_backend_draw_image;
+  backend->create_image = software_backend_create_image;
+  backend->update_image = software_backend_update_image;
+  backend->draw_glyphs = software_backend_draw_glyphs;
+  backend->destroy = software_backend_destroy;
+  sw->dump_dir = dump_dir;
+  sw->report_stats = report_stats;
+  software_backend_resize(backend, width, height);
+  // 主线程也参与光栅化
+  raster_pool_init(&sw->pool, sw, SDL_GetCPUCount() - 1);
+  return backend;
+}
+
+/*-------------------------------------
+ * 字形图集
+ * 每个字形只光栅化一次，按行装箱到共享的图集页中；
+ * 文字节点排版成字形序列，绘制时每个图集页一次提交全部四边形。
+ * 主字体缺少的字形（如中文）回退到 SimKai.ttf。
+ * 图集页按字节预算做 LRU 淘汰，本帧已经用到的页不会被淘汰。
+ * 字形只在绘制时才光栅化，可见区域外的文字只排版不光栅化；
+ * 不可见文字的字形所在页会被淘汰，重新可见时按需再光栅化。
+ * 节点不持有纹理，预算（setTextCacheBudget）对全部文字都生效
+ *-----------------------------------*/
+#define GLYPH_ATLAS_PAGE_SIZE 512
+#define GLYPH_ATLAS_PADDING 1
+#define GLYPH_ATLAS_DEFAULT_BUDGET (8 * 1024 * 1024)
+#define GLYPH_ATLAS_PAGE_BYTES                                                 \
+  ((size_t)GLYPH_ATLAS_PAGE_SIZE * GLYPH_ATLAS_PAGE_SIZE * 4)
+
+typedef struct GlyphPage {
+  void *image; // 由渲染后端创建的图像句柄
+  int cursor_x, shelf_y, shelf_h; // 当前行的写入位置和行高
+  int last_used; // 最近一次被绘制的帧号
+} GlyphPage;
+
+typedef struct Glyph {
+  // 缓存键
+  TTF_Font *font;
+  Uint32 ch;
+
+  TTF_Font *render_font; // 实际光栅化的字体，缺字时为回退字体
+  int advance;
+  int offset_x, offset_y; // 位图左上角相对笔位置（行顶）的偏移
+  int w, h;               // 位图尺寸，空白字形为 0
+  GlyphPage *page; // NULL 表示尚未光栅化或所在页已被淘汰
+  SDL_Rect src;    // 在图集页中的位置
+} Glyph;
+
+typedef struct {
+  GHashTable *glyphs; // (字体, 码点) -> Glyph，度量信息常驻
+  GlyphPage **pages;
+  int page_count;
+  int page_capacity;
+  size_t budget;
+  int frame;
+  TTF_Font *fallback;
+  RenderBackend *backend;
+  // 字形表和字体由主线程绘制与布局线程测量共用（SDL 互斥锁可重入）
+  SDL_mutex *lock;
+  // 绘制时按页收集四边形的临时缓冲
+  SDL_Rect *src_rects;
+  SDL_Rect *dst_rects;
+  int rect_capacity;
+} GlyphAtlas;
+
+static GlyphAtlas glyph_atlas = {.budget = GLYPH_ATLAS_DEFAULT_BUDGET};
+
+// 文字节点的排版结果，文字或换行宽度变化时重建
+typedef struct {
+  Glyph *glyph;
+  int x, y; // 笔位置，相对节点左上角
+} TextGlyph;
+
+typedef struct TextLayout {
+  TTF_Font *font;
+  int wrap_width;
+  SDL_Rect bounds; // 全部字形位图的包围盒，相对节点左上角
+  int count;
+  TextGlyph *glyphs;
+} TextLayout;
+
+// SDL_ttf 2.0.18 之前只有 16 位码点接口
+static int glyph_is_provided(TTF_Font *font, Uint32 ch) {
+#if SDL_TTF_VERSION_ATLEAST(2, 0, 18)
+  return TTF_GlyphIsProvided32(font, ch);
+#else
+  return ch <= 0xFFFF && TTF_GlyphIsProvided(font, (Uint16)ch);
+#endif
+}
+
+static int glyph_metrics(TTF_Font *font, Uint32 ch, int *minx, int *maxx,
+                         int *advance) {
+#if SDL_TTF_VERSION_ATLEAST(2, 0, 18)
+  return TTF_GlyphMetrics32(font, ch, minx, maxx, NULL, NULL, advance);
+#else
+  if (ch > 0xFFFF)
+    return -1;
+  return TTF_GlyphMetrics(font, (Uint16)ch, minx, maxx, NULL, NULL, advance);
+#endif
+}
+
+static int glyph_kerning(TTF_Font *font, Uint32 prev, Uint32 ch) {
+#if SDL_TTF_VERSION_ATLEAST(2, 0, 18)
+  return TTF_GetFontKerningSizeGlyphs32(font, prev, ch);
+#else
+  if (prev > 0xFFFF || ch > 0xFFFF)
+    return 0;
+  return TTF_GetFontKerningSizeGlyphs(font, (Uint16)prev, (Uint16)ch);
+#endif
+}
+
+// 白色渲染，绘制时再乘上文字颜色
+static SDL_Surface *glyph_render(TTF_Font *font, Uint32 ch) {
+  SDL_Color white = {255, 255, 255, 255};
+#if SDL_TTF_VERSION_ATLEAST(2, 0, 18)
+  return TTF_RenderGlyph32_Blended(font, ch, white);
+#else
+  if (ch > 0xFFFF)
+    return NULL;
+  return TTF_RenderGlyph_Blended(font, (Uint16)ch, white);
+#endif
+}
+
+static guint glyph_hash(gconstpointer key) {
+  const Glyph *glyph = key;
+  return (guint)(uintptr_t)glyph->font * 31 + glyph->ch;
+}
+
+static gboolean glyph_equal(gconstpointer a, gconstpointer b) {
+  const Glyph *ga = a;
+  const Glyph *gb = b;
+  return ga->font == gb->font && ga->ch == gb->ch;
+}
+
+void glyph_atlas_init(RenderBackend *backend, TTF_Font *fallback) {
+  glyph_atlas.glyphs = g_hash_table_new(glyph_hash, glyph_equal);
+  glyph_atlas.backend = backend;
+  glyph_atlas.fallback = fallback;
+  glyph_atlas.lock = SDL_CreateMutex();
+}
+
+static void glyph_atlas_free_page(int index) {
+  GlyphPage *page = glyph_atlas.pages[index];
+  // 引用这一页的字形在下次绘制时重新光栅化
+  GHashTableIter iter;
+  gpointer key;
+  SDL_LockMutex(glyph_atlas.lock);
+  g_hash_table_iter_init(&iter, glyph_atlas.glyphs);
+  while (g_hash_table_iter_next(&iter, &key, NULL)) {
+    Glyph *glyph = key;
+    if (glyph->page == page)
+      glyph->page = NULL;
+  }
+  SDL_UnlockMutex(glyph_atlas.lock);
+  glyph_atlas.backend->free_image(glyph_atlas.backend, page->image);
+  free(page);
+  glyph_atlas.pages[index] = glyph_atlas.pages[--glyph_atlas.page_count];
+}
+
+// 释放最久未用的页，直到回到预算以内；只在两帧之间调用
+static void glyph_atlas_trim(void) {
+  while (glyph_atlas.page_count > 0 &&
+         (size_t)glyph_atlas.page_count * GLYPH_ATLAS_PAGE_BYTES >
+             glyph_atlas.budget) {
+    int oldest = 0;
+    for (int i = 1; i < glyph_atlas.page_count; i++) {
+      if (glyph_atlas.pages[i]->last_used <
+          glyph_atlas.pages[oldest]->last_used)
+        oldest = i;
+    }
+    glyph_atlas_free_page(oldest);
+  }
+}
+
+void glyph_atlas_set_budget(size_t budget) {
+  glyph_atlas.budget = budget;
+  glyph_atlas_trim();
+}
+
+// 每帧开始时调用，上一帧因为页被占用而超出的预算在这里回收
+void glyph_atlas_begin_frame(void) {
+  glyph_atlas_trim();
+  glyph_atlas.frame++;
+}
+
+void glyph_atlas_destroy(void) {
+  while (glyph_atlas.page_count > 0) {
+    glyph_atlas_free_page(glyph_atlas.page_count - 1);
+  }
+  free(glyph_atlas.pages);
+  glyph_atlas.pages = NULL;
+  glyph_atlas.page_capacity = 0;
+  if (glyph_atlas.glyphs) {
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, glyph_atlas.glyphs);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+      g_hash_table_iter_steal(&iter);
+      free(key);
+    }
+    g_hash_table_destroy(glyph_atlas.glyphs);
+    glyph_atlas.glyphs = NULL;
+  }
+  free(glyph_atlas.src_rects);
+  free(glyph_atlas.dst_rects);
+  glyph_atlas.src_rects = glyph_atlas.dst_rects = NULL;
+  glyph_atlas.rect_capacity = 0;
+  if (glyph_atlas.lock) {
+    SDL_DestroyMutex(glyph_atlas.lock);
+    glyph_atlas.lock = NULL;
+  }
+}
+
+// 查找字形度量，首次出现时只取度量，不光栅化
+static Glyph *glyph_atlas_lookup(TTF_Font *font, Uint32 ch) {
+  Glyph key = {0};
+  key.font = font;
+  key.ch = ch;
+  Glyph *glyph = g_hash_table_lookup(glyph_atlas.glyphs, &key);
+  if (glyph)
+    return glyph;
+
+  glyph = calloc(1, sizeof(Glyph));
+  *glyph = key;
+  TTF_Font *render_font = font;
+  if (!glyph_is_provided(font, ch) && glyph_atlas.fallback &&
+      glyph_is_provided(glyph_atlas.fallback, ch)) {
+    render_font = glyph_atlas.fallback;
+  }
+  glyph->render_font = render_font;
+  int minx = 0, maxx = 0, advance = 0;
+  if (glyph_metrics(render_font, ch, &minx, &maxx, &advance) == 0) {
+    glyph->advance = advance;
+    if (maxx > minx) {
+      // 与 SDL_ttf 渲染单字时的位图范围一致
+      glyph->offset_x = minx < 0 ? minx : 0;
+      glyph->offset_y = TTF_FontAscent(font) - TTF_FontAscent(render_font);
+      glyph->w = (maxx > advance ? maxx : advance) - glyph->offset_x;
+      glyph->h = TTF_FontHeight(render_font);
+    }
+  }
+  g_hash_table_insert(glyph_atlas.glyphs, glyph, glyph);
+  return glyph;
+}
+
+// 在页内按行装箱，放不下返回 0
+static int glyph_page_alloc(GlyphPage *page, int w, int h, SDL_Rect *out) {
+  int pw = w + GLYPH_ATLAS_PADDING;
+  int ph = h + GLYPH_ATLAS_PADDING;
+  if (page->cursor_x + pw > GLYPH_ATLAS_PAGE_SIZE) {
+    page->shelf_y += page->shelf_h;
+    page->cursor_x = 0;
+    page->shelf_h = 0;
+  }
+  if (pw > GLYPH_ATLAS_PAGE_SIZE || page->shelf_y + ph > GLYPH_ATLAS_PAGE_SIZE)
+    return 0;
+  *out = (SDL_Rect){page->cursor_x, page->shelf_y, w, h};
+  page->cursor_x += pw;
+  if (ph > page->shelf_h)
+    page->shelf_h = ph;
+  return 1;
+}
+
+static GlyphPage *glyph_atlas_new_page(void) {
+  RenderBackend *backend = glyph_atlas.backend;
+  void *image = backend->create_image(backend, GLYPH_ATLAS_PAGE_SIZE,
+                                      GLYPH_ATLAS_PAGE_SIZE);
+  if (!image)
+    return NULL;
+  if (glyph_atlas.page_count == glyph_atlas.page_capacity) {
+    glyph_atlas.page_capacity =
+        glyph_atlas.page_capacity ? glyph_atlas.page_capacity * 2 : 4;
+    glyph_atlas.pages =
+        realloc(glyph_atlas.pages,
+                sizeof(GlyphPage *) * (size_t)glyph_atlas.page_capacity);
+  }
+  GlyphPage *page = calloc(1, sizeof(GlyphPage));
+  page->image = image;
+  glyph_atlas.pages[glyph_atlas.page_count++] = page;
+  return page;
+}
+
+// 依次尝试：已有页的剩余空间 -> 预算内新建一页 -> 清空本帧未用过的最旧页
+// -> 超出预算新建（下一帧开始时回收）
+static GlyphPage *glyph_atlas_place(int w, int h, SDL_Rect *out) {
+  for (int i = glyph_atlas.page_count - 1; i >= 0; i--) {
+    if (glyph_page_alloc(glyph_atlas.pages[i], w, h, out))
+      return glyph_atlas.pages[i];
+  }
+
+  GlyphPage *page = NULL;
+  if ((size_t)(glyph_atlas.page_count + 1) * GLYPH_ATLAS_PAGE_BYTES >
+      glyph_atlas.budget) {
+    int oldest = -1;
+    for (int i = 0; i < glyph_atlas.page_count; i++) {
+      GlyphPage *candidate = glyph_atlas.pages[i];
+      if (candidate->last_used < glyph_atlas.frame &&
+          (oldest < 0 ||
+           candidate->last_used < glyph_atlas.pages[oldest]->last_used))
+        oldest = i;
+    }
+    if (oldest >= 0) {
+      glyph_atlas_free_page(oldest);
+    }
+  }
+  page = glyph_atlas_new_page();
+  if (!page || !glyph_page_alloc(page, w, h, out))
+    return NULL;
+  return page;
+}
+
+// 保证字形位于图集中并标记所在页本帧已使用，空白字形返回 0
+static int glyph_atlas_ensure(Glyph *glyph) {
+  if (glyph->page) {
+    glyph->page->last_used = glyph_atlas.frame;
+    return 1;
+  }
+  if (glyph->w <= 0 || glyph->h <= 0)
+    return 0;
+
+  SDL_Surface *surface = glyph_render(glyph->render_font, glyph->ch);
+  if (!surface)
+    return 0;
+  if (surface->format->format != SDL_PIXELFORMAT_ARGB8888) {
+    SDL_Surface *converted =
+        SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(surface);
+    if (!converted)
+      return 0;
+    surface = converted;
+  }
+  // 位图以度量为准裁剪，绘制范围与排版计算的包围盒保持一致
+  int w = surface->w < glyph->w ? surface->w : glyph->w;
+  int h = surface->h < glyph->h ? surface->h : glyph->h;
+  SDL_Rect rect;
+  GlyphPage *page = glyph_atlas_place(w, h, &rect);
+  if (page) {
+    glyph_atlas.backend->update_image(glyph_atlas.backend, page->image, &rect,
+                                      surface);
+    page->last_used = glyph_atlas.frame;
+    glyph->page = page;
+    glyph->src = rect;
+  }
+  SDL_FreeSurface(surface);
+  return page != NULL;
+}
+
+// 解码一个 UTF-8 字符，非法字节按 U+FFFD 处理并前进一个字节
+static Uint32 utf8_next(const char **text) {
+  const unsigned char *s = (const unsigned char *)*text;
+  Uint32 ch = s[0];
+  int extra = 0;
+  if (ch >= 0xF0 && ch <= 0xF4) {
+    ch &= 0x07;
+    extra = 3;
+  } else if (ch >= 0xE0) {
+    ch &= 0x0F;
+    extra = 2;
+  } else if (ch >= 0xC2 && ch < 0xE0) {
+    ch &= 0x1F;
+    extra = 1;
+  } else if (ch >= 0x80) {
+    *text += 1;
+    return 0xFFFD;
+  }
+  for (int i = 1; i <= extra; i++) {
+    if ((s[i] & 0xC0) != 0x80) {
+      *text += 1;
+      return 0xFFFD;
+    }
+    ch = (ch << 6) | (s[i] & 0x3F);
+  }
+  *text += extra + 1;
+  return ch;
+}
+
+// 中日韩表意文字之间可以任意断行
+static int glyph_breaks_anywhere(Uint32 ch) {
+  return (ch >= 0x2E80 && ch <= 0x9FFF) || (ch >= 0xAC00 && ch <= 0xD7AF) ||
+         (ch >= 0xF900 && ch <= 0xFAFF) || (ch >= 0xFF00 && ch <= 0xFFEF) ||
+         (ch >= 0x20000 && ch <= 0x2FFFF);
+}
+
+void text_layout_free(TreeNode *node) {
+  if (node->text_layout) {
+    free(node->text_layout->glyphs);
+    free(node->text_layout);
+    node->text_layout = NULL;
+  }
+}
+
+// 按换行宽度（0 表示不换行）逐字排版，glyphs 至少能容纳 strlen(text) 项。
+// 返回字形数，*last_line_y 为最后一行的行顶
+static int text_layout_glyphs(TTF_Font *font, const char *text,
+                              int wrap_width, TextGlyph *glyphs,
+                              int *last_line_y) {
+  int count = 0;
+  int line_skip = TTF_FontLineSkip(font);
+  int pen_x = 0, line_y = 0;
+  int line_start = 0; // 当前行的第一个字形
+  int break_at = -1;  // 当前行最后一个断行位置，从该字形起换到下一行
+  Uint32 prev = 0;
+  const char *p = text;
+  while (*p) {
+    Uint32 ch = utf8_next(&p);
+    if (ch == '\n') {
+      pen_x = 0;
+      line_y += line_skip;
+      line_start = count;
+      break_at = -1;
+      prev = 0;
+      continue;
+    }
+    if (ch == '\t')
+      ch = ' ';
+    if (ch < 0x20)
+      continue;
+
+    Glyph *glyph = glyph_atlas_lookup(font, ch);
+    if (prev && glyph->render_font == font)
+      pen_x += glyph_kerning(font, prev, ch);
+    if (glyph_breaks_anywhere(ch))
+      break_at = count;
+    // 超出换行宽度时，把最后一个断行位置之后的字形移到下一行；
+    // 没有断行位置的长单词在当前字形前强制断开
+    if (wrap_width > 0 && ch != ' ' && pen_x + glyph->advance > wrap_width &&
+        count > line_start) {
+      int from = break_at > line_start ? break_at : count;
+      int shift = from < count ? glyphs[from].x : pen_x;
+      line_y += line_skip;
+      for (int i = from; i < count; i++) {
+        glyphs[i].x -= shift;
+        glyphs[i].y = line_y;
+      }
+      pen_x -= shift;
+      line_start = from;
+      break_at = -1;
+    }
+
+    TextGlyph *item = &glyphs[count++];
+    item->glyph = glyph;
+    item->x = pen_x;
+    item->y = line_y;
+    pen_x += glyph->advance;
+    if (ch == ' ')
+      break_at = count; // 空格之后可以断行
+    prev = ch;
+  }
+  *last_line_y = line_y;
+  return count;
+}
+
+// 按换行宽度排版节点文字（0 表示不换行），结果缓存在节点上
+TextLayout *text_layout_update(TTF_Font *font, TreeNode *node,
+                               int wrap_width) {
+  TextLayout *layout = node->text_layout;
+  if (layout && layout->font == font && layout->wrap_width == wrap_width)
+    return layout;
+  text_layout_free(node);
+
+  layout = calloc(1, sizeof(TextLayout));
+  layout->font = font;
+  layout->wrap_width = wrap_width;
+  // 码点数不会超过字节数
+  size_t len = strlen(node->text);
+  layout->glyphs = malloc(sizeof(TextGlyph) * (len ? len : 1));
+  int last_line_y;
+  SDL_LockMutex(glyph_atlas.lock);
+  layout->count = text_layout_glyphs(font, node->text, wrap_width,
+                                     layout->glyphs, &last_line_y);
+  SDL_UnlockMutex(glyph_atlas.lock);
+
+  for (int i = 0; i < layout->count; i++) {
+    const Glyph *glyph = layout->glyphs[i].glyph;
+    if (glyph->w <= 0)
+      continue;
+    SDL_Rect rect = {layout->glyphs[i].x + glyph->offset_x,
+                     layout->glyphs[i].y + glyph->offset_y, glyph->w,
+                     glyph->h};
+    if (layout->bounds.w <= 0)
+      layout->bounds = rect;
+    else
+      SDL_UnionRect(&layout->bounds, &rect, &layout->bounds);
+  }
+  node->text_layout = layout;
+  return layout;
+}
+
+// 绘制排版好的文字：先保证全部字形在图集中，再按页各提交一次
+void text_layout_draw(RenderBackend *backend, const TextLayout *layout, int x,
+                      int y, Color color) {
+  if (layout->count > glyph_atlas.rect_capacity) {
+    glyph_atlas.rect_capacity = layout->count;
+    glyph_atlas.src_rects =
+        realloc(glyph_atlas.src_rects,
+                sizeof(SDL_Rect) * (size_t)glyph_atlas.rect_capacity);
+    glyph_atlas.dst_rects =
+        realloc(glyph_atlas.dst_rects,
+                sizeof(SDL_Rect) * (size_t)glyph_atlas.rect_capacity);
+  }
+  int drawable = 0;
+  SDL_LockMutex(glyph_atlas.lock);
+  for (int i = 0; i < layout->count; i++) {
+    drawable += glyph_atlas_ensure(layout->glyphs[i].glyph);
+  }
+  SDL_UnlockMutex(glyph_atlas.lock);
+  if (drawable == 0)
+    return;
+
+  for (int p = 0; p < glyph_atlas.page_count && drawable > 0; p++) {
+    GlyphPage *page = glyph_atlas.pages[p];
+    if (page->last_used != glyph_atlas.frame)
+      continue;
+    int count = 0;
+    for (int i = 0; i < layout->count; i++) {
+      const TextGlyph *item = &layout->glyphs[i];
+      const Glyph *glyph = item->glyph;
+      if (glyph->page != page)
+        continue;
+      glyph_atlas.src_rects[count] = glyph->src;
+      glyph_atlas.dst_rects[count] =
+          (SDL_Rect){x + item->x + glyph->offset_x,
+                     y + item->y + glyph->offset_y, glyph->src.w,
+                     glyph->src.h};
+      count++;
+    }
+    if (count > 0) {
+      backend->draw_glyphs(backend, page->image, glyph_atlas.src_rects,
+                           glyph_atlas.dst_rects, count, color);
+      drawable -= count;
+    }
+  }
+}
+
+/*-------------------------------------
+ * 文字测量
+ * TEXT 节点的 Yoga 测量函数，换行规则与绘制时的排版一致。
+ * 结果按 (文字, 字体, 宽度模式, 宽度) 缓存，重复布局不会重新测量。
+ *-----------------------------------*/
+#define TEXT_MEASURE_CACHE_MAX 4096
+
+typedef struct {
+  // 缓存键
+  char *text;
+  TTF_Font *font;
+  YGMeasureMode width_mode;
+  int width; // 换行宽度，不限宽度时为 0
+  guint hash;
+
+  // 缓存值：内容尺寸，未按约束裁剪
+  YGSize size;
+} TextMeasureEntry;
+
+typedef struct {
+  GHashTable *table;
+  TTF_Font *font; // 布局使用的字体，字体加载后才能测量
+  TextGlyph *scratch;
+  size_t scratch_capacity;
+} TextMeasurer;
+
+static TextMeasurer text_measurer = {0};
+
+static guint text_measure_hash(gconstpointer key) {
+  return ((const TextMeasureEntry *)key)->hash;
+}
+
+static gboolean text_measure_equal(gconstpointer a, gconstpointer b) {
+  const TextMeasureEntry *ea = a;
+  const TextMeasureEntry *eb = b;
+  return ea->hash == eb->hash && ea->font == eb->font &&
+         ea->width_mode == eb->width_mode && ea->width == eb->width &&
+         strcmp(ea->text, eb->text) == 0;
+}
+
+static void text_measure_entry_free(gpointer data) {
+  TextMeasureEntry *entry = data;
+  free(entry->text);
+  free(entry);
+}
+
+void text_measure_init(TTF_Font *font) {
+  text_measurer.table = g_hash_table_new_full(
+      text_measure_hash, text_measure_equal, text_measure_entry_free, NULL);
+  text_measurer.font = font;
+}
+
+void text_measure_destroy(void) {
+  if (text_measurer.table) {
+    g_hash_table_destroy(text_measurer.table);
+    text_measurer.table = NULL;
+  }
+  free(text_measurer.scratch);
+  text_measurer.scratch = NULL;
+  text_measurer.scratch_capacity = 0;
+  text_measurer.font = NULL;
+}
+
+// 与 TTF_SizeUTF8 一致：宽度取各行最后一个非空白字形的前进位置
+static YGSize text_measure_compute(TTF_Font *font, const char *text,
+                                   int wrap_width) {
+  size_t len = strlen(text);
+  if (len > text_measurer.scratch_capacity) {
+    text_measurer.scratch_capacity = len;
+    text_measurer.scratch = realloc(text_measurer.scratch,
+                                    sizeof(TextGlyph) * len);
+  }
+  int last_line_y = 0;
+  int count = text_layout_glyphs(font, text, wrap_width, text_measurer.scratch,
+                                 &last_line_y);
+  int width = 0;
+  for (int i = 0; i < count; i++) {
+    const TextGlyph *item = &text_measurer.scratch[i];
+    if (item->glyph->ch == ' ')
+      continue;
+    if (item->x + item->glyph->advance > width)
+      width = item->x + item->glyph->advance;
+  }
+  YGSize size = {(float)width, (float)(last_line_y + TTF_FontHeight(font))};
+  return size;
+}
+
+static YGSize text_measure_lookup(TTF_Font *font, const char *text,
+                                  YGMeasureMode width_mode, int width) {
+  TextMeasureEntry key = {0};
+  key.text = (char *)text;
+  key.font = font;
+  key.width_mode = width_mode;
+  key.width = width;
+  key.hash = g_str_hash(text) * 31 + (guint)(uintptr_t)font;
+  key.hash = (key.hash * 31 + (guint)width_mode) * 31 + (guint)width;
+
+  TextMeasureEntry *entry = g_hash_table_lookup(text_measurer.table, &key);
+  if (entry)
+    return entry->size;
+
+  // 缓存只保存布局中间结果，超过上限时整表清空即可
+  if (g_hash_table_size(text_measurer.table) >= TEXT_MEASURE_CACHE_MAX)
+    g_hash_table_remove_all(text_measurer.table);
+  entry = malloc(sizeof(TextMeasureEntry));
+  *entry = key;
+  entry->text = strdup(text);
+  entry->size = text_measure_compute(font, text, width);
+  g_hash_table_insert(text_measurer.table, entry, entry);
+  return entry->size;
+}
+
+static YGSize text_measure_func(YGNodeConstRef yogaNode, float width,
+                                YGMeasureMode width_mode, float height,
+                                YGMeasureMode height_mode) {
+  // 影子节点的上下文是文字副本，在布局线程调用
+  const char *text = YGNodeGetContext(yogaNode);
+  YGSize size = {0, 0};
+  if (!text || !text_measurer.font)
+    return size;
+
+  int wrap_width = 0;
+  if (width_mode != YGMeasureModeUndefined) {
+    wrap_width = (int)width;
+    if (wrap_width < 1)
+      wrap_width = 1; // 0 表示不换行，极窄时按每个字形一行处理
+  }
+  SDL_LockMutex(glyph_atlas.lock);
+  size = text_measure_lookup(text_measurer.font, text, width_mode, wrap_width);
+  SDL_UnlockMutex(glyph_atlas.lock);
+
+  if (width_mode == YGMeasureModeExactly ||
+      (width_mode == YGMeasureModeAtMost && size.width > width))
+    size.width = width;
+  if (height_mode == YGMeasureModeExactly ||
+      (height_mode == YGMeasureModeAtMost && size.height > height))
+    size.height = height;
+  return size;
+}
+
+/*-------------------------------------
+ * 脏标记与重绘区域
+ * 节点被修改时打上脏标记并记下旧矩形，布局完成后遍历一次，
+ * 把脏节点和位置变化节点的新旧矩形并入重绘区域。
+ * 重绘区域为空时整帧跳过。
+ *-----------------------------------*/
+static SDL_Rect damage_rect = {0, 0, 0, 0};
+static int damage_empty = 1;
+static int tree_dirty = 1; // 有节点被标脏或布局重新计算过
+
+void damage_add(const SDL_Rect *rect) {
+  if (SDL_RectEmpty(rect))
+    return;
+  if (damage_empty) {
+    damage_rect = *rect;
+    damage_empty = 0;
+  } else {
+    SDL_UnionRect(&damage_rect, rect, &damage_rect);
+  }
+}
+
+void damage_all(void) {
+  SDL_Rect all = {0, 0, VIEW_WIDTH, VIEW_HEIGHT};
+  damage_add(&all);
+}
+
+void damage_reset(void) {
+  damage_empty = 1;
+  damage_rect = (SDL_Rect){0, 0, 0, 0};
+}
+
+void mark_node_dirty(TreeNode *node) {
+  if (!node)
+    return;
+  node->dirty = 1;
+  tree_dirty = 1;
+}
+
+// 节点即将从树上移除，其整棵子树上次绘制的区域都需要重绘
+void damage_subtree(TreeNode *node) {
+  damage_add(&node->paint_box);
+  for (int i = 0; i < node->childCount; i++) {
+    damage_subtree(node->children[i]);
+  }
+}
+
+/*-------------------------------------
+ * 合成图层
+ * 设置了 layer: "cache" 的节点把整棵子树渲染到离屏纹理中，
+ * 子树内部没有修改或重新布局时，后续帧直接贴图。
+ * 图层内容裁剪到节点自身的布局矩形。
+ *-----------------------------------*/
+#define LAYER_DEFAULT_BUDGET (32 * 1024 * 1024)
+
+typedef struct Layer {
+  TreeNode *node;
+  SDL_Texture *texture;
+  int w, h;
+  size_t bytes;
+  int valid;                // 纹理内容是否与子树一致
+  int busy;                 // 正在作为渲染目标，嵌套图层渲染时不可淘汰
+  struct Layer *prev, *next; // LRU 链表，头部为最近使用
+} Layer;
+
+typedef struct {
+  Layer *lru_head;
+  Layer *lru_tail;
+  size_t bytes;
+  size_t budget;
+} LayerCache;
+
+static LayerCache layer_cache = {NULL, NULL, 0, LAYER_DEFAULT_BUDGET};
+
+static void layer_lru_unlink(Layer *layer) {
+  if (layer->prev)
+    layer->prev->next = layer->next;
+  else
+    layer_cache.lru_head = layer->next;
+  if (layer->next)
+    layer->next->prev = layer->prev;
+  else
+    layer_cache.lru_tail = layer->prev;
+  layer->prev = layer->next = NULL;
+}
+
+static void layer_lru_push_front(Layer *layer) {
+  layer->prev = NULL;
+  layer->next = layer_cache.lru_head;
+  if (layer_cache.lru_head)
+    layer_cache.lru_head->prev = layer;
+  layer_cache.lru_head = layer;
+  if (!layer_cache.lru_tail)
+    layer_cache.lru_tail = layer;
+}
+
+// 只释放纹理，图层本身保留，下次用到时重新渲染
+static void layer_release_texture(Layer *layer) {
+  if (layer->texture) {
+    SDL_DestroyTexture(layer->texture);
+    layer->texture = NULL;
+    layer_cache.bytes -= layer->bytes;
+  }
+  layer->bytes = 0;
+  layer->w = layer->h = 0;
+  layer->valid = 0;
+}
+
+// 为即将创建的纹理腾出空间，从最久未使用的图层开始淘汰
+static void layer_evict(size_t incoming) {
+  Layer *layer = layer_cache.lru_tail;
+  while (layer && layer_cache.bytes + incoming > layer_cache.budget) {
+    Layer *prev = layer->prev;
+    if (!layer->busy)
+      layer_release_texture(layer);
+    layer = prev;
+  }
+}
+
+void layer_set_budget(size_t budget) {
+  layer_cache.budget = budget;
+  layer_evict(0);
+}
+
+void layer_create(TreeNode *node) {
+  if (node->layer)
+    return;
+  Layer *layer = calloc(1, sizeof(Layer));
+  layer->node = node;
+  node->layer = layer;
+  layer_lru_push_front(layer);
+}
+
+void layer_destroy(TreeNode *node) {
+  Layer *layer = node->layer;
+  if (!layer)
+    return;
+  layer_release_texture(layer);
+  layer_lru_unlink(layer);
+  free(layer);
+  node->layer = NULL;
+}
+
+// 节点自身及所有祖先上的图层内容都已过期
+void invalidate_layers(TreeNode *node) {
+  for (; node; node = node->parent) {
+    if (node->layer)
+      node->layer->valid = 0;
+  }
+}
+
+/*-------------------------------------
+ * 后台布局
+ * JS 只修改节点上的 Yoga 样式树，布局线程计算的是一棵影子树：
+ * 线程空闲时主线程把样式、文字和子节点结构同步到影子树后提交计算，
+ * 计算完成后再由主线程把结果发布到节点的 layout 字段。
+ * 渲染和命中测试只读已发布的结果，新布局就绪前继续显示上一份完整布局。
+ *-----------------------------------*/
+typedef struct {
+  SDL_Thread *thread; // 创建失败时退化为在主线程同步计算
+  SDL_mutex *lock;
+  SDL_cond *cond;
+  int pending; // 已提交，等待布局线程取走
+  int done;    // 布局线程计算完成
+  int quit;
+  YGNodeRef root; // 本次计算的影子根节点
+  float width, height;
+
+  // 以下只在主线程访问
+  int busy;      // 已提交、尚未发布
+  int published; // 已发布的布局次数
+  // 已删除节点的影子节点，布局线程空闲时再释放
+  YGNodeRef *retired;
+  int retired_count;
+  int retired_capacity;
+} LayoutWorker;
+
+static LayoutWorker layout_worker = {0};
+int layout_dirty = 1; // 样式、结构或文字有变化，需要重新布局
+
+enum {
+  SHADOW_TEXT = 1 << 0,     // 文字内容
+  SHADOW_STYLE = 1 << 1,    // Yoga 样式
+  SHADOW_CHILDREN = 1 << 2, // 子节点列表
+  SHADOW_ALL = SHADOW_TEXT | SHADOW_STYLE | SHADOW_CHILDREN,
+};
+
+// 记下节点需要同步的内容，并标记祖先，同步时只走有变化的子树
+void layout_mark_shadow(TreeNode *node, int flags) {
+  node->shadow_dirty |= flags;
+  for (TreeNode *p = node->parent; p && !p->shadow_descendant_dirty;
+       p = p->parent)
+    p->shadow_descendant_dirty = 1;
+  layout_dirty = 1;
+}
+
+static int layout_worker_main(void *arg) {
+  LayoutWorker *worker = arg;
+  SDL_LockMutex(worker->lock);
+  for (;;) {
+    while (!worker->quit && !worker->pending)
+      SDL_CondWait(worker->cond, worker->lock);
+    if (worker->quit)
+      break;
+    worker->pending = 0;
+    YGNodeRef root = worker->root;
+    float width = worker->width, height = worker->height;
+    SDL_UnlockMutex(worker->lock);
+
+    YGNodeCalculateLayout(root, width, height, YGDirectionLTR);
+
+    SDL_LockMutex(worker->lock);
+    worker->done = 1;
+    SDL_CondBroadcast(worker->cond);
+  }
+  SDL_UnlockMutex(worker->lock);
+  return 0;
+}
+
+void layout_worker_init(void) {
+  layout_worker.lock = SDL_CreateMutex();
+  layout_worker.cond = SDL_CreateCond();
+  layout_worker.thread =
+      SDL_CreateThread(layout_worker_main, "layout", &layout_worker);
+  if (!layout_worker.thread) {
+    SDL_Log("Layout thread unavailable, computing layout on the main thread: "
+            "%s",
+            SDL_GetError());
+  }
+}
+
+static YGNodeRef layout_shadow_create(TreeNode *node) {
+  YGNodeRef shadow = YGNodeNew();
+  if (node->node_type == TEXT) {
+    // 文字副本归影子节点所有，测量函数在布局线程读取
+    YGNodeSetContext(shadow, strdup(node->text ? node->text : ""));
+    YGNodeSetMeasureFunc(shadow, text_measure_func);
+  }
+  return shadow;
+}
+
+// 节点释放时调用，影子节点可能正在被布局线程使用，只记录下来
+void layout_retire_shadow(TreeNode *node) {
+  if (!node->shadow)
+    return;
+  if (layout_worker.retired_count == layout_worker.retired_capacity) {
+    layout_worker.retired_capacity =
+        layout_worker.retired_capacity ? layout_worker.retired_capacity * 2
+                                       : 64;
+    layout_worker.retired =
+        realloc(layout_worker.retired,
+                sizeof(YGNodeRef) * (size_t)layout_worker.retired_capacity);
+  }
+  layout_worker.retired[layout_worker.retired_count++] = node->shadow;
+  node->shadow = NULL;
+}
+
+static void layout_free_retired(void) {
+  // 先拆开父子关系，逐个释放时不会再访问已释放的节点
+  for (int i = 0; i < layout_worker.retired_count; i++) {
+    YGNodeRemoveAllChildren(layout_worker.retired[i]);
+  }
+  for (int i = 0; i < layout_worker.retired_count; i++) {
+    free(YGNodeGetContext(layout_worker.retired[i]));
+    YGNodeFree(layout_worker.retired[i]);
+  }
+  layout_worker.retired_count = 0;
+}
+
+// 把有变化的样式、文字和子节点结构同步到影子树，只在布局线程空闲时调用。
+// 没有标记的子树整棵跳过，沿用影子树上的样式和 Yoga 的布局缓存
+static void layout_sync_node(TreeNode *node) {
+  int flags = node->shadow_dirty;
+  if (!node->shadow) {
+    node->shadow = layout_shadow_create(node);
+    flags = SHADOW_ALL;
+  } else if ((flags & SHADOW_TEXT) && node->node_type == TEXT) {
+    free(YGNodeGetContext(node->shadow));
+    YGNodeSetContext(node->shadow, strdup(node->text));
+    YGNodeMarkDirty(node->shadow);
+  }
+  YGNodeRef shadow = node->shadow;
+  if (flags & SHADOW_STYLE)
+    YGNodeCopyStyle(shadow, node->yogaNode);
+
+  if (node->shadow_descendant_dirty || (flags & SHADOW_CHILDREN)) {
+    for (int i = 0; i < node->childCount; i++) {
+      TreeNode *child = node->children[i];
+      if (!child->shadow || child->shadow_dirty ||
+          child->shadow_descendant_dirty)
+        layout_sync_node(child);
+    }
+  }
+  if (flags & SHADOW_CHILDREN) {
+    int same = YGNodeGetChildCount(shadow) == (unsigned)node->childCount;
+    for (int i = 0; same && i < node->childCount; i++) {
+      if (YGNodeGetChild(shadow, i) != node->children[i]->shadow)
+        same = 0;
+    }
+    if (!same) {
+      YGNodeRemoveAllChildren(shadow);
+      for (int i = 0; i < node->childCount; i++) {
+        YGNodeInsertChild(shadow, node->children[i]->shadow, i);
+      }
+    }
+  }
+  node->shadow_dirty = 0;
+  node->shadow_descendant_dirty = 0;
+}
+
+static void layout_worker_submit(TreeNode *root, float width, float height) {
+  layout_sync_node(root);
+  // 同步后已删除的影子节点都不在树上了
+  layout_free_retired();
+  layout_worker.busy = 1;
+  if (!layout_worker.thread) {
+    YGNodeCalculateLayout(root->shadow, width, height, YGDirectionLTR);
+    layout_worker.done = 1;
+    return;
+  }
+  SDL_LockMutex(layout_worker.lock);
+  layout_worker.root = root->shadow;
+  layout_worker.width = width;
+  layout_worker.height = height;
+  layout_worker.pending = 1;
+  SDL_CondBroadcast(layout_worker.cond);
+  SDL_UnlockMutex(layout_worker.lock);
+}
+
+// 影子树的计算结果写回节点（前台缓冲）；计算开始后才加入的节点没有影子节点，
+// 提交后换了父节点的节点算出的位置属于旧父节点，都保持原状，留给下一次布局
+static void layout_publish(TreeNode *node) {
+  YGNodeRef shadow = node->shadow;
+  if (!shadow)
+    return;
+  if (node->parent && YGNodeGetOwner(shadow) != node->parent->shadow) {
+    layout_dirty = 1;
+    return;
+  }
+  node->layout.left = YGNodeLayoutGetLeft(shadow);
+  node->layout.top = YGNodeLayoutGetTop(shadow);
+  node->layout.width = YGNodeLayoutGetWidth(shadow);
+  node->layout.height = YGNodeLayoutGetHeight(shadow);
+  node->has_layout = 1;
+  for (int i = 0; i < node->childCount; i++) {
+    layout_publish(node->children[i]);
+  }
+}
+
+// 计算完成时发布结果，wait 为 1 时阻塞等待；返回是否发布了新布局
+static int layout_worker_poll(int wait) {
+  if (!layout_worker.busy)
+    return 0;
+  SDL_LockMutex(layout_worker.lock);
+  while (wait && !layout_worker.done)
+    SDL_CondWait(layout_worker.cond, layout_worker.lock);
+  int done = layout_worker.done;
+  layout_worker.done = 0;
+  SDL_UnlockMutex(layout_worker.lock);
+  if (!done)
+    return 0;
+
+  layout_worker.busy = 0;
+  layout_worker.published++;
+  layout_publish(root_data);
+  tree_dirty = 1;
+  geometry_dirty = 1;
+  return 1;
+}
+
+// 在节点树释放之后调用
+void layout_worker_destroy(void) {
+  if (layout_worker.thread) {
+    SDL_LockMutex(layout_worker.lock);
+    layout_worker.quit = 1;
+    SDL_CondBroadcast(layout_worker.cond);
+    SDL_UnlockMutex(layout_worker.lock);
+    SDL_WaitThread(layout_worker.thread, NULL);
+    layout_worker.thread = NULL;
+  }
+  layout_free_retired();
+  free(layout_worker.retired);
+  layout_worker.retired = NULL;
+  layout_worker.retired_capacity = 0;
+  SDL_DestroyCond(layout_worker.cond);
+  SDL_DestroyMutex(layout_worker.lock);
+}
+
+/*-------------------------------------
+ * 核心功能实现
+ *-----------------------------------*/
+// 只接受 "#RGB" 和 "#RRGGBB"，格式不对返回 0 且不修改 out
+int parse_hex_color(const char *hex, Color *out) {
+  if (!hex || hex[0] != '#')
+    return 0;
+  size_t len = strlen(hex + 1);
+  if (len != 3 && len != 6)
+    return 0;
+  unsigned int rgb = 0;
+  for (size_t i = 1; i <= len; i++) {
+    if (!g_ascii_isxdigit(hex[i]))
+      return 0;
+    rgb = (rgb << 4) | (unsigned int)g_ascii_xdigit_value(hex[i]);
+  }
+  Color color = COLOR_BLACK;
+  if (len == 6) {
+    color.r = (rgb >> 16) & 0xFF;
+    color.g = (rgb >> 8) & 0xFF;
+    color.b = rgb & 0xFF;
+  } else {
+    color.r = ((rgb >> 8) & 0xF) * 17;
+    color.g = ((rgb >> 4) & 0xF) * 17;
+    color.b = (rgb & 0xF) * 17;
+  }
+  *out = color;
+  return 1;
+}
+
+// 格式不对时返回黑色
+Color parse_color(const char *hex) {
+  Color color = COLOR_BLACK;
+  parse_hex_color(hex, &color);
+  return color;
+}
+
+/*-------------------------------------
+ * 样式共享表
+ * React 树里大量节点的样式完全相同。样式按值入表并计数引用，
+ * 每种样式只保存一份，连同一个写好布局属性的 Yoga 模板节点；
+ * 节点应用样式时用 YGNodeCopyStyle 一次拷贝全部布局属性。
+ * defineStyle 定义的样式类也只是表中的一项，class 属性直接换成它
+ *-----------------------------------*/
+static GHashTable *style_table = NULL;   // NodeStyle* 集合，按值比较
+static GHashTable *style_classes = NULL; // 类名 -> 共享样式
+
+static guint style_hash(gconstpointer key) {
+  // FNV-1a
+  const unsigned char *bytes = key;
+  guint hash = 2166136261u;
+  for (size_t i = 0; i < STYLE_VALUE_SIZE; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static gboolean style_equal(gconstpointer a, gconstpointer b) {
+  return memcmp(a, b, STYLE_VALUE_SIZE) == 0;
+}
+
+
+// createNode 的默认样式：白底黑边，按行排列，其余与 Yoga 默认一致
+void style_set_defaults(NodeStyle *style) {
+  memset(style, 0, sizeof(*style)); // 长度全部为 YGUnitUndefined
+  style->flex = 1.0f;
+  style->flexGrow = YGUndefined;
+  style->flexShrink = YGUndefined;
+  style->flexDirection = YGFlexDirectionRow;
+  style->justifyContent = YGJustifyFlexStart;
+  style->alignItems = YGAlignStretch;
+  style->alignSelf = YGAlignAuto;
+  style->alignContent = YGAlignFlexStart;
+  style->flexWrap = YGWrapNoWrap;
+  style->positionType = YGPositionTypeRelative;
+  style->display = YGDisplayFlex;
+  style->overflow = YGOverflowVisible;
+  style->aspectRatio = YGUndefined;
+  style->margin[YGEdgeAll] = (StyleLength){10.0f, YGUnitPoint};
+  style->backgroundColor = COLOR_WHITE;
+  style->borderColor = COLOR_BLACK;
+}
+
+static void style_apply_length(YGNodeRef yoga, StyleLength length,
+                               void (*points)(YGNodeRef, float),
+                               void (*percent)(YGNodeRef, float),
+                               void (*automatic)(YGNodeRef)) {
+  if (length.unit == YGUnitPercent) {
+    percent(yoga, length.value);
+  } else if (length.unit == YGUnitAuto && automatic) {
+    automatic(yoga);
+  } else {
+    points(yoga, length.unit == YGUnitPoint ? length.value : YGUndefined);
+  }
+}
+
+static void style_apply_edges(YGNodeRef yoga, const StyleLength *edges,
+                              void (*points)(YGNodeRef, YGEdge, float),
+                              void (*percent)(YGNodeRef, YGEdge, float),
+                              void (*automatic)(YGNodeRef, YGEdge)) {
+  for (int e = 0; e < STYLE_EDGE_COUNT; e++) {
+    YGEdge edge = (YGEdge)e;
+    if (edges[e].unit == YGUnitPercent) {
+      percent(yoga, edge, edges[e].value);
+    } else if (edges[e].unit == YGUnitAuto && automatic) {
+      automatic(yoga, edge);
+    } else {
+      points(yoga, edge,
+             edges[e].unit == YGUnitPoint ? edges[e].value : YGUndefined);
+    }
+  }
+}
+
+// 模板节点只在样式入表时写一次
+static void style_apply_yoga(YGNodeRef yoga, const NodeStyle *style) {
+  YGNodeStyleSetFlex(yoga, style->flex);
+  YGNodeStyleSetFlexGrow(yoga, style->flexGrow);
+  YGNodeStyleSetFlexShrink(yoga, style->flexShrink);
+  style_apply_length(yoga, style->flexBasis, YGNodeStyleSetFlexBasis,
+                     YGNodeStyleSetFlexBasisPercent, YGNodeStyleSetFlexBasisAuto);
+  YGNodeStyleSetFlexDirection(yoga, style->flexDirection);
+  YGNodeStyleSetJustifyContent(yoga, style->justifyContent);
+  YGNodeStyleSetAlignItems(yoga, style->alignItems);
+  YGNodeStyleSetAlignSelf(yoga, style->alignSelf);
+  YGNodeStyleSetAlignContent(yoga, style->alignContent);
+  YGNodeStyleSetFlexWrap(yoga, style->flexWrap);
+  YGNodeStyleSetPositionType(yoga, style->positionType);
+  YGNodeStyleSetDisplay(yoga, style->display);
+  YGNodeStyleSetOverflow(yoga, style->overflow);
+  YGNodeStyleSetAspectRatio(yoga, style->aspectRatio);
+  style_apply_length(yoga, style->width, YGNodeStyleSetWidth,
+                     YGNodeStyleSetWidthPercent, YGNodeStyleSetWidthAuto);
+  style_apply_length(yoga, style->height, YGNodeStyleSetHeight,
+                     YGNodeStyleSetHeightPercent, YGNodeStyleSetHeightAuto);
+  style_apply_length(yoga, style->minWidth, YGNodeStyleSetMinWidth,
+                     YGNodeStyleSetMinWidthPercent, NULL);
+  style_apply_length(yoga, style->minHeight, YGNodeStyleSetMinHeight,
+                     YGNodeStyleSetMinHeightPercent, NULL);
+  style_apply_length(yoga, style->maxWidth, YGNodeStyleSetMaxWidth,
+                     YGNodeStyleSetMaxWidthPercent, NULL);
+  style_apply_length(yoga, style->maxHeight, YGNodeStyleSetMaxHeight,
+                     YGNodeStyleSetMaxHeightPercent, NULL);
+  style_apply_edges(yoga, style->position, YGNodeStyleSetPosition,
+                    YGNodeStyleSetPositionPercent, NULL);
+  style_apply_edges(yoga, style->margin, YGNodeStyleSetMargin,
+                    YGNodeStyleSetMarginPercent, YGNodeStyleSetMarginAuto);
+  style_apply_edges(yoga, style->padding, YGNodeStyleSetPadding,
+                    YGNodeStyleSetPaddingPercent, NULL);
+}
+
+static void style_release_value(gpointer style);
+
+void style_table_init(void) {
+  style_table = g_hash_table_new(style_hash, style_equal);
+  style_classes =
+      g_hash_table_new_full(g_str_hash, g_str_equal, free, style_release_value);
+}
+
+// 取得与 value 相同的共享样式并增加引用；value 只读取值字段
+const NodeStyle *style_intern(const NodeStyle *value) {
+  NodeStyle *style = g_hash_table_lookup(style_table, value);
+  if (style) {
+    style->refcount++;
+    return style;
+  }
+  style = malloc(sizeof(NodeStyle));
+  memcpy(style, value, STYLE_VALUE_SIZE);
+  style->refcount = 1;
+  style->yoga = YGNodeNew();
+  style_apply_yoga(style->yoga, style);
+  g_hash_table_add(style_table, style);
+  return style;
+}
+
+void style_release(const NodeStyle *style) {
+  if (!style)
+    return;
+  NodeStyle *shared = (NodeStyle *)style;
+  if (--shared->refcount > 0)
+    return;
+  g_hash_table_remove(style_table, shared);
+  YGNodeFree(shared->yoga);
+  free(shared);
+}
+
+static void style_release_value(gpointer style) { style_release(style); }
+
+// 类先释放，它们持有的引用归还后，剩下的都是泄漏
+void style_table_destroy(void) {
+  g_hash_table_destroy(style_classes);
+  style_classes = NULL;
+  if (g_hash_table_size(style_table) > 0) {
+    fprintf(stderr, "style table: %u styles still referenced\n",
+            g_hash_table_size(style_table));
+  }
+  g_hash_table_destroy(style_table);
+  style_table = NULL;
+}
+
+// 节点换用与 value 相同的样式。布局属性变化时一次性拷贝模板节点的 Yoga 样式
+void node_set_style(TreeNode *node, const NodeStyle *value) {
+  const NodeStyle *style = style_intern(value);
+  const NodeStyle *old = node->style;
+  if (style == old) {
+    style_release(style);
+    return;
+  }
+  if (!old || memcmp(old, style, STYLE_LAYOUT_SIZE) != 0) {
+    YGNodeCopyStyle(node->yogaNode, style->yoga);
+    layout_mark_shadow(node, SHADOW_STYLE);
+  }
+  node->style = style;
+  style_release(old);
+  mark_node_dirty(node);
+}
+
+// 把节点当前的样式记为初始样式，之后移除的属性恢复为这里的取值
+void node_rebase_style(TreeNode *node) {
+  const NodeStyle *old = node->base_style;
+  node->base_style = style_intern(node->style);
+  style_release(old);
+}
+
+const NodeStyle *style_class_lookup(const char *name) {
+  return g_hash_table_lookup(style_classes, name);
+}
+
+// 重复定义同名类只影响之后设置 class 的节点，已应用的节点仍持有旧样式
+void style_class_define(const char *name, const NodeStyle *value) {
+  g_hash_table_replace(style_classes, strdup(name),
+                       (gpointer)style_intern(value));
+}
+
+YGNodeRef create_yoga_node(TreeNode *data) {
+  YGNodeRef yogaNode = YGNodeNew();
+  YGNodeCopyStyle(yogaNode, data->style->yoga);
+  // 文字节点的测量函数设置在影子节点上（见 layout_shadow_create）
+  return yogaNode;
+}
+
+// 文字节点的内容：短文字（React 里多为数字和标签）放进 slab
+char *node_text_dup(const char *text) {
+  size_t size = strlen(text) + 1;
+  if (size > TEXT_SLAB_SIZE)
+    return strdup(text);
+  char *copy = slab_alloc(&text_slab);
+  memcpy(copy, text, size);
+  return copy;
+}
+
+void node_text_free(char *text) {
+  if (!text)
+    return;
+  if (strlen(text) + 1 > TEXT_SLAB_SIZE)
+    free(text);
+  else
+    slab_free(&text_slab, text);
+}
+
+// id 由调用方给出：flushMutations 中的节点使用 JS 预留的 id
+TreeNode *create_node_with_id(int id, NodeType node_type, const char *text,
+                              float flex, float margin,
+                              YGFlexDirection flexDirection,
+                              YGJustify justifyContent) {
+  TreeNode *node = slab_alloc(&node_slab);
+  node->id = id;
+  node_slots_insert(node);
+  node->wrapper = JS_UNDEFINED;
+
+  node->node_type = node_type;
+  memory_counters.nodes[node_type]++;
+  if (node_type == TEXT) {
+    node->text = node_text_dup(text); // 复制文字内容
+  } else {
+    node->text = NULL;
+  }
+
+  // 初始化白底黑边
+  NodeStyle style;
+  style_set_defaults(&style);
+  style.flex = flex;
+  style.margin[YGEdgeAll] = (StyleLength){margin, YGUnitPoint};
+  style.flexDirection = flexDirection;
+  style.justifyContent = justifyContent;
+  node->style = style_intern(&style);
+  node->base_style = style_intern(&style);
+  node->childCount = 0;
+  node->children = NULL;
+  node->parent = NULL;
+  node->listener_buckets = NULL;
+  node->listener_bucket_count = 0;
+  node->shadow = NULL;
+  node->shadow_dirty = SHADOW_ALL;
+  node->shadow_descendant_dirty = 0;
+  node->layout = (LayoutBox){0, 0, 0, 0};
+  node->has_layout = 0;
+  node->text_layout = NULL;
+  node->dirty = 1;
+  node->layout_box = (SDL_Rect){0, 0, 0, 0};
+  node->paint_box = (SDL_Rect){0, 0, 0, 0};
+  node->geometry_index = -1;
+  node->scroll_x = node->scroll_y = 0;
+  node->layer = NULL;
+
+  node->yogaNode = create_yoga_node(node);
+
+  return node;
+}
+
+// id 表已满时返回 NULL
+TreeNode *create_node(NodeType node_type, const char *text, float flex,
+                      float margin, YGFlexDirection flexDirection,
+                      YGJustify justifyContent) {
+  int id = node_id_reserve();
+  if (id < 0)
+    return NULL;
+  return create_node_with_id(id, node_type, text, flex, margin, flexDirection,
+                             justifyContent);
+}
+
+// 文字节点：无边框、透明背景、无外边距
+TreeNode *create_text_node(int id, const char *text) {
+  TreeNode *node = create_node_with_id(id, TEXT, text, 1.0f, 0,
+                                       YGFlexDirectionRow, YGJustifyFlexStart);
+  NodeStyle style = *node->style;
+  style.borderColor = COLOR_WHITE;
+  style.backgroundColor = COLOR_TRANSPARENT;
+  node_set_style(node, &style);
+  node_rebase_style(node);
+  return node;
+}
+
+void set_node_text(TreeNode *node, const char *text) {
+  if (!node || node->node_type != TEXT) {
+    return;
+  }
+  node_text_free(node->text);       // 释放旧的文字内容
+  node->text = node_text_dup(text); // 复制新的文字内容
+  text_layout_free(node);           // 文字变化后重新排版
+  layout_mark_shadow(node, SHADOW_TEXT); // 内容尺寸需要重新测量
+  mark_node_dirty(node);
+}
+
+/*-------------------------------------
+ * 事件监听
+ * 监听器按事件类型（JSAtom）分桶存放在节点上。
+ * 全局委托表记录每种事件类型在整棵树上的监听器总数：
+ * 没有任何监听器的事件（例如无人关心的 mousemove）直接跳过，
+ * 框架也可以只在根节点上为每种事件注册一个监听器，靠冒泡接收所有事件
+ *-----------------------------------*/
+static GHashTable *listener_type_counts = NULL; // JSAtom -> 监听器个数
+
+static void listener_count_add(JSAtom type, int delta) {
+  if (!listener_type_counts)
+    listener_type_counts = g_hash_table_new(g_direct_hash, g_direct_equal);
+  gpointer key = GUINT_TO_POINTER(type);
+  int count = GPOINTER_TO_INT(g_hash_table_lookup(listener_type_counts, key));
+  count += delta;
+  memory_counters.listeners += delta;
+  if (count > 0)
+    g_hash_table_insert(listener_type_counts, key, GINT_TO_POINTER(count));
+  else
+    g_hash_table_remove(listener_type_counts, key);
+}
+
+int listener_type_has_any(JSAtom type) {
+  return listener_type_counts &&
+         g_hash_table_lookup(listener_type_counts, GUINT_TO_POINTER(type));
+}
+
+ListenerBucket *listener_bucket_find(TreeNode *node, JSAtom type) {
+  for (int i = 0; i < node->listener_bucket_count; i++) {
+    if (node->listener_buckets[i].type == type)
+      return &node->listener_buckets[i];
+  }
+  return NULL;
+}
+
+// 初始容量的监听器数组来自 slab，扩容后改用 malloc
+static void listener_array_free(ListenerBucket *bucket) {
+  if (bucket->capacity == LISTENER_SLAB_CAPACITY)
+    slab_free(&listener_slab, bucket->listeners);
+  else
+    free(bucket->listeners);
+}
+
+// 同一回调在同一阶段重复注册时忽略，与 DOM 一致
+void add_listener(JSContext *ctx, TreeNode *node, JSAtom type,
+                  JSValueConst callback, int capture) {
+  if (!node || type == JS_ATOM_NULL || !JS_IsFunction(ctx, callback)) {
+    return;
+  }
+  ListenerBucket *bucket = listener_bucket_find(node, type);
+  if (!bucket) {
+    node->listener_buckets =
+        realloc(node->listener_buckets,
+                sizeof(ListenerBucket) * (size_t)(node->listener_bucket_count + 1));
+    bucket = &node->listener_buckets[node->listener_bucket_count++];
+    bucket->type = JS_DupAtom(ctx, type);
+    bucket->count = bucket->capacity = 0;
+    bucket->listeners = NULL;
+  }
+  for (int i = 0; i < bucket->count; i++) {
+    if (bucket->listeners[i].capture == capture &&
+        JS_VALUE_GET_OBJ(bucket->listeners[i].callback) ==
+            JS_VALUE_GET_OBJ(callback))
+      return;
+  }
+  if (bucket->count == bucket->capacity) {
+    int capacity =
+        bucket->capacity ? bucket->capacity * 2 : LISTENER_SLAB_CAPACITY;
+    EventListener *listeners =
+        capacity == LISTENER_SLAB_CAPACITY
+            ? slab_alloc(&listener_slab)
+            : malloc(sizeof(EventListener) * (size_t)capacity);
+    if (bucket->count > 0)
+      memcpy(listeners, bucket->listeners,
+             sizeof(EventListener) * (size_t)bucket->count);
+    listener_array_free(bucket);
+    bucket->listeners = listeners;
+    bucket->capacity = capacity;
+  }
+  bucket->listeners[bucket->count++] =
+      (EventListener){JS_DupValue(ctx, callback), capture};
+  listener_count_add(type, 1);
+}
+
+void remove_listener(JSContext *ctx, TreeNode *node, JSAtom type,
+                     JSValueConst callback, int capture) {
+  if (!node || !JS_IsObject(callback)) {
+    return;
+  }
+  ListenerBucket *bucket = listener_bucket_find(node, type);
+  if (!bucket)
+    return;
+  for (int i = 0; i < bucket->count; i++) {
+    EventListener *listener = &bucket->listeners[i];
+    if (listener->capture == capture &&
+        JS_VALUE_GET_OBJ(listener->callback) == JS_VALUE_GET_OBJ(callback)) {
+      JS_FreeValue(ctx, listener->callback);
+      memmove(listener, listener + 1,
+              sizeof(EventListener) * (size_t)(bucket->count - i - 1));
+      bucket->count--;
+      listener_count_add(type, -1);
+      break;
+    }
+  }
+  // 空桶留着，同类型再次注册时复用
+}
+
+void listeners_free(JSContext *ctx, TreeNode *node) {
+  for (int b = 0; b < node->listener_bucket_count; b++) {
+    ListenerBucket *bucket = &node->listener_buckets[b];
+    for (int i = 0; i < bucket->count; i++)
+      JS_FreeValue(ctx, bucket->listeners[i].callback);
+    if (bucket->count > 0)
+      listener_count_add(bucket->type, -bucket->count);
+    JS_FreeAtom(ctx, bucket->type);
+    listener_array_free(bucket);
+  }
+  free(node->listener_buckets);
+  node->listener_buckets = NULL;
+  node->listener_bucket_count = 0;
+}
+
+void listener_counts_free(void) {
+  if (listener_type_counts) {
+    g_hash_table_destroy(listener_type_counts);
+    listener_type_counts = NULL;
+  }
+}
+
+void free_tree(JSContext *ctx, TreeNode *node) {
+  if (node) {
+    if (node == selectedNode) {
+      selectedNode = NULL;
+    }
+    if (node == hoveredNode) {
+      hoveredNode = NULL;
+    }
+    // JS 中可能仍持有包装对象，断开后 unwrap_node 返回 NULL，不会悬空
+    if (!JS_IsUndefined(node->wrapper)) {
+      JS_SetOpaque(node->wrapper, NULL);
+      node->wrapper = JS_UNDEFINED;
+    }
+    if (node->node_type == TEXT) {
+      text_layout_free(node);
+      node_text_free(node->text);
+    }
+    listeners_free(ctx, node);
+    for (int i = 0; i < node->childCount; i++) {
+      free_tree(ctx, node->children[i]);
+    }
+    layer_destroy(node);
+    layout_retire_shadow(node);
+    YGNodeFree(node->yogaNode);
+    free(node->children);
+    node_slots_remove(node);
+    style_release(node->style);
+    style_release(node->base_style);
+    memory_counters.nodes[node->node_type]--;
+    slab_free(&node_slab, node);
+  }
+}
+
+/*-------------------------------------
+ * 节点包装对象
+ * 每个 TreeNode 至多一个 JS 包装对象，重复包装返回同一个对象。
+ * 节点只记下包装对象而不持有引用：JS 不再使用时照常回收，
+ * 终结器清空节点上的记录；节点先被释放时（free_tree）清空包装对象的
+ * opaque，之后 unwrap_node 得到 NULL
+ *-----------------------------------*/
+static JSClassID tree_node_class_id;
+
+static void tree_node_finalizer(JSRuntime *rt, JSValue val) {
+  TreeNode *node = JS_GetOpaque(val, tree_node_class_id);
+  if (node)
+    node->wrapper = JS_UNDEFINED;
+  memory_counters.wrappers--;
+}
+
+static JSClassDef tree_node_class = {
+    .class_name = "TreeNode",
+    .finalizer = tree_node_finalizer,
+};
+
+int tree_node_class_init(JSRuntime *rt) {
+  if (tree_node_class_id == 0)
+    JS_NewClassID(&tree_node_class_id);
+  return JS_NewClass(rt, tree_node_class_id, &tree_node_class);
+}
+
+JSValue wrap_node(JSContext *ctx, TreeNode *node) {
+  if (!JS_IsUndefined(node->wrapper))
+    return JS_DupValue(ctx, node->wrapper);
+
+  // 创建对象并关联类
+  JSValue obj = JS_NewObjectClass(ctx, tree_node_class_id);
+  if (JS_IsException(obj))
+    return obj;
+
+  // 绑定 C 指针到 JS 对象
+  JS_SetOpaque(obj, node);
+  node->wrapper = obj;
+  memory_counters.wrappers++;
+  return obj;
+}
+
+/*-------------------------------------
+ * 事件派发
+ * 从根到目标的路径上依次经过捕获、目标、冒泡三个阶段：
+ * 捕获阶段自根向下调用 capture 监听器，目标节点上按注册顺序调用全部监听器，
+ * 冒泡阶段自下向上调用非 capture 监听器（bubbles 为假的事件没有冒泡阶段）。
+ * stopPropagation() 置 cancelBubble，当前节点的其余监听器仍会执行。
+ * 回调可能删除路径上的节点，路径按 id 记录，每一步重新查找
+ *-----------------------------------*/
+enum { EVENT_CAPTURING_PHASE = 1, EVENT_AT_TARGET = 2, EVENT_BUBBLING_PHASE = 3 };
+
+typedef struct {
+  JSAtom click, mousemove, mouseenter, mouseleave, scroll;
+  JSAtom cancel_bubble, current_target, event_phase;
+  JSValue proto; // 事件对象的原型，提供 stopPropagation / composedPath
+} EventRuntime;
+
+static EventRuntime events = {0};
+
+static JSValue js_event_stopPropagation(JSContext *ctx, JSValueConst this_val,
+                                        int argc, JSValueConst *argv) {
+  JS_SetProperty(ctx, this_val, events.cancel_bubble, JS_TRUE);
+  return JS_UNDEFINED;
+}
+
+// 从目标到根的节点数组，按需生成，不在每次派发时分配
+static JSValue js_event_composedPath(JSContext *ctx, JSValueConst this_val,
+                                     int argc, JSValueConst *argv) {
+  JSValue path = JS_NewArray(ctx);
+  JSValue target = JS_GetPropertyStr(ctx, this_val, "target");
+  TreeNode *node = JS_GetOpaque(target, tree_node_class_id);
+  JS_FreeValue(ctx, target);
+  for (uint32_t i = 0; node; node = node->parent, i++)
+    JS_SetPropertyUint32(ctx, path, i, wrap_node(ctx, node));
+  return path;
+}
+
+void events_init(JSContext *ctx) {
+  events.click = JS_NewAtom(ctx, "click");
+  events.mousemove = JS_NewAtom(ctx, "mousemove");
+  events.mouseenter = JS_NewAtom(ctx, "mouseenter");
+  events.mouseleave = JS_NewAtom(ctx, "mouseleave");
+  events.scroll = JS_NewAtom(ctx, "scroll");
+  events.cancel_bubble = JS_NewAtom(ctx, "cancelBubble");
+  events.current_target = JS_NewAtom(ctx, "currentTarget");
+  events.event_phase = JS_NewAtom(ctx, "eventPhase");
+  events.proto = JS_NewObject(ctx);
+  JS_SetPropertyStr(ctx, events.proto, "stopPropagation",
+                    JS_NewCFunction(ctx, js_event_stopPropagation,
+                                    "stopPropagation", 0));
+  JS_SetPropertyStr(
+      ctx, events.proto, "composedPath",
+      JS_NewCFunction(ctx, js_event_composedPath, "composedPath", 0));
+}
+
+// 必须在 JS_FreeContext 之前调用
+void events_free(JSContext *ctx) {
+  JSAtom *atoms[] = {&events.click,         &events.mousemove,
+                     &events.mouseenter,    &events.mouseleave,
+                     &events.scroll,        &events.cancel_bubble,
+                     &events.current_target, &events.event_phase};
+  for (size_t i = 0; i < sizeof(atoms) / sizeof(atoms[0]); i++) {
+    JS_FreeAtom(ctx, *atoms[i]);
+    *atoms[i] = JS_ATOM_NULL;
+  }
+  JS_FreeValue(ctx, events.proto);
+  events.proto = JS_UNDEFINED;
+}
+
+// 调用 node 上当前阶段的监听器，返回是否已停止传播
+static int invoke_listeners(JSContext *ctx, TreeNode *node, JSAtom type,
+                            int phase, JSValueConst event_obj) {
+  ListenerBucket *bucket = listener_bucket_find(node, type);
+  if (!bucket || bucket->count == 0)
+    return 0;
+
+  // 先拷贝出本阶段的回调：回调中增删监听器不影响这次派发
+  EventListener local[8];
+  EventListener *callbacks = local;
+  if (bucket->count > 8)
+    callbacks = malloc(sizeof(EventListener) * (size_t)bucket->count);
+  int count = 0;
+  for (int i = 0; i < bucket->count; i++) {
+    EventListener *listener = &bucket->listeners[i];
+    if (phase == EVENT_AT_TARGET ||
+        listener->capture == (phase == EVENT_CAPTURING_PHASE)) {
+      callbacks[count].callback = JS_DupValue(ctx, listener->callback);
+      callbacks[count].capture = listener->capture;
+      count++;
+    }
+  }
+  if (count == 0) {
+    if (callbacks != local)
+      free(callbacks);
+    return 0;
+  }
+
+  JS_SetProperty(ctx, event_obj, events.current_target, wrap_node(ctx, node));
+  JS_SetProperty(ctx, event_obj, events.event_phase, JS_NewInt32(ctx, phase));
+  for (int i = 0; i < count; i++) {
+    // 调用 JS 回调函数
+    JSValue ret =
+        JS_Call(ctx, callbacks[i].callback, JS_UNDEFINED, 1, &event_obj);
+    if (JS_IsException(ret)) {
+      // 处理异常（例如打印错误）
+      js_std_dump_error(ctx);
+    }
+    JS_FreeValue(ctx, ret);
+    JS_FreeValue(ctx, callbacks[i].callback);
+  }
+  if (callbacks != local)
+    free(callbacks);
+
+  JSValue stopped = JS_GetProperty(ctx, event_obj, events.cancel_bubble);
+  int result = JS_ToBool(ctx, stopped);
+  JS_FreeValue(ctx, stopped);
+  return result;
+}
+
+// client 为鼠标事件的窗口坐标，其他事件传 NULL
+void dispatch_event(JSContext *ctx, TreeNode *target, JSAtom type, int bubbles,
+                    const SDL_Point *client) {
+  // 整棵树上都没有这种事件的监听器
+  if (!target || !listener_type_has_any(type))
+    return;
+
+  // 记录从目标到根的路径
+  int depth = 0;
+  for (TreeNode *n = target; n; n = n->parent)
+    depth++;
+  int local_path[64];
+  int *path = depth <= 64 ? local_path : malloc(sizeof(int) * (size_t)depth);
+  int k = 0;
+  for (TreeNode *n = target; n; n = n->parent)
+    path[k++] = n->id;
+
+  // 创建合成事件对象
+  JSValue event_obj = JS_NewObjectProto(ctx, events.proto);
+  JS_SetPropertyStr(ctx, event_obj, "type", JS_AtomToString(ctx, type));
+  JS_SetPropertyStr(ctx, event_obj, "target", wrap_node(ctx, target));
+  JS_SetPropertyStr(ctx, event_obj, "bubbles", JS_NewBool(ctx, bubbles));
+  JS_SetProperty(ctx, event_obj, events.cancel_bubble, JS_FALSE);
+  if (client) {
+    JS_SetPropertyStr(ctx, event_obj, "clientX", JS_NewInt32(ctx, client->x));
+    JS_SetPropertyStr(ctx, event_obj, "clientY", JS_NewInt32(ctx, client->y));
+  }
+
+  int stopped = 0;
+  for (int i = depth - 1; i > 0 && !stopped; i--) {
+    TreeNode *node = find_node_by_id(path[i]);
+    if (node)
+      stopped = invoke_listeners(ctx, node, type, EVENT_CAPTURING_PHASE,
+                                 event_obj);
+  }
+  if (!stopped) {
+    TreeNode *node = find_node_by_id(path[0]);
+    if (node)
+      stopped = invoke_listeners(ctx, node, type, EVENT_AT_TARGET, event_obj);
+  }
+  for (int i = 1; bubbles && i < depth && !stopped; i++) {
+    TreeNode *node = find_node_by_id(path[i]);
+    if (node)
+      stopped = invoke_listeners(ctx, node, type, EVENT_BUBBLING_PHASE,
+                                 event_obj);
+  }
+
+  JS_SetProperty(ctx, event_obj, events.current_target, JS_NULL);
+  // 释放事件对象
+  JS_FreeValue(ctx, event_obj);
+  if (path != local_path)
+    free(path);
+}
+
+// 解包 JS 对象为 TreeNode*
+TreeNode *unwrap_node(JSContext *ctx, JSValueConst val) {
+  if (!JS_IsObject(val)) {
+    JS_ThrowTypeError(ctx, "Expected TreeNode object");
+    return NULL;
+  }
+  return JS_GetOpaque(val, tree_node_class_id);
+}
+
+int append_child(TreeNode *parent, TreeNode *child) {
+  // 带测量函数的 Yoga 节点不能有子节点
+  if (!parent || !child || child->parent || parent->node_type == TEXT)
+    return 0;
+  parent->children =
+      realloc(parent->children, sizeof(TreeNode *) * (parent->childCount + 1));
+  parent->children[parent->childCount++] = child;
+  child->parent = parent;
+  YGNodeInsertChild(parent->yogaNode, child->yogaNode, parent->childCount - 1);
+  mark_node_dirty(child);
+  layout_mark_shadow(parent, SHADOW_CHILDREN);
+  return 1;
+}
+
+int insert_before(TreeNode *parent, TreeNode *newChild, TreeNode *refChild) {
+  if (!parent || !newChild || !refChild || parent != refChild->parent)
+    return 0;
+
+  int index = -1;
+  for (int i = 0; i < parent->childCount; i++) {
+    if (parent->children[i] == refChild) {
+      index = i;
+      break;
+    }
+  }
+  if (index == -1)
+    return 0;
+
+  parent->children =
+      realloc(parent->children, sizeof(TreeNode *) * (parent->childCount + 1));
+  memmove(&parent->children[index + 1], &parent->children[index],
+          sizeof(TreeNode *) * (parent->childCount - index));
+  parent->children[index] = newChild;
+  parent->childCount++;
+  newChild->parent = parent;
+  YGNodeInsertChild(parent->yogaNode, newChild->yogaNode, index);
+  mark_node_dirty(newChild);
+  layout_mark_shadow(parent, SHADOW_CHILDREN);
+  return 1;
+}
+
+int remove_child(JSContext *ctx, TreeNode *parent, TreeNode *child) {
+  if (!parent || !child || parent != child->parent)
+    return 0;
+
+  int index = -1;
+  for (int i = 0; i < parent->childCount; i++) {
+    if (parent->children[i] == child) {
+      index = i;
+      break;
+    }
+  }
+  if (index == -1)
+    return 0;
+
+  damage_subtree(child);
+  invalidate_layers(parent);
+  tree_dirty = 1;
+  layout_mark_shadow(parent, SHADOW_CHILDREN);
+  geometry_dirty = 1; // 缓冲中不能留下已释放的节点
+  YGNodeRemoveChild(parent->yogaNode, child->yogaNode);
+  memmove(&parent->children[index], &parent->children[index + 1],
+          sizeof(TreeNode *) * (parent->childCount - index - 1));
+  parent->childCount--;
+  parent->children =
+      realloc(parent->children, sizeof(TreeNode *) * parent->childCount);
+  free_tree(ctx, child);
+  return 1;
+}
+
+/*-------------------------------------
+ * 样式属性表
+ * 每个样式属性登记一次：类型、在 NodeStyle 中的偏移和可选的关键字表。
+ * 属性名用带种子的 FNV-1a 散列到 128 个槽，种子保证现有属性名互不冲突
+ * （完美散列），查找只需一次散列加一次 strcmp。
+ * 数字值直接写入，不经过字符串；字符串值按属性类型解析
+ *-----------------------------------*/
+typedef enum {
+  STYLE_FLOAT,  // 数字
+  STYLE_LENGTH, // 数字（点）、"50%"、"10px"，部分属性允许 "auto"
+  STYLE_ENUM,   // 关键字
+  STYLE_COLOR   // "#RRGGBB" / "#RGB" 或 0xRRGGBB
+} StyleKind;
+
+#define STYLE_ALLOW_AUTO 1
+
+typedef struct {
+  const char *name;
+  int value;
+} StyleKeyword;
+
+typedef struct {
+  const char *name;
+  StyleKind kind;
+  int flags;
+  size_t offset;
+  const StyleKeyword *keywords; // STYLE_ENUM 的取值表，以 NULL 结尾
+} StyleProperty;
+
+static const StyleKeyword flex_direction_keywords[] = {
+    {"row", YGFlexDirectionRow},
+    {"column", YGFlexDirectionColumn},
+    {"row-reverse", YGFlexDirectionRowReverse},
+    {"column-reverse", YGFlexDirectionColumnReverse},
+    {NULL, 0}};
+
+static const StyleKeyword justify_keywords[] = {
+    {"flex-start", YGJustifyFlexStart},
+    {"center", YGJustifyCenter},
+    {"flex-end", YGJustifyFlexEnd},
+    {"space-between", YGJustifySpaceBetween},
+    {"space-around", YGJustifySpaceAround},
+    {"space-evenly", YGJustifySpaceEvenly},
+    {NULL, 0}};
+
+static const StyleKeyword align_keywords[] = {
+    {"auto", YGAlignAuto},
+    {"flex-start", YGAlignFlexStart},
+    {"center", YGAlignCenter},
+    {"flex-end", YGAlignFlexEnd},
+    {"stretch", YGAlignStretch},
+    {"baseline", YGAlignBaseline},
+    {"space-between", YGAlignSpaceBetween},
+    {"space-around", YGAlignSpaceAround},
+    {NULL, 0}};
+
+static const StyleKeyword wrap_keywords[] = {{"nowrap", YGWrapNoWrap},
+                                             {"wrap", YGWrapWrap},
+                                             {"wrap-reverse", YGWrapWrapReverse},
+                                             {NULL, 0}};
+
+static const StyleKeyword position_keywords[] = {
+    {"relative", YGPositionTypeRelative},
+    {"absolute", YGPositionTypeAbsolute},
+    {NULL, 0}};
+
+static const StyleKeyword display_keywords[] = {
+    {"flex", YGDisplayFlex}, {"none", YGDisplayNone}, {NULL, 0}};
+
+static const StyleKeyword overflow_keywords[] = {
+    {"visible", YGOverflowVisible},
+    {"hidden", YGOverflowHidden},
+    {"scroll", YGOverflowScroll},
+    {NULL, 0}};
+
+#define STYLE_FIELD(field) offsetof(NodeStyle, field)
+
+static const StyleProperty style_properties[] = {
+    {"flex", STYLE_FLOAT, 0, STYLE_FIELD(flex), NULL},
+    {"flexGrow", STYLE_FLOAT, 0, STYLE_FIELD(flexGrow), NULL},
+    {"flexShrink", STYLE_FLOAT, 0, STYLE_FIELD(flexShrink), NULL},
+    {"flexBasis", STYLE_LENGTH, STYLE_ALLOW_AUTO, STYLE_FIELD(flexBasis), NULL},
+    {"flexDirection", STYLE_ENUM, 0, STYLE_FIELD(flexDirection),
+     flex_direction_keywords},
+    {"flexWrap", STYLE_ENUM, 0, STYLE_FIELD(flexWrap), wrap_keywords},
+    {"justifyContent", STYLE_ENUM, 0, STYLE_FIELD(justifyContent),
+     justify_keywords},
+    {"alignItems", STYLE_ENUM, 0, STYLE_FIELD(alignItems), align_keywords},
+    {"alignSelf", STYLE_ENUM, 0, STYLE_FIELD(alignSelf), align_keywords},
+    {"alignContent", STYLE_ENUM, 0, STYLE_FIELD(alignContent), align_keywords},
+    {"position", STYLE_ENUM, 0, STYLE_FIELD(positionType), position_keywords},
+    {"display", STYLE_ENUM, 0, STYLE_FIELD(display), display_keywords},
+    {"overflow", STYLE_ENUM, 0, STYLE_FIELD(overflow), overflow_keywords},
+    {"aspectRatio", STYLE_FLOAT, 0, STYLE_FIELD(aspectRatio), NULL},
+    {"width", STYLE_LENGTH, STYLE_ALLOW_AUTO, STYLE_FIELD(width), NULL},
+    {"height", STYLE_LENGTH, STYLE_ALLOW_AUTO, STYLE_FIELD(height), NULL},
+    {"minWidth", STYLE_LENGTH, 0, STYLE_FIELD(minWidth), NULL},
+    {"minHeight", STYLE_LENGTH, 0, STYLE_FIELD(minHeight), NULL},
+    {"maxWidth", STYLE_LENGTH, 0, STYLE_FIELD(maxWidth), NULL},
+    {"maxHeight", STYLE_LENGTH, 0, STYLE_FIELD(maxHeight), NULL},
+    {"left", STYLE_LENGTH, 0, STYLE_FIELD(position[YGEdgeLeft]), NULL},
+    {"top", STYLE_LENGTH, 0, STYLE_FIELD(position[YGEdgeTop]), NULL},
+    {"right", STYLE_LENGTH, 0, STYLE_FIELD(position[YGEdgeRight]), NULL},
+    {"bottom", STYLE_LENGTH, 0, STYLE_FIELD(position[YGEdgeBottom]), NULL},
+    {"margin", STYLE_LENGTH, STYLE_ALLOW_AUTO, STYLE_FIELD(margin[YGEdgeAll]),
+     NULL},
+    {"marginLeft", STYLE_LENGTH, STYLE_ALLOW_AUTO,
+     STYLE_FIELD(margin[YGEdgeLeft]), NULL},
+    {"marginTop", STYLE_LENGTH, STYLE_ALLOW_AUTO,
+     STYLE_FIELD(margin[YGEdgeTop]), NULL},
+    {"marginRight", STYLE_LENGTH, STYLE_ALLOW_AUTO,
+     STYLE_FIELD(margin[YGEdgeRight]), NULL},
+    {"marginBottom", STYLE_LENGTH, STYLE_ALLOW_AUTO,
+     STYLE_FIELD(margin[YGEdgeBottom]), NULL},
+    {"marginHorizontal", STYLE_LENGTH, STYLE_ALLOW_AUTO,
+     STYLE_FIELD(margin[YGEdgeHorizontal]), NULL},
+    {"marginVertical", STYLE_LENGTH, STYLE_ALLOW_AUTO,
+     STYLE_FIELD(margin[YGEdgeVertical]), NULL},
+    {"padding", STYLE_LENGTH, 0, STYLE_FIELD(padding[YGEdgeAll]), NULL},
+    {"paddingLeft", STYLE_LENGTH, 0, STYLE_FIELD(padding[YGEdgeLeft]), NULL},
+    {"paddingTop", STYLE_LENGTH, 0, STYLE_FIELD(padding[YGEdgeTop]), NULL},
+    {"paddingRight", STYLE_LENGTH, 0, STYLE_FIELD(padding[YGEdgeRight]), NULL},
+    {"paddingBottom", STYLE_LENGTH, 0, STYLE_FIELD(padding[YGEdgeBottom]),
+     NULL},
+    {"paddingHorizontal", STYLE_LENGTH, 0,
+     STYLE_FIELD(padding[YGEdgeHorizontal]), NULL},
+    {"paddingVertical", STYLE_LENGTH, 0, STYLE_FIELD(padding[YGEdgeVertical]),
+     NULL},
+    {"backgroundColor", STYLE_COLOR, 0, STYLE_FIELD(backgroundColor), NULL},
+    {"borderColor", STYLE_COLOR, 0, STYLE_FIELD(borderColor), NULL},
+};
+
+#define STYLE_PROPERTY_COUNT                                                   \
+  ((int)(sizeof(style_properties) / sizeof(style_properties[0])))
+// 增删属性后若出现冲突，换一个能让所有属性名落在不同槽的种子
+#define STYLE_HASH_SEED 0x20au
+#define STYLE_HASH_BITS 7
+
+static const StyleProperty *style_slots[1 << STYLE_HASH_BITS];
+
+static unsigned int style_name_hash(const char *name) {
+  unsigned int hash = STYLE_HASH_SEED;
+  for (; *name; name++) {
+    hash ^= (unsigned char)*name;
+    hash *= 16777619u;
+  }
+  return hash >> (32 - STYLE_HASH_BITS);
+}
+
+void style_registry_init(void) {
+  for (int i = 0; i < STYLE_PROPERTY_COUNT; i++) {
+    const StyleProperty *prop = &style_properties[i];
+    unsigned int slot = style_name_hash(prop->name);
+    if (style_slots[slot]) {
+      fprintf(stderr, "style registry: '%s' collides with '%s'\n", prop->name,
+              style_slots[slot]->name);
+      abort();
+    }
+    style_slots[slot] = prop;
+  }
+}
+
+const StyleProperty *style_property_lookup(const char *name) {
+  const StyleProperty *prop = style_slots[style_name_hash(name)];
+  return prop && strcmp(prop->name, name) == 0 ? prop : NULL;
+}
+
+// 数字值的快速路径：JS number 直接写入，颜色按 0xRRGGBB 解释
+int style_set_number(NodeStyle *style, const StyleProperty *prop,
+                     double number) {
+  void *field = (char *)style + prop->offset;
+  switch (prop->kind) {
+  case STYLE_FLOAT:
+    *(float *)field = (float)number;
+    return 1;
+  case STYLE_LENGTH:
+    *(StyleLength *)field = (StyleLength){(float)number, YGUnitPoint};
+    return 1;
+  case STYLE_COLOR: {
+    // 超出范围（含 NaN）的 double 转无符号整数是未定义行为，先检查
+    if (!(number >= 0 && number <= 0xFFFFFF))
+      return 0;
+    unsigned int rgb = (unsigned int)number;
+    *(Color *)field = (Color){(rgb >> 16) & 0xFF, (rgb >> 8) & 0xFF,
+                              rgb & 0xFF, 255};
+    return 1;
+  }
+  case STYLE_ENUM:
+    break;
+  }
+  return 0;
+}
+
+int style_set_string(NodeStyle *style, const StyleProperty *prop,
+                     const char *value) {
+  void *field = (char *)style + prop->offset;
+  switch (prop->kind) {
+  case STYLE_FLOAT:
+    *(float *)field = atof(value);
+    return 1;
+  case STYLE_LENGTH: {
+    if (strcmp(value, "auto") == 0) {
+      if (!(prop->flags & STYLE_ALLOW_AUTO))
+        return 0;
+      *(StyleLength *)field = (StyleLength){0, YGUnitAuto};
+      return 1;
+    }
+    char *end;
+    float number = strtof(value, &end);
+    if (end == value)
+      return 0;
+    YGUnit unit = YGUnitPoint;
+    if (strcmp(end, "%") == 0) {
+      unit = YGUnitPercent;
+    } else if (*end != '\0' && strcmp(end, "px") != 0) {
+      return 0;
+    }
+    *(StyleLength *)field = (StyleLength){number, unit};
+    return 1;
+  }
+  case STYLE_ENUM:
+    for (const StyleKeyword *k = prop->keywords; k->name; k++) {
+      if (strcmp(k->name, value) == 0) {
+        *(int *)field = k->value;
+        return 1;
+      }
+    }
+    return 0;
+  case STYLE_COLOR:
+    return parse_hex_color(value, (Color *)field);
+  }
+  return 0;
+}
+
+static size_t style_property_size(const StyleProperty *prop) {
+  switch (prop->kind) {
+  case STYLE_FLOAT:
+    return sizeof(float);
+  case STYLE_LENGTH:
+    return sizeof(StyleLength);
+  case STYLE_ENUM:
+    return sizeof(int);
+  case STYLE_COLOR:
+    return sizeof(Color);
+  }
+  return 0;
+}
+
+// 移除属性：恢复为 base 中的取值（节点的初始样式，或样式类的默认样式）
+void style_reset_property(NodeStyle *style, const StyleProperty *prop,
+                          const NodeStyle *base) {
+  memcpy((char *)style + prop->offset, (const char *)base + prop->offset,
+         style_property_size(prop));
+}
+
+/*-------------------------------------
+ * 新增：样式属性设置函数
+ * 参数说明：
+ * - node: 目标节点
+ * - attr: 属性名（字符串）
+ * - value: 属性值（字符串形式）
+ * 返回值：1成功 0失败
+ *-----------------------------------*/
+// 把一条样式属性写入样式值，defineStyle 和 setAttribute 共用
+int style_parse_property(NodeStyle *style, const char *attr,
+                         const char *value) {
+  const StyleProperty *prop = style_property_lookup(attr);
+  return prop ? style_set_string(style, prop, value) : 0;
+}
+
+int set_attribute(TreeNode *node, const char *attr, const char *value) {
+  if (!node || !attr || !value)
+    return 0;
+
+  if (strcmp(attr, "class") == 0) {
+    // 整套预先算好的样式（含 Yoga 设置）一步换上
+    const NodeStyle *style = style_class_lookup(value);
+    if (!style)
+      return 0;
+    node_set_style(node, style);
+    return 1;
+  } else if (strcmp(attr, "layer") == 0) {
+    if (strcmp(value, "cache") == 0) {
+      layer_create(node);
+    } else if (strcmp(value, "none") == 0) {
+      layer_destroy(node);
+    } else {
+      return 0;
+    }
+    mark_node_dirty(node);
+    return 1;
+  }
+
+  // 写时复制：在副本上修改，再换成表中相同的样式
+  NodeStyle style = *node->style;
+  if (!style_parse_property(&style, attr, value))
+    return 0;
+  node_set_style(node, &style);
+  return 1;
+}
+
+// setAttribute 的数字快速路径
+int set_style_number(TreeNode *node, const StyleProperty *prop,
+                     double number) {
+  NodeStyle style = *node->style;
+  if (!style_set_number(&style, prop, number))
+    return 0;
+  node_set_style(node, &style);
+  return 1;
+}
+
+// 每帧调用：发布已完成的布局，线程空闲且有变化时提交新的计算
+void update_yoga_layout(int force) {
+  if (force)
+    layout_dirty = 1;
+  layout_worker_poll(0);
+  if (!layout_dirty || layout_worker.busy)
+    return;
+  fprintf(stdout, "systemp ========>:  Update Layout\n");
+  layout_dirty = 0;
+  layout_worker_submit(root_data, VIEW_WIDTH, VIEW_HEIGHT);
+  // 首次布局完成前没有任何可显示的内容，同步等待
+  if (layout_worker.published == 0)
+    layout_worker_poll(1);
+}
+
+/*-------------------------------------
+ * 滚动容器
+ *-----------------------------------*/
+#define SCROLL_STEP 40
+
+int node_clips_children(const TreeNode *node) {
+  return node->style->overflow != YGOverflowVisible;
+}
+
+// 子节点布局矩形的外包尺寸，即可滚动内容的大小
+static void scroll_content_size(TreeNode *node, int *content_w,
+                                int *content_h) {
+  float max_w = 0, max_h = 0;
+  for (int i = 0; i < node->childCount; i++) {
+    const LayoutBox *child = &node->children[i]->layout;
+    float right = child->left + child->width;
+    float bottom = child->top + child->height;
+    if (right > max_w)
+      max_w = right;
+    if (bottom > max_h)
+      max_h = bottom;
+  }
+  *content_w = (int)max_w;
+  *content_h = (int)max_h;
+}
+
+// 把滚动偏移限制在 [0, 内容尺寸 - 可视尺寸]，返回偏移是否变化
+int clamp_scroll(TreeNode *node) {
+  int old_x = node->scroll_x, old_y = node->scroll_y;
+  if (node->style->overflow != YGOverflowScroll) {
+    node->scroll_x = node->scroll_y = 0;
+  } else {
+    int content_w, content_h;
+    scroll_content_size(node, &content_w, &content_h);
+    int max_x = content_w - (int)node->layout.width;
+    int max_y = content_h - (int)node->layout.height;
+    if (node->scroll_x > max_x)
+      node->scroll_x = max_x;
+    if (node->scroll_y > max_y)
+      node->scroll_y = max_y;
+    if (node->scroll_x < 0)
+      node->scroll_x = 0;
+    if (node->scroll_y < 0)
+      node->scroll_y = 0;
+  }
+  return node->scroll_x != old_x || node->scroll_y != old_y;
+}
+
+static int geometry_scroll(TreeNode *node, int dx, int dy);
+
+// 返回是否真的滚动了。几何缓冲有效时直接平移容器内容并重绘容器可见区域，
+// 否则留到下一次重建几何缓冲和 collect_damage 时计算
+int scroll_node_by(TreeNode *node, int dx, int dy) {
+  int old_x = node->scroll_x, old_y = node->scroll_y;
+  node->scroll_x += dx;
+  node->scroll_y += dy;
+  if (!clamp_scroll(node))
+    return 0;
+  if (!geometry_scroll(node, old_x - node->scroll_x, old_y - node->scroll_y)) {
+    tree_dirty = 1;
+    geometry_dirty = 1;
+  }
+  return 1;
+}
+
+// 从命中的节点向上找第一个能在该方向滚动的容器
+TreeNode *find_scroll_container(TreeNode *node, int dx, int dy) {
+  for (; node; node = node->parent) {
+    if (node->style->overflow != YGOverflowScroll)
+      continue;
+    int old_x = node->scroll_x, old_y = node->scroll_y;
+    node->scroll_x += dx;
+    node->scroll_y += dy;
+    int can_scroll = clamp_scroll(node);
+    node->scroll_x = old_x;
+    node->scroll_y = old_y;
+    if (can_scroll)
+      return node;
+  }
+  return NULL;
+}
+
+/*-------------------------------------
+ * 批量绘制
+ * 遍历树时把背景填充和边框收集成批次，按绘制顺序整批交给后端
+ * （SDL 后端为一次 SDL_RenderGeometry）。
+ * 混合模式变化或遇到文字纹理时先提交当前批次，保证前后遮挡关系不变。
+ *-----------------------------------*/
+#define DRAW_BATCH_MAX_QUADS 16384
+
+typedef struct {
+  SDL_Rect *rects;
+  Color *colors;
+  int quad_count;
+  int quad_capacity;
+  SDL_BlendMode blend;
+} DrawBatch;
+
+static DrawBatch draw_batch = {0};
+
+void draw_batch_flush(RenderBackend *backend) {
+  DrawBatch *batch = &draw_batch;
+  if (batch->quad_count == 0)
+    return;
+  backend->fill_rects(backend, batch->rects, batch->colors, batch->quad_count,
+                      batch->blend);
+  batch->quad_count = 0;
+}
+
+void draw_batch_fill_rect(RenderBackend *backend, const SDL_Rect *rect,
+                          Color color, SDL_BlendMode blend) {
+  DrawBatch *batch = &draw_batch;
+  if (rect->w <= 0 || rect->h <= 0)
+    return;
+  if (batch->quad_count > 0 &&
+      (batch->blend != blend || batch->quad_count >= DRAW_BATCH_MAX_QUADS)) {
+    draw_batch_flush(backend);
+  }
+  batch->blend = blend;
+  if (batch->quad_count == batch->quad_capacity) {
+    batch->quad_capacity = batch->quad_capacity ? batch->quad_capacity * 2 : 256;
+    batch->rects =
+        realloc(batch->rects, sizeof(SDL_Rect) * (size_t)batch->quad_capacity);
+    batch->colors =
+        realloc(batch->colors, sizeof(Color) * (size_t)batch->quad_capacity);
+  }
+  batch->rects[batch->quad_count] = *rect;
+  batch->colors[batch->quad_count] = color;
+  batch->quad_count++;
+}
+
+// 与 SDL_RenderDrawRect 一致的 1 像素边框，拆成四条细矩形
+void draw_batch_outline_rect(RenderBackend *backend, const SDL_Rect *rect,
+                             Color color, SDL_BlendMode blend) {
+  int x = rect->x, y = rect->y, w = rect->w, h = rect->h;
+  if (w <= 0 || h <= 0)
+    return;
+  SDL_Rect top = {x, y, w, 1};
+  SDL_Rect bottom = {x, y + h - 1, w, 1};
+  SDL_Rect left = {x, y + 1, 1, h - 2};
+  SDL_Rect right = {x + w - 1, y + 1, 1, h - 2};
+  draw_batch_fill_rect(backend, &top, color, blend);
+  if (h > 1)
+    draw_batch_fill_rect(backend, &bottom, color, blend);
+  draw_batch_fill_rect(backend, &left, color, blend);
+  if (w > 1)
+    draw_batch_fill_rect(backend, &right, color, blend);
+}
+
+void draw_batch_free(void) {
+  free(draw_batch.rects);
+  free(draw_batch.colors);
+  memset(&draw_batch, 0, sizeof(draw_batch));
+}
+
+void render_text(TTF_Font *font, RenderBackend *backend, TreeNode *node, int x,
+                 int y, int w, int h) {
+
+  // 设置文字颜色
+  Color color = {0, 0, 0, 255}; // 黑色文字
+  // 宽度不变时直接复用上次的排版，字形位图从图集中取
+  TextLayout *layout = text_layout_update(font, node, w);
+  // 绘制文字
+  text_layout_draw(backend, layout, x, y, color);
+}
+
+/*-------------------------------------
+ * 几何缓冲
+ * 布局发布、滚动或结构变化后，把整棵树按绘制顺序（先序）展开成按列存放的数组：
+ * 绝对坐标、尺寸、父节点下标、子树结束位置和节点指针各占一列，下标即绘制顺序。
+ * 重绘区域收集、渲染、命中测试和 JS 布局查询都按下标线性扫描，
+ * 不再逐层递归累加父节点偏移。
+ *-----------------------------------*/
+typedef struct {
+  int count;
+  int capacity;
+  int *x, *y, *w, *h; // 绝对布局矩形，已计入祖先的滚动偏移
+  int *parent;        // 父节点下标，根节点为 -1
+  int *end;           // [i, end[i]) 为 i 的整棵子树
+  SDL_Rect *subtree;  // 整棵子树绘制覆盖的矩形，用于剔除不可见子树
+  TreeNode **node;
+  unsigned int generation; // 每次重建加一，派生数据据此判断是否过期
+} GeometryBuffer;
+
+static GeometryBuffer geometry = {0};
+
+static void geometry_reserve(int count) {
+  if (count <= geometry.capacity)
+    return;
+  int capacity = geometry.capacity ? geometry.capacity * 2 : 256;
+  while (capacity < count)
+    capacity *= 2;
+  size_t n = (size_t)capacity;
+  geometry.x = realloc(geometry.x, sizeof(int) * n);
+  geometry.y = realloc(geometry.y, sizeof(int) * n);
+  geometry.w = realloc(geometry.w, sizeof(int) * n);
+  geometry.h = realloc(geometry.h, sizeof(int) * n);
+  geometry.parent = realloc(geometry.parent, sizeof(int) * n);
+  geometry.end = realloc(geometry.end, sizeof(int) * n);
+  geometry.subtree = realloc(geometry.subtree, sizeof(SDL_Rect) * n);
+  geometry.node = realloc(geometry.node, sizeof(TreeNode *) * n);
+  geometry.capacity = capacity;
+}
+
+static void geometry_append(TreeNode *node, int parent, int parentX,
+                            int parentY) {
+  // 还没有布局结果的新节点连同子树不进入缓冲
+  if (!node->has_layout) {
+    node->geometry_index = -1;
+    return;
+  }
+  geometry_reserve(geometry.count + 1);
+  int i = geometry.count++;
+  int x = parentX + (int)node->layout.left;
+  int y = parentY + (int)node->layout.top;
+  geometry.x[i] = x;
+  geometry.y[i] = y;
+  geometry.w[i] = (int)node->layout.width;
+  geometry.h[i] = (int)node->layout.height;
+  geometry.parent[i] = parent;
+  geometry.subtree[i] = node->paint_box;
+  geometry.node[i] = node;
+  node->geometry_index = i;
+
+  if (node->childCount > 0) {
+    // 内容或尺寸变化后滚动偏移可能越界
+    clamp_scroll(node);
+    int childX = x - node->scroll_x;
+    int childY = y - node->scroll_y;
+    for (int c = 0; c < node->childCount; c++) {
+      geometry_append(node->children[c], i, childX, childY);
+    }
+  }
+  geometry.end[i] = geometry.count;
+}
+
+// 使用缓冲前调用，只在布局、滚动或结构变化后重建
+void geometry_update(void) {
+  if (!geometry_dirty)
+    return;
+  geometry.count = 0;
+  if (root_data)
+    geometry_append(root_data, -1, 0, 0);
+  geometry_dirty = 0;
+  geometry.generation++;
+}
+
+// 纯滚动：容器的子孙在缓冲中整体平移 (dx, dy)，上次的布局和绘制矩形同步平移，
+// collect_damage 不会再把它们当作移动过的节点逐个比较。
+// 只需重绘容器在祖先裁剪内的可见部分，缓冲过期时返回 0
+static int geometry_scroll(TreeNode *node, int dx, int dy) {
+  int index = node->geometry_index;
+  if (geometry_dirty || index < 0 || index >= geometry.count ||
+      geometry.node[index] != node)
+    return 0;
+
+  for (int i = index + 1; i < geometry.end[index]; i++) {
+    TreeNode *child = geometry.node[i];
+    geometry.x[i] += dx;
+    geometry.y[i] += dy;
+    geometry.subtree[i].x += dx;
+    geometry.subtree[i].y += dy;
+    child->layout_box.x += dx;
+    child->layout_box.y += dy;
+    child->paint_box.x += dx;
+    child->paint_box.y += dy;
+  }
+
+  SDL_Rect visible = {geometry.x[index], geometry.y[index], geometry.w[index],
+                      geometry.h[index]};
+  for (int p = geometry.parent[index]; p >= 0; p = geometry.parent[p]) {
+    if (!node_clips_children(geometry.node[p]))
+      continue;
+    SDL_Rect clip = {geometry.x[p], geometry.y[p], geometry.w[p],
+                     geometry.h[p]};
+    if (!SDL_IntersectRect(&visible, &clip, &visible))
+      visible = (SDL_Rect){0, 0, 0, 0};
+  }
+  damage_add(&visible);
+  // 容器所在的图层内容变了；容器内部的图层以自身为原点，不受平移影响
+  invalidate_layers(node);
+  // 命中测试索引和悬停状态按版本号重新计算
+  geometry.generation++;
+  return 1;
+}
+
+void geometry_free(void) {
+  free(geometry.x);
+  free(geometry.y);
+  free(geometry.w);
+  free(geometry.h);
+  free(geometry.parent);
+  free(geometry.end);
+  free(geometry.subtree);
+  free(geometry.node);
+  memset(&geometry, 0, sizeof(geometry));
+}
+
+/*-------------------------------------
+ * 空间索引
+ * 命中测试的频率跟随鼠标移动，不能每次都扫描整个几何缓冲。
+ * 几何缓冲重建后，在根节点矩形上铺一张 64 像素的均匀网格，
+ * 每个格子按下标升序记录与之相交的节点（紧凑存储：offsets + indices）。
+ * 查询时只检查点所在格子里的候选节点。
+ *-----------------------------------*/
+#define SPATIAL_CELL_SHIFT 6 // 格子边长 64 像素
+
+typedef struct {
+  int x, y;       // 网格原点，即根节点的左上角
+  int cols, rows;
+  int *offsets;   // 第 c 个格子的候选为 indices[offsets[c], offsets[c + 1])
+  int *indices;
+  int cell_capacity;
+  int index_capacity;
+  unsigned int generation; // 建立索引时几何缓冲的版本
+} SpatialIndex;
+
+static SpatialIndex spatial = {0};
+
+// 节点矩形（闭区间，与命中测试一致）覆盖的格子范围，完全在网格外时返回 0
+static int spatial_cell_range(int i, int *c0, int *r0, int *c1, int *r1) {
+  int left = geometry.x[i] - spatial.x;
+  int top = geometry.y[i] - spatial.y;
+  int right = left + geometry.w[i];
+  int bottom = top + geometry.h[i];
+  if (right < 0 || bottom < 0 || geometry.w[i] < 0 || geometry.h[i] < 0)
+    return 0;
+  *c0 = left > 0 ? left >> SPATIAL_CELL_SHIFT : 0;
+  *r0 = top > 0 ? top >> SPATIAL_CELL_SHIFT : 0;
+  *c1 = right >> SPATIAL_CELL_SHIFT;
+  *r1 = bottom >> SPATIAL_CELL_SHIFT;
+  if (*c0 >= spatial.cols || *r0 >= spatial.rows)
+    return 0;
+  if (*c1 >= spatial.cols)
+    *c1 = spatial.cols - 1;
+  if (*r1 >= spatial.rows)
+    *r1 = spatial.rows - 1;
+  return 1;
+}
+
+static void spatial_rebuild(void) {
+  spatial.generation = geometry.generation;
+  spatial.cols = spatial.rows = 0;
+  if (geometry.count == 0)
+    return;
+
+  // 点必须落在根节点之内才可能命中，网格只需覆盖根节点
+  spatial.x = geometry.x[0];
+  spatial.y = geometry.y[0];
+  int w = geometry.w[0] > 0 ? geometry.w[0] : 0;
+  int h = geometry.h[0] > 0 ? geometry.h[0] : 0;
+  spatial.cols = (w >> SPATIAL_CELL_SHIFT) + 1;
+  spatial.rows = (h >> SPATIAL_CELL_SHIFT) + 1;
+  int cells = spatial.cols * spatial.rows;
+  if (cells + 1 > spatial.cell_capacity) {
+    spatial.cell_capacity = cells + 1;
+    spatial.offsets =
+        realloc(spatial.offsets, sizeof(int) * (size_t)spatial.cell_capacity);
+  }
+  memset(spatial.offsets, 0, sizeof(int) * (size_t)(cells + 1));
+
+  // 第一遍统计每个格子的候选数，第二遍按下标升序填入
+  int c0, r0, c1, r1;
+  for (int i = 0; i < geometry.count;) {
+    // 文字节点不参与命中，且没有子节点
+    if (geometry.node[i]->node_type == TEXT) {
+      i = geometry.end[i];
+      continue;
+    }
+    if (!spatial_cell_range(i, &c0, &r0, &c1, &r1)) {
+      // 完全在根节点外的节点及其子树都不可能命中
+      i = geometry.end[i];
+      continue;
+    }
+    for (int r = r0; r <= r1; r++)
+      for (int c = c0; c <= c1; c++)
+        spatial.offsets[r * spatial.cols + c + 1]++;
+    i++;
+  }
+  for (int c = 0; c < cells; c++)
+    spatial.offsets[c + 1] += spatial.offsets[c];
+
+  int total = spatial.offsets[cells];
+  if (total > spatial.index_capacity) {
+    spatial.index_capacity = total;
+    spatial.indices =
+        realloc(spatial.indices, sizeof(int) * (size_t)spatial.index_capacity);
+  }
+  // 借用 offsets 作为写入游标，填完后恰好右移一格，再整体复原
+  for (int i = 0; i < geometry.count;) {
+    if (geometry.node[i]->node_type == TEXT ||
+        !spatial_cell_range(i, &c0, &r0, &c1, &r1)) {
+      i = geometry.end[i];
+      continue;
+    }
+    for (int r = r0; r <= r1; r++)
+      for (int c = c0; c <= c1; c++)
+        spatial.indices[spatial.offsets[r * spatial.cols + c]++] = i;
+    i++;
+  }
+  for (int c = cells; c > 0; c--)
+    spatial.offsets[c] = spatial.offsets[c - 1];
+  spatial.offsets[0] = 0;
+}
+
+void spatial_free(void) {
+  free(spatial.offsets);
+  free(spatial.indices);
+  memset(&spatial, 0, sizeof(spatial));
+}
+
+// 命中测试：点必须落在每一级祖先之内；同级节点中先出现的优先，
+// 命中后只在其子树中继续查找。
+// 格子中的候选按先序升序排列，逐个检查：只有父节点恰好是当前命中节点
+// （根节点则要求尚无命中）且包含该点的候选才能成为新的命中节点，
+// 结果与完整扫描几何缓冲相同
+TreeNode *find_node_at_position(int x, int y) {
+  geometry_update();
+  if (spatial.generation != geometry.generation)
+    spatial_rebuild();
+  int cx = x - spatial.x, cy = y - spatial.y;
+  if (cx < 0 || cy < 0)
+    return NULL;
+  cx >>= SPATIAL_CELL_SHIFT;
+  cy >>= SPATIAL_CELL_SHIFT;
+  if (cx >= spatial.cols || cy >= spatial.rows)
+    return NULL;
+
+  int cell = cy * spatial.cols + cx;
+  int hit = -1;
+  for (int k = spatial.offsets[cell]; k < spatial.offsets[cell + 1]; k++) {
+    int i = spatial.indices[k];
+    if (geometry.parent[i] != hit)
+      continue;
+    int left = geometry.x[i], top = geometry.y[i];
+    if (x < left || x > left + geometry.w[i] || y < top ||
+        y > top + geometry.h[i])
+      continue;
+    hit = i;
+  }
+  return hit >= 0 ? geometry.node[hit] : NULL;
+}
+
+/*-------------------------------------
+ * 悬停
+ * 鼠标移动时命中最深节点，向它派发 mousemove；命中节点变化时，
+ * 对离开的祖先链自内向外派发 mouseleave，对进入的祖先链自外向内派发
+ * mouseenter（两者都只发给节点自身，与 DOM 一致）。
+ * 布局或滚动使鼠标下的节点变化时，也按最后的鼠标位置重新判定。
+ *-----------------------------------*/
+typedef struct {
+  int active; // 鼠标在窗口内
+  int x, y;   // 最后一次的鼠标位置
+  unsigned int generation; // 上次命中时几何缓冲的版本
+  int *ids;   // 派发期间的节点 id，回调可能删除节点，派发前按 id 重新查找
+  int id_capacity;
+} HoverState;
+
+static HoverState hover = {0};
+
+static void hover_reserve(int count) {
+  if (count <= hover.id_capacity)
+    return;
+  hover.id_capacity = count * 2;
+  hover.ids = realloc(hover.ids, sizeof(int) * (size_t)hover.id_capacity);
+}
+
+static int node_depth(TreeNode *node) {
+  int depth = 0;
+  for (; node; node = node->parent)
+    depth++;
+  return depth;
+}
+
+// 把悬停节点切换到 hit，派发 mouseleave / mouseenter
+static void hover_set(JSContext *ctx, TreeNode *hit) {
+  TreeNode *old = hoveredNode;
+  if (old == hit)
+    return;
+
+  // 找到新旧节点的最近公共祖先
+  int old_depth = node_depth(old), new_depth = node_depth(hit);
+  TreeNode *a = old, *b = hit;
+  int da = old_depth, db = new_depth;
+  for (; da > db; da--)
+    a = a->parent;
+  for (; db > da; db--)
+    b = b->parent;
+  while (a != b) {
+    a = a->parent;
+    b = b->parent;
+  }
+  TreeNode *common = a;
+
+  // 先记下两条链上的 id，再更新悬停节点，最后派发
+  hover_reserve(old_depth + new_depth);
+  int leave_count = 0, enter_count = 0;
+  for (TreeNode *n = old; n != common; n = n->parent)
+    hover.ids[leave_count++] = n->id;
+  for (TreeNode *n = hit; n != common; n = n->parent)
+    hover.ids[leave_count + enter_count++] = n->id;
+  hoveredNode = hit;
+
+  SDL_Point client = {hover.x, hover.y};
+  for (int k = 0; k < leave_count; k++) {
+    TreeNode *n = find_node_by_id(hover.ids[k]);
+    dispatch_event(ctx, n, events.mouseleave, 0, &client);
+  }
+  for (int k = leave_count + enter_count - 1; k >= leave_count; k--) {
+    TreeNode *n = find_node_by_id(hover.ids[k]);
+    dispatch_event(ctx, n, events.mouseenter, 0, &client);
+  }
+}
+
+// SDL_MOUSEMOTION
+void hover_mouse_move(JSContext *ctx, int x, int y) {
+  hover.active = 1;
+  hover.x = x;
+  hover.y = y;
+  TreeNode *hit = find_node_at_position(x, y);
+  hover.generation = geometry.generation;
+  hover_set(ctx, hit);
+  // 回调中可能删除了命中节点，hoveredNode 会随之清空
+  SDL_Point client = {x, y};
+  dispatch_event(ctx, hoveredNode, events.mousemove, 1, &client);
+}
+
+// 鼠标离开窗口
+void hover_mouse_leave(JSContext *ctx) {
+  hover.active = 0;
+  hover_set(ctx, NULL);
+}
+
+// 每帧布局之后调用：几何变化时鼠标虽未移动，下方的节点也可能已经不同
+void hover_refresh(JSContext *ctx) {
+  if (!hover.active)
+    return;
+  geometry_update();
+  if (hover.generation == geometry.generation)
+    return;
+  TreeNode *hit = find_node_at_position(hover.x, hover.y);
+  hover.generation = geometry.generation;
+  hover_set(ctx, hit);
+}
+
+void hover_free(void) {
+  free(hover.ids);
+  memset(&hover, 0, sizeof(hover));
+}
+
+/*-------------------------------------
+ * 渲染系统
+ *-----------------------------------*/
+// 当前渲染目标坐标系下的可见裁剪矩形，完全落在其外的子树直接跳过
+static SDL_Rect render_clip = {0, 0, 0, 0};
+
+static SDL_Rect offset_rect(const SDL_Rect *rect, int dx, int dy) {
+  SDL_Rect moved = {rect->x + dx, rect->y + dy, rect->w, rect->h};
+  return moved;
+}
+
+// collect_damage 中节点传给子节点的上下文
+typedef struct {
+  int in_layer;
+  int layer_dx, layer_dy; // 所在图层原点的位移，整体平移不会使图层失效
+  int has_clip;
+  SDL_Rect clip; // 祖先裁剪容器的交集，之外的区域不会显示
+} DamageContext;
+
+static DamageContext *damage_contexts = NULL;
+static int damage_context_capacity = 0;
+
+static void damage_add_clipped(const SDL_Rect *rect, const DamageContext *dc) {
+  if (!dc->has_clip) {
+    damage_add(rect);
+    return;
+  }
+  SDL_Rect visible;
+  if (SDL_IntersectRect(rect, &dc->clip, &visible))
+    damage_add(&visible);
+}
+
+// 布局完成后顺序扫描一次几何缓冲，收集脏节点和位置变化节点的新旧矩形；
+// 再倒序扫描，子节点先于父节点完成，自底向上合并每棵子树的绘制范围
+void collect_damage(TTF_Font *font) {
+  if (geometry.count > damage_context_capacity) {
+    damage_context_capacity = geometry.capacity;
+    damage_contexts = realloc(damage_contexts, sizeof(DamageContext) *
+                                                   (size_t)damage_context_capacity);
+  }
+
+  for (int i = 0; i < geometry.count; i++) {
+    TreeNode *dataNode = geometry.node[i];
+    int parent = geometry.parent[i];
+    DamageContext dc = {0};
+    if (parent >= 0)
+      dc = damage_contexts[parent];
+
+    SDL_Rect box = {geometry.x[i], geometry.y[i], geometry.w[i],
+                    geometry.h[i]};
+    SDL_Rect old = dataNode->layout_box;
+    int moved = memcmp(&box, &old, sizeof(SDL_Rect)) != 0;
+
+    if (dataNode->layer) {
+      dc.in_layer = 1;
+      dc.layer_dx = box.x - old.x;
+      dc.layer_dy = box.y - old.y;
+    }
+
+    if (dataNode->dirty || moved) {
+      if (dc.in_layer &&
+          (dataNode->dirty || box.x - old.x != dc.layer_dx ||
+           box.y - old.y != dc.layer_dy || box.w != old.w ||
+           box.h != old.h)) {
+        invalidate_layers(dataNode);
+      }
+
+      damage_add_clipped(&dataNode->paint_box, &dc);
+      SDL_Rect paint = box;
+      if (!dataNode->dirty && box.w == old.w && box.h == old.h) {
+        // 只是平移：内容不变，绘制矩形跟着平移，不必重新排版文字
+        paint = offset_rect(&dataNode->paint_box, box.x - old.x,
+                            box.y - old.y);
+      } else if (dataNode->node_type == TEXT && dataNode->text) {
+        // 文字可能超出布局矩形，按排版后的字形包围盒计算
+        TextLayout *layout = text_layout_update(font, dataNode, box.w);
+        if (layout->bounds.w > 0 && layout->bounds.h > 0) {
+          SDL_Rect text_rect = layout->bounds;
+          text_rect.x += box.x;
+          text_rect.y += box.y;
+          SDL_UnionRect(&paint, &text_rect, &paint);
+        }
+      }
+      dataNode->layout_box = box;
+      dataNode->paint_box = paint;
+      damage_add_clipped(&paint, &dc);
+      dataNode->dirty = 0;
+    }
+    geometry.subtree[i] = dataNode->paint_box;
+
+    if (geometry.end[i] > i + 1 && node_clips_children(dataNode)) {
+      if (dc.has_clip) {
+        if (!SDL_IntersectRect(&dc.clip, &box, &dc.clip))
+          dc.clip = (SDL_Rect){0, 0, 0, 0};
+      } else {
+        dc.clip = box;
+        dc.has_clip = 1;
+      }
+    }
+    damage_contexts[i] = dc;
+  }
+
+  for (int i = geometry.count - 1; i > 0; i--) {
+    int parent = geometry.parent[i];
+    // 裁剪容器的子节点不会画到容器外
+    if (!node_clips_children(geometry.node[parent]))
+      SDL_UnionRect(&geometry.subtree[parent], &geometry.subtree[i],
+                    &geometry.subtree[parent]);
+  }
+}
+
+// 裁剪容器入栈，扫描越过其子树时恢复外层裁剪；图层递归渲染时在栈顶继续使用
+typedef struct {
+  int end;
+  SDL_Rect prev_clip;
+} ClipEntry;
+
+static ClipEntry *clip_stack = NULL;
+static int clip_stack_top = 0;
+static int clip_stack_capacity = 0;
+
+static void clip_push(RenderBackend *backend, int end, const SDL_Rect *clip) {
+  if (clip_stack_top == clip_stack_capacity) {
+    clip_stack_capacity = clip_stack_capacity ? clip_stack_capacity * 2 : 16;
+    clip_stack = realloc(clip_stack,
+                         sizeof(ClipEntry) * (size_t)clip_stack_capacity);
+  }
+  draw_batch_flush(backend);
+  clip_stack[clip_stack_top].end = end;
+  clip_stack[clip_stack_top].prev_clip = render_clip;
+  clip_stack_top++;
+  render_clip = *clip;
+  backend->set_clip(backend, &render_clip);
+}
+
+static void clip_pop(RenderBackend *backend) {
+  draw_batch_flush(backend);
+  render_clip = clip_stack[--clip_stack_top].prev_clip;
+  backend->set_clip(backend, &render_clip);
+}
+
+static void render_range(TTF_Font *font, RenderBackend *backend, int first,
+                         int end, int ox, int oy, int layer_root);
+
+// 把图层子树重新渲染到离屏纹理，失败时返回 0 由调用方直接绘制
+static int layer_render(TTF_Font *font, RenderBackend *backend, int index,
+                        int w, int h) {
+  Layer *layer = geometry.node[index]->layer;
+  SDL_Renderer *renderer = backend->renderer;
+  size_t bytes = (size_t)w * h * 4;
+  // 软件后端没有渲染目标纹理，图层退化为直接绘制
+  if (!renderer || bytes > layer_cache.budget ||
+      !SDL_RenderTargetSupported(renderer)) {
+    layer_release_texture(layer);
+    return 0;
+  }
+
+  if (!layer->texture || layer->w != w || layer->h != h) {
+    layer_release_texture(layer);
+    layer_evict(bytes);
+    layer->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                       SDL_TEXTUREACCESS_TARGET, w, h);
+    if (!layer->texture)
+      return 0;
+    SDL_SetTextureBlendMode(layer->texture, SDL_BLENDMODE_BLEND);
+    layer->w = w;
+    layer->h = h;
+    layer->bytes = bytes;
+    layer_cache.bytes += bytes;
+  }
+
+  draw_batch_flush(backend);
+  SDL_Texture *prev_target = SDL_GetRenderTarget(renderer);
+  SDL_Rect prev_clip = render_clip;
+
+  SDL_SetRenderTarget(renderer, layer->texture);
+  render_clip = (SDL_Rect){0, 0, w, h};
+  backend->set_clip(backend, &render_clip);
+  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+  SDL_RenderClear(renderer);
+  layer->busy = 1;
+  // 图层内以节点左上角为原点
+  render_range(font, backend, index, geometry.end[index], -geometry.x[index],
+               -geometry.y[index], index);
+  draw_batch_flush(backend);
+  layer->busy = 0;
+
+  render_clip = prev_clip;
+  SDL_SetRenderTarget(renderer, prev_target);
+  backend->set_clip(backend, &render_clip);
+  layer->valid = 1;
+  return 1;
+}
+
+// 图层有效时直接贴图，返回 0 表示需要按普通节点绘制
+static int layer_composite(TTF_Font *font, RenderBackend *backend, int index,
+                           int x, int y, int w, int h) {
+  Layer *layer = geometry.node[index]->layer;
+  if (w <= 0 || h <= 0)
+    return 1;
+  if (!layer->valid || !layer->texture || layer->w != w || layer->h != h) {
+    if (!layer_render(font, backend, index, w, h))
+      return 0;
+  }
+  draw_batch_flush(backend);
+  SDL_Rect dst = {x, y, w, h};
+  backend->draw_image(backend, layer->texture, &dst);
+  layer_lru_unlink(layer);
+  layer_lru_push_front(layer);
+  return 1;
+}
+
+// 按绘制顺序渲染缓冲中 [first, end) 的节点，(ox, oy) 把绝对坐标换算到
+// 当前渲染目标；layer_root 为正在渲染自身图层的节点，不再对它做合成
+static void render_range(TTF_Font *font, RenderBackend *backend, int first,
+                         int end, int ox, int oy, int layer_root) {
+  int clip_base = clip_stack_top;
+  int i = first;
+  while (i < end) {
+    // 离开裁剪容器的子树，恢复外层裁剪
+    while (clip_stack_top > clip_base &&
+           clip_stack[clip_stack_top - 1].end <= i) {
+      clip_pop(backend);
+    }
+
+    TreeNode *dataNode = geometry.node[i];
+    int x = geometry.x[i] + ox;
+    int y = geometry.y[i] + oy;
+    int w = geometry.w[i];
+    int h = geometry.h[i];
+
+    // 整棵子树都在可见区域之外，直接剔除
+    SDL_Rect subtree = offset_rect(&geometry.subtree[i], ox, oy);
+    if (!SDL_HasIntersection(&subtree, &render_clip)) {
+      i = geometry.end[i];
+      continue;
+    }
+
+    // 自身不在可见区域内的节点只需继续遍历子节点
+    SDL_Rect paint = offset_rect(&dataNode->paint_box, ox, oy);
+    int in_damage = SDL_HasIntersection(&paint, &render_clip);
+
+    // 如果是 TEXT 节点，渲染文字
+    if (dataNode->node_type == TEXT && dataNode->text) {
+      if (in_damage) {
+        // 文字必须画在之前收集的背景之上
+        draw_batch_flush(backend);
+        render_text(font, backend, dataNode, x, y, w, h);
+      }
+      i = geometry.end[i];
+      continue;
+    }
+
+    // 图层内容不超出自身矩形，不相交时整棵子树都可以跳过
+    if (dataNode->layer && i != layer_root) {
+      if (!in_damage ||
+          layer_composite(font, backend, i, x, y, w, h)) {
+        i = geometry.end[i];
+        continue;
+      }
+    }
+
+    SDL_Rect rect = {x, y, w, h};
+    if (in_damage) {
+      // 绘制背景（开启透明）
+      draw_batch_fill_rect(backend, &rect, dataNode->style->backgroundColor,
+                           SDL_BLENDMODE_BLEND);
+
+      // 绘制边框
+      Color border = (dataNode == selectedNode) ? COLOR_HIGHLIGHT
+                                                : dataNode->style->borderColor;
+      draw_batch_outline_rect(backend, &rect, border, SDL_BLENDMODE_BLEND);
+    }
+
+    // 裁剪容器与当前可见区域不相交时跳过全部子节点
+    if (geometry.end[i] > i + 1 && node_clips_children(dataNode)) {
+      SDL_Rect clip;
+      if (!SDL_IntersectRect(&render_clip, &rect, &clip)) {
+        i = geometry.end[i];
+        continue;
+      }
+      clip_push(backend, geometry.end[i], &clip);
+    }
+    i++;
+  }
+  while (clip_stack_top > clip_base) {
+    clip_pop(backend);
+  }
+}
+
+void render_free(void) {
+  free(damage_contexts);
+  damage_contexts = NULL;
+  damage_context_capacity = 0;
+  free(clip_stack);
+  clip_stack = NULL;
+  clip_stack_top = clip_stack_capacity = 0;
+}
+
+// 选中节点变化时新旧两个节点的高亮边框都要重绘
+void set_selected_node(TreeNode *node) {
+  if (node == selectedNode)
+    return;
+  mark_node_dirty(selectedNode);
+  mark_node_dirty(node);
+  selectedNode = node;
+}
+
+// 返回本帧是否有内容被重绘
+int render_frame(TTF_Font *font, RenderBackend *backend) {
+  geometry_update();
+  if (tree_dirty) {
+    collect_damage(font);
+    tree_dirty = 0;
+  }
+  if (damage_empty)
+    return 0;
+
+  glyph_atlas_begin_frame();
+  if (!backend->begin_frame(backend)) {
+    // 上一帧内容不可靠，只能整屏重绘
+    damage_all();
+  }
+  render_clip = damage_rect;
+  backend->set_clip(backend, &render_clip);
+  Color background = {240, 240, 240, 255};
+  backend->fill_rects(backend, &damage_rect, &background, 1,
+                      SDL_BLENDMODE_NONE);
+  render_range(font, backend, 0, geometry.count, 0, 0, -1);
+  draw_batch_flush(backend);
+  backend->set_clip(backend, NULL);
+  backend->end_frame(backend);
+  damage_reset();
+  return 1;
+}
+
+static JSValue js_createNode(JSContext *ctx, JSValue this_val, int argc,
+                             JSValue *argv) {
+  // 创建 C 层对象
+  TreeNode *node = create_node(NODE, NULL, 1.0f, 10.0f, YGFlexDirectionRow,
+                               YGJustifyFlexStart);
+  if (!node)
+    return JS_ThrowRangeError(ctx, "createNode: too many live nodes");
+
+  // 包装为 JS 对象
+  return wrap_node(ctx, node);
+}
+
+static JSValue js_createTextNode(JSContext *ctx, JSValue this_val, int argc,
+                                 JSValue *argv) {
+  if (argc < 1) {
+    return JS_ThrowTypeError(ctx,
+                             "createNode requires at least 1 argument: text");
+  }
+  int id = node_id_reserve();
+  if (id < 0)
+    return JS_ThrowRangeError(ctx, "createTextNode: too many live nodes");
+  const char *text = JS_ToCString(ctx, argv[0]);
+  if (!text) {
+    node_id_unreserve(id);
+    return JS_EXCEPTION;
+  }
+
+  // 创建 C 层对象
+  TreeNode *node = create_text_node(id, text);
+  JS_FreeCString(ctx, text);
+
+  // 包装为 JS 对象
+  return wrap_node(ctx, node);
+}
+
+static JSValue js_appendChild(JSContext *ctx, JSValue this_val, int argc,
+                              JSValue *argv) {
+  // 参数必须为2个：parent 和 child
+  if (argc != 2) {
+    return JS_ThrowTypeError(
+        ctx, "appendChild requires 2 arguments: parent and child");
+  }
+
+  // 解包父节点和子节点
+  TreeNode *parent = unwrap_node(ctx, argv[0]);
+  TreeNode *child = unwrap_node(ctx, argv[1]);
+
+  if (!parent) {
+    return JS_ThrowTypeError(ctx, "Invalid parent node");
+  }
+  if (!child) {
+    return JS_ThrowTypeError(ctx, "Invalid child node");
+  }
+  if (parent->node_type == TEXT) {
+    return JS_ThrowTypeError(ctx, "Text nodes cannot have children");
+  }
+
+  // 执行添加操作
+  if (append_child(parent, child)) {
+    return JS_UNDEFINED;
+  } else {
+    return JS_ThrowInternalError(ctx, "Failed to append child");
+  }
+}
+
+// 第四个参数为 true 或 {capture: true} 时在捕获阶段触发
+static int listener_capture_option(JSContext *ctx, int argc,
+                                   JSValueConst *argv) {
+  if (argc < 4)
+    return 0;
+  if (JS_IsObject(argv[3])) {
+    JSValue capture = JS_GetPropertyStr(ctx, argv[3], "capture");
+    int result = JS_ToBool(ctx, capture);
+    JS_FreeValue(ctx, capture);
+    return result;
+  }
+  return JS_ToBool(ctx, argv[3]);
+}
+
+// JS 绑定的 addEventListener
+static JSValue js_addEventListener(JSContext *ctx, JSValueConst this_val,
+                                   int argc, JSValueConst *argv) {
+  if (argc < 3) {
+    return JS_ThrowTypeError(
+        ctx, "addEventListener requires 3 arguments: node & type & callback");
+  }
+  TreeNode *node = unwrap_node(ctx, argv[0]);
+  if (!node) {
+    return JS_ThrowTypeError(ctx, "Invalid node parameter");
+  }
+  JSAtom type = JS_ValueToAtom(ctx, argv[1]);
+  if (type == JS_ATOM_NULL) {
+    return JS_EXCEPTION;
+  }
+
+  add_listener(ctx, node, type, argv[2], listener_capture_option(ctx, argc, argv));
+  JS_FreeAtom(ctx, type);
+  return JS_UNDEFINED;
+}
+
+// JS 绑定的 removeEventListener
+static JSValue js_removeEventListener(JSContext *ctx, JSValueConst this_val,
+                                      int argc, JSValueConst *argv) {
+  if (argc < 3) {
+    return JS_ThrowTypeError(
+        ctx,
+        "removeEventListener requires 3 arguments: node & type & callback");
+  }
+  TreeNode *node = unwrap_node(ctx, argv[0]);
+  if (!node) {
+    return JS_ThrowTypeError(ctx, "Invalid node parameter");
+  }
+  JSAtom type = JS_ValueToAtom(ctx, argv[1]);
+  if (type == JS_ATOM_NULL) {
+    return JS_EXCEPTION;
+  }
+
+  remove_listener(ctx, node, type, argv[2],
+                  listener_capture_option(ctx, argc, argv));
+  JS_FreeAtom(ctx, type);
+  return JS_UNDEFINED;
+}
+
+// dispatchEvent(node, type[, bubbles = true])
+static JSValue js_dispatchEvent(JSContext *ctx, JSValueConst this_val, int argc,
+                                JSValueConst *argv) {
+  if (argc < 2) {
+    return JS_ThrowTypeError(ctx,
+                             "dispatchEvent requires 2 arguments: node & type");
+  }
+  TreeNode *node = unwrap_node(ctx, argv[0]);
+  if (!node) {
+    return JS_ThrowTypeError(ctx, "Invalid node parameter");
+  }
+  JSAtom type = JS_ValueToAtom(ctx, argv[1]);
+  if (type == JS_ATOM_NULL) {
+    return JS_EXCEPTION;
+  }
+  int bubbles = argc > 2 ? JS_ToBool(ctx, argv[2]) : 1;
+
+  // 调用 C 层函数
+  dispatch_event(ctx, node, type, bubbles, NULL);
+
+  JS_FreeAtom(ctx, type);
+  return JS_UNDEFINED;
+}
+
+static JSValue js_removeChild(JSContext *ctx, JSValue this_val, int argc,
+                              JSValue *argv) {
+  // 参数必须为2个：parent 和 child
+  if (argc != 2) {
+    return JS_ThrowTypeError(
+        ctx, "appendChild requires 2 arguments: parent and child");
+  }
+
+  // 解包父节点和子节点
+  TreeNode *parent = unwrap_node(ctx, argv[0]);
+  TreeNode *child = unwrap_node(ctx, argv[1]);
+
+  if (!parent) {
+    return JS_ThrowTypeError(ctx, "Invalid parent node");
+  }
+  if (!child) {
+    return JS_ThrowTypeError(ctx, "Invalid child node");
+  }
+
+  // 执行添加操作
+  if (remove_child(ctx, parent, child)) {
+    return JS_UNDEFINED;
+  } else {
+    return JS_ThrowInternalError(ctx, "Failed to remove child");
+  }
+}
+
+static JSValue js_insertBefore(JSContext *ctx, JSValue this_val, int argc,
+                               JSValue *argv) {
+  // 参数必须为3个：parent 和 child, ref
+  if (argc != 3) {
+    return JS_ThrowTypeError(
+        ctx, "appendChild requires 3 arguments: parent and child");
+  }
+
+  // 解包父节点和子节点
+  TreeNode *parent = unwrap_node(ctx, argv[0]);
+  TreeNode *child = unwrap_node(ctx, argv[1]);
+  TreeNode *ref = unwrap_node(ctx, argv[2]);
+
+  if (!parent) {
+    return JS_ThrowTypeError(ctx, "Invalid parent node");
+  }
+  if (!child) {
+    return JS_ThrowTypeError(ctx, "Invalid child node");
+  }
+
+  // 执行添加操作
+  if (insert_before(parent, child, ref)) {
+    return JS_UNDEFINED;
+  } else {
+    return JS_ThrowInternalError(ctx, "Failed to insert child");
+  }
+}
+
+static JSValue js_setAttribute(JSContext *ctx, JSValue this_val, int argc,
+                               JSValue *argv) {
+  // 参数必须为3个：node 和 key, value
+  if (argc != 3) {
+    return JS_ThrowTypeError(
+        ctx, "appendChild requires 3 arguments: parent and child");
+  }
+
+  // 解包父节点和子节点
+  TreeNode *node = unwrap_node(ctx, argv[0]);
+
+  if (!node) {
+    return JS_ThrowTypeError(ctx, "Invalid node parameter");
+  }
+
+  // 转换属性名（第二个参数）
+  const char *attr = JS_ToCString(ctx, argv[1]);
+  if (!attr) {
+    return JS_ThrowTypeError(ctx, "Invalid attribute name");
+  }
+
+  // 数字值直接写入样式，不经过字符串往返
+  if (JS_IsNumber(argv[2])) {
+    const StyleProperty *prop = style_property_lookup(attr);
+    double number;
+    if (prop && JS_ToFloat64(ctx, &number, argv[2]) == 0 &&
+        set_style_number(node, prop, number)) {
+      JS_FreeCString(ctx, attr);
+      return JS_UNDEFINED;
+    }
+  }
+
+  // 转换属性值（第三个参数）
+  const char *value = JS_ToCString(ctx, argv[2]);
+  if (!value) {
+    JS_FreeCString(ctx, attr); // 释放已分配的属性名
+    return JS_ThrowTypeError(ctx, "Invalid attribute value");
+  }
+
+  // 调用底层设置属性逻辑
+  int ret = set_attribute(node, attr, value);
+
+  // 处理操作结果
+  JSValue result = JS_UNDEFINED;
+  if (ret != 1) {
+    result = JS_ThrowInternalError(ctx, "Failed to set attribute '%s'", attr);
+  }
+
+  // 释放字符串资源
+  JS_FreeCString(ctx, attr);
+  JS_FreeCString(ctx, value);
+  return result;
+}
+
+static JSValue js_setTextContent(JSContext *ctx, JSValue this_val, int argc,
+                                 JSValue *argv) {
+  // 检查参数数量
+  if (argc != 2) {
+    return JS_ThrowTypeError(
+        ctx, "setTextContent requires exactly 2 arguments: node and text");
+  }
+
+  // 解包 TreeNode
+  TreeNode *node = unwrap_node(ctx, argv[0]);
+  if (!node) {
+    return JS_ThrowTypeError(ctx, "Invalid node parameter");
+  }
+
+  // 检查节点类型是否为 TEXT
+  if (node->node_type != TEXT) {
+    return JS_ThrowTypeError(ctx, "Node is not a TEXT node");
+  }
+
+  // 获取新的文字内容
+  const char *new_text = JS_ToCString(ctx, argv[1]);
+  if (!new_text) {
+    return JS_ThrowTypeError(ctx, "Invalid text parameter");
+  }
+
+  // 更新节点的文字内容
+  set_node_text(node, new_text);
+
+  // 释放 C 字符串资源
+  JS_FreeCString(ctx, new_text);
+
+  return JS_UNDEFINED;
+}
+
+static JSValue js_setLayerBudget(JSContext *ctx, JSValue this_val, int argc,
+                                 JSValue *argv) {
+  if (argc != 1) {
+    return JS_ThrowTypeError(ctx, "setLayerBudget requires 1 argument: bytes");
+  }
+  int64_t bytes;
+  if (JS_ToInt64(ctx, &bytes, argv[0]) != 0) {
+    return JS_EXCEPTION;
+  }
+  if (bytes < 0) {
+    return JS_ThrowRangeError(ctx, "Invalid layer budget");
+  }
+  layer_set_budget((size_t)bytes);
+  return JS_UNDEFINED;
+}
+
+// 从几何缓冲读取节点的绝对布局矩形，尚未布局的节点返回 null
+static JSValue js_getLayout(JSContext *ctx, JSValue this_val, int argc,
+                            JSValue *argv) {
+  if (argc != 1) {
+    return JS_ThrowTypeError(ctx, "getLayout requires 1 argument: node");
+  }
+  TreeNode *node = unwrap_node(ctx, argv[0]);
+  if (!node) {
+    return JS_ThrowTypeError(ctx, "Invalid node");
+  }
+  geometry_update();
+  int i = node->geometry_index;
+  if (i < 0 || i >= geometry.count || geometry.node[i] != node) {
+    return JS_NULL;
+  }
+  JSValue rect = JS_NewObject(ctx);
+  JS_SetPropertyStr(ctx, rect, "x", JS_NewInt32(ctx, geometry.x[i]));
+  JS_SetPropertyStr(ctx, rect, "y", JS_NewInt32(ctx, geometry.y[i]));
+  JS_SetPropertyStr(ctx, rect, "width", JS_NewInt32(ctx, geometry.w[i]));
+  JS_SetPropertyStr(ctx, rect, "height", JS_NewInt32(ctx, geometry.h[i]));
+  return rect;
+}
+
+// 在 C 中遍历样式对象的自有属性，逐条写入 style；
+// 值为 undefined / null 表示移除该属性，恢复为 base 中的取值。
+// 失败时抛出异常并返回 -1，style 可能已部分修改
+static int style_apply_js_object(JSContext *ctx, NodeStyle *style,
+                                 const NodeStyle *base, JSValueConst obj) {
+  JSPropertyEnum *props = NULL;
+  uint32_t count = 0;
+  if (JS_GetOwnPropertyNames(ctx, &props, &count, obj,
+                             JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY) != 0) {
+    return -1;
+  }
+
+  int ret = 0;
+  for (uint32_t i = 0; i < count && ret == 0; i++) {
+    const char *attr = JS_AtomToCString(ctx, props[i].atom);
+    if (!attr) {
+      ret = -1;
+      break;
+    }
+    const StyleProperty *prop = style_property_lookup(attr);
+    if (!prop) {
+      JS_ThrowRangeError(ctx, "Unknown style property: %s", attr);
+      JS_FreeCString(ctx, attr);
+      ret = -1;
+      break;
+    }
+
+    JSValue v = JS_GetProperty(ctx, obj, props[i].atom);
+    int ok = 0;
+    double number;
+    if (JS_IsUndefined(v) || JS_IsNull(v)) {
+      style_reset_property(style, prop, base);
+      ok = 1;
+    } else if (JS_IsNumber(v) && JS_ToFloat64(ctx, &number, v) == 0 &&
+               style_set_number(style, prop, number)) {
+      ok = 1;
+    } else {
+      const char *value = JS_ToCString(ctx, v);
+      ok = value && style_set_string(style, prop, value);
+      JS_FreeCString(ctx, value);
+    }
+    JS_FreeValue(ctx, v);
+
+    if (!ok) {
+      JS_ThrowRangeError(ctx, "Invalid value for style property '%s'", attr);
+      ret = -1;
+    }
+    JS_FreeCString(ctx, attr);
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    JS_FreeAtom(ctx, props[i].atom);
+  }
+  js_free(ctx, props);
+  return ret;
+}
+
+// defineStyle(name, {flex: 1, backgroundColor: "#fff", ...})
+// 在默认样式上写入属性，整体入表，之后 setAttribute(node, "class", name)
+// 一步换上
+static JSValue js_defineStyle(JSContext *ctx, JSValue this_val, int argc,
+                              JSValue *argv) {
+  if (argc != 2 || !JS_IsObject(argv[1])) {
+    return JS_ThrowTypeError(
+        ctx, "defineStyle requires 2 arguments: name and style object");
+  }
+  const char *name = JS_ToCString(ctx, argv[0]);
+  if (!name) {
+    return JS_ThrowTypeError(ctx, "Invalid style name");
+  }
+
+  NodeStyle style;
+  style_set_defaults(&style);
+  NodeStyle defaults = style;
+  if (style_apply_js_object(ctx, &style, &defaults, argv[1]) != 0) {
+    JS_FreeCString(ctx, name);
+    return JS_EXCEPTION;
+  }
+  style_class_define(name, &style);
+  JS_FreeCString(ctx, name);
+  return JS_UNDEFINED;
+}
+
+// setStyle(node, {width: 100, backgroundColor: "#f00", margin: undefined})
+// 一次调用写入对象中的全部样式属性，只在结束时换一次共享样式。
+// 既可传完整样式，也可只传变化的键，值为 undefined / null 的键恢复为
+// 节点创建时的样式。
+// 任何一条属性无效时整个调用不生效
+static JSValue js_setStyle(JSContext *ctx, JSValue this_val, int argc,
+                           JSValue *argv) {
+  if (argc != 2) {
+    return JS_ThrowTypeError(ctx,
+                             "setStyle requires 2 arguments: node and style");
+  }
+  TreeNode *node = unwrap_node(ctx, argv[0]);
+  if (!node) {
+    return JS_ThrowTypeError(ctx, "Invalid node parameter");
+  }
+  if (JS_IsUndefined(argv[1]) || JS_IsNull(argv[1])) {
+    return JS_UNDEFINED;
+  }
+  if (!JS_IsObject(argv[1])) {
+    return JS_ThrowTypeError(ctx, "Style must be an object");
+  }
+
+  NodeStyle style = *node->style;
+  if (style_apply_js_object(ctx, &style, node->base_style, argv[1]) != 0) {
+    return JS_EXCEPTION;
+  }
+  node_set_style(node, &style);
+  return JS_UNDEFINED;
+}
+
+/*-------------------------------------
+ * 变更指令缓冲
+ * React 一次提交里的全部树变更由 JS 编码成 32 位整数指令写入 ArrayBuffer，
+ * 在 resetAfterCommit 中调用一次 flushMutations 在 C 中顺序执行。
+ * - 节点用整数 id 表示，新节点的 id 由 reserveNodeIds 预先分配
+ * - 属性名、关键字和事件类型用 internString 换成整数，
+ *   作为样式属性名时入表就解析好属性，执行时不再查找。
+ *   这张表常驻不释放，只放取值有限的字符串
+ * - 数字样式值以 float32 位模式直接放在指令中
+ * - 文字内容、任意字符串属性值和回调函数放在附带的 values 数组里，
+ *   指令中只存下标，随本次提交一起释放
+ * 同一节点连续的样式指令先合并，再一次换成共享样式。
+ * 执行失败时之前的指令已生效，本次创建但没有挂到树上的节点由 C 释放
+ *-----------------------------------*/
+typedef enum {
+  MUT_CREATE_NODE = 1, // id
+  MUT_CREATE_TEXT,     // id, 文字的 values 下标
+  MUT_APPEND_CHILD,    // parent, child
+  MUT_INSERT_BEFORE,   // parent, child, before
+  MUT_REMOVE_CHILD,    // parent, child
+  MUT_SET_ATTRIBUTE,   // node, 属性名串, 关键字串
+  MUT_SET_STYLE_NUMBER, // node, 属性名串, float32 位
+  MUT_RESET_STYLE,     // node, 属性名串
+  MUT_SET_TEXT,        // node, 文字的 values 下标
+  MUT_ADD_LISTENER,    // node, 事件类型串, 回调的 values 下标
+  MUT_REMOVE_LISTENER, // node, 事件类型串, 回调的 values 下标
+  MUT_SET_ATTRIBUTE_VALUE, // node, 属性名串, 值的 values 下标
+  MUT_OPCODE_COUNT
+} MutationOpcode;
+
+// 每条指令的操作数个数
+static const int mutation_arity[MUT_OPCODE_COUNT] = {
+    [MUT_CREATE_NODE] = 1,      [MUT_CREATE_TEXT] = 2,
+    [MUT_APPEND_CHILD] = 2,     [MUT_INSERT_BEFORE] = 3,
+    [MUT_REMOVE_CHILD] = 2,     [MUT_SET_ATTRIBUTE] = 3,
+    [MUT_SET_STYLE_NUMBER] = 3, [MUT_RESET_STYLE] = 2,
+    [MUT_SET_TEXT] = 2,         [MUT_ADD_LISTENER] = 3,
+    [MUT_REMOVE_LISTENER] = 3,  [MUT_SET_ATTRIBUTE_VALUE] = 3,
+};
+
+typedef struct {
+  char *text;
+  const StyleProperty *prop; // 作为样式属性名时对应的属性，否则为 NULL
+} MutationString;
+
+static MutationString *mutation_strings = NULL;
+static int mutation_string_count = 0;
+static int mutation_string_capacity = 0;
+static GHashTable *mutation_string_ids = NULL; // 文本 -> 下标 + 1
+
+// 本次执行中创建的节点 id，失败时据此释放没有挂到树上的节点
+static int *mutation_created = NULL;
+static int mutation_created_count = 0;
+static int mutation_created_capacity = 0;
+
+static void mutation_created_push(int id) {
+  if (mutation_created_count == mutation_created_capacity) {
+    mutation_created_capacity =
+        mutation_created_capacity ? mutation_created_capacity * 2 : 64;
+    mutation_created =
+        realloc(mutation_created,
+                sizeof(int) * (size_t)mutation_created_capacity);
+  }
+  mutation_created[mutation_created_count++] = id;
+}
+
+int mutation_string_intern(const char *text) {
+  if (!mutation_string_ids)
+    mutation_string_ids = g_hash_table_new(g_str_hash, g_str_equal);
+  gpointer found = g_hash_table_lookup(mutation_string_ids, text);
+  if (found)
+    return GPOINTER_TO_INT(found) - 1;
+
+  if (mutation_string_count == mutation_string_capacity) {
+    mutation_string_capacity =
+        mutation_string_capacity ? mutation_string_capacity * 2 : 64;
+    mutation_strings =
+        realloc(mutation_strings,
+                sizeof(MutationString) * (size_t)mutation_string_capacity);
+  }
+  int index = mutation_string_count++;
+  mutation_strings[index].text = strdup(text);
+  mutation_strings[index].prop = style_property_lookup(text);
+  g_hash_table_insert(mutation_string_ids, mutation_strings[index].text,
+                      GINT_TO_POINTER(index + 1));
+  return index;
+}
+
+void mutation_strings_free(void) {
+  for (int i = 0; i < mutation_string_count; i++)
+    free(mutation_strings[i].text);
+  free(mutation_strings);
+  mutation_strings = NULL;
+  mutation_string_count = mutation_string_capacity = 0;
+  free(mutation_created);
+  mutation_created = NULL;
+  mutation_created_count = mutation_created_capacity = 0;
+  if (mutation_string_ids) {
+    g_hash_table_destroy(mutation_string_ids);
+    mutation_string_ids = NULL;
+  }
+}
+
+// 合并中的样式：同一节点连续的样式指令只在最后入表一次
+typedef struct {
+  TreeNode *node;
+  NodeStyle style;
+} PendingStyle;
+
+static void pending_style_commit(PendingStyle *pending) {
+  if (pending->node) {
+    node_set_style(pending->node, &pending->style);
+    pending->node = NULL;
+  }
+}
+
+static NodeStyle *pending_style_for(PendingStyle *pending, TreeNode *node) {
+  if (pending->node != node) {
+    pending_style_commit(pending);
+    pending->node = node;
+    pending->style = *node->style;
+  }
+  return &pending->style;
+}
+
+// 执行 [words, words + count) 中的指令；出错时抛出异常，之前的指令已生效。
+// 所有出错路径都经过末尾，合并中的样式照常提交
+static int mutations_run(JSContext *ctx, const int32_t *words, size_t count,
+                         JSValueConst values) {
+  PendingStyle pending = {NULL};
+  const char *error = NULL;
+  int thrown = 0; // 异常已由 QuickJS 抛出，不再另抛 RangeError
+  size_t pc = 0;
+
+  while (pc < count) {
+    int32_t op = words[pc];
+    if (op <= 0 || op >= MUT_OPCODE_COUNT) {
+      error = "unknown opcode";
+      break;
+    }
+    if (pc + 1 + (size_t)mutation_arity[op] > count) {
+      error = "truncated command";
+      break;
+    }
+    const int32_t *arg = words + pc + 1;
+
+    // 除样式指令外都先提交合并中的样式，节点可能随之被删除
+    if (op != MUT_SET_ATTRIBUTE && op != MUT_SET_ATTRIBUTE_VALUE &&
+        op != MUT_SET_STYLE_NUMBER && op != MUT_RESET_STYLE)
+      pending_style_commit(&pending);
+
+    if (op == MUT_CREATE_NODE || op == MUT_CREATE_TEXT) {
+      int id = arg[0];
+      if (!node_id_is_reserved(id)) {
+        error = "node id was not reserved or is already in use";
+        break;
+      }
+      if (op == MUT_CREATE_NODE) {
+        create_node_with_id(id, NODE, NULL, 1.0f, 10.0f, YGFlexDirectionRow,
+                            YGJustifyFlexStart);
+      } else {
+        JSValue v = JS_GetPropertyUint32(ctx, values, (uint32_t)arg[1]);
+        const char *text = JS_ToCString(ctx, v);
+        JS_FreeValue(ctx, v);
+        if (!text) {
+          thrown = 1;
+          break;
+        }
+        create_text_node(id, text);
+        JS_FreeCString(ctx, text);
+      }
+      mutation_created_push(id);
+      pc += 1 + mutation_arity[op];
+      continue;
+    }
+
+    TreeNode *node = find_node_by_id(arg[0]);
+    if (!node) {
+      error = "unknown node id";
+      break;
+    }
+    const MutationString *name = NULL;
+    if (op == MUT_SET_ATTRIBUTE || op == MUT_SET_ATTRIBUTE_VALUE ||
+        op == MUT_SET_STYLE_NUMBER || op == MUT_RESET_STYLE ||
+        op == MUT_ADD_LISTENER || op == MUT_REMOVE_LISTENER) {
+      if (arg[1] < 0 || arg[1] >= mutation_string_count) {
+        error = "unknown string id";
+        break;
+      }
+      name = &mutation_strings[arg[1]];
+    }
+
+    int ok = 1;
+    switch ((MutationOpcode)op) {
+    case MUT_APPEND_CHILD:
+    case MUT_INSERT_BEFORE:
+    case MUT_REMOVE_CHILD: {
+      TreeNode *child = find_node_by_id(arg[1]);
+      if (!child || node->node_type == TEXT) {
+        ok = 0;
+      } else if (op == MUT_APPEND_CHILD) {
+        ok = append_child(node, child);
+      } else if (op == MUT_INSERT_BEFORE) {
+        TreeNode *before = find_node_by_id(arg[2]);
+        ok = before && insert_before(node, child, before);
+      } else {
+        ok = remove_child(ctx, node, child);
+      }
+      break;
+    }
+    case MUT_SET_ATTRIBUTE:
+    case MUT_SET_ATTRIBUTE_VALUE: {
+      const char *value = NULL;
+      if (op == MUT_SET_ATTRIBUTE) {
+        if (arg[2] < 0 || arg[2] >= mutation_string_count) {
+          ok = 0;
+          break;
+        }
+        value = mutation_strings[arg[2]].text;
+      } else {
+        JSValue v = JS_GetPropertyUint32(ctx, values, (uint32_t)arg[2]);
+        value = JS_ToCString(ctx, v);
+        JS_FreeValue(ctx, v);
+        if (!value) {
+          ok = 0;
+          thrown = 1;
+          break;
+        }
+      }
+      if (name->prop) {
+        ok = style_set_string(pending_style_for(&pending, node), name->prop,
+                              value);
+      } else {
+        // class、layer 等非样式属性
+        pending_style_commit(&pending);
+        ok = set_attribute(node, name->text, value);
+      }
+      if (op == MUT_SET_ATTRIBUTE_VALUE)
+        JS_FreeCString(ctx, value);
+      break;
+    }
+    case MUT_SET_STYLE_NUMBER: {
+      float number;
+      memcpy(&number, &arg[2], sizeof(number));
+      ok = name->prop && style_set_number(pending_style_for(&pending, node),
+                                          name->prop, number);
+      break;
+    }
+    case MUT_RESET_STYLE:
+      ok = name->prop != NULL;
+      if (ok)
+        style_reset_property(pending_style_for(&pending, node), name->prop,
+                             node->base_style);
+      break;
+    case MUT_SET_TEXT: {
+      if (node->node_type != TEXT) {
+        ok = 0;
+        break;
+      }
+      JSValue v = JS_GetPropertyUint32(ctx, values, (uint32_t)arg[1]);
+      const char *text = JS_ToCString(ctx, v);
+      JS_FreeValue(ctx, v);
+      if (!text) {
+        ok = 0;
+        thrown = 1;
+        break;
+      }
+      set_node_text(node, text);
+      JS_FreeCString(ctx, text);
+      break;
+    }
+    case MUT_ADD_LISTENER:
+    case MUT_REMOVE_LISTENER: {
+      JSValue callback = JS_GetPropertyUint32(ctx, values, (uint32_t)arg[2]);
+      if (JS_IsException(callback)) {
+        ok = 0;
+        thrown = 1;
+        break;
+      }
+      JSAtom type = JS_NewAtom(ctx, name->text);
+      if (op == MUT_ADD_LISTENER)
+        add_listener(ctx, node, type, callback, 0);
+      else
+        remove_listener(ctx, node, type, callback, 0);
+      JS_FreeAtom(ctx, type);
+      JS_FreeValue(ctx, callback);
+      break;
+    }
+    default:
+      break;
+    }
+    if (!ok) {
+      if (!thrown)
+        error = "command failed";
+      break;
+    }
+    pc += 1 + mutation_arity[op];
+  }
+
+  pending_style_commit(&pending);
+  if (thrown)
+    return -1;
+  if (error) {
+    JS_ThrowRangeError(ctx, "flushMutations: %s at word %zu", error, pc);
+    return -1;
   }
-  const char *text = JS_ToCString(ctx, argv[0]);
+  return 0;
+}
 
-  // 创建 C 层对象
-  TreeNode *node =
-      create_node(TEXT, text, 1.0f, 0, YGFlexDirectionRow, YGJustifyFlexStart);
-  node->style->borderColor = COLOR_WHITE;
-  node->style->backgroundColor = COLOR_TRANSPARENT;
+// 把 node 子树中所有节点的 id 追加到 ids 数组
+static void mutation_collect_ids(JSContext *ctx, TreeNode *node, JSValue ids,
+                                 uint32_t *count) {
+  JS_SetPropertyUint32(ctx, ids, (*count)++, JS_NewInt32(ctx, node->id));
+  for (int i = 0; i < node->childCount; i++)
+    mutation_collect_ids(ctx, node->children[i], ids, count);
+}
 
-  JS_FreeCString(ctx, text);
-  if (!node)
-    return JS_ThrowOutOfMemory(ctx);
+// 失败时释放本次创建但没有挂到树上的节点，连同挂在它们下面的子树（其中
+// 可能有本次之前就存在的节点）。异常对象的 orphanedIds 列出所有因此失效
+// 的 id，JS 据此丢弃对它们的引用
+static int mutations_apply(JSContext *ctx, const int32_t *words, size_t count,
+                           JSValueConst values) {
+  mutation_created_count = 0;
+  if (mutations_run(ctx, words, count, values) == 0)
+    return 0;
 
-  // 包装为 JS 对象
-  return wrap_node(ctx, node);
+  JSValue orphans = JS_NewArray(ctx);
+  uint32_t orphan_count = 0;
+  for (int i = 0; i < mutation_created_count; i++) {
+    TreeNode *node = find_node_by_id(mutation_created[i]);
+    if (node && !node->parent && node != root_data) {
+      mutation_collect_ids(ctx, node, orphans, &orphan_count);
+      free_tree(ctx, node);
+    }
+  }
+  // 出错位置之后的创建指令没有执行，调用方已经用掉了这些 id，直接归还
+  for (size_t pc = 0; pc < count;) {
+    int32_t op = words[pc];
+    if (op <= 0 || op >= MUT_OPCODE_COUNT ||
+        pc + 1 + (size_t)mutation_arity[op] > count)
+      break;
+    if (op == MUT_CREATE_NODE || op == MUT_CREATE_TEXT)
+      node_id_unreserve(words[pc + 1]);
+    pc += 1 + mutation_arity[op];
+  }
+  JSValue error = JS_GetException(ctx);
+  if (JS_IsObject(error))
+    JS_SetPropertyStr(ctx, error, "orphanedIds", orphans);
+  else
+    JS_FreeValue(ctx, orphans);
+  JS_Throw(ctx, error);
+  return -1;
 }
 
-static JSValue js_appendChild(JSContext *ctx, JSValue this_val, int argc,
-                              JSValue *argv) {
-  // 参数必须为2个：parent 和 child
-  if (argc != 2) {
-    return JS_ThrowTypeError(
-        ctx, "appendChild requires 2 arguments: parent and child");
+// reserveNodeIds(ids)：用新预留的 id 填满 Int32Array，供 MUT_CREATE_* 使用。
+// id 不再连续（槽位会复用），因此由调用方提供数组而不是返回起始值
+static JSValue js_reserveNodeIds(JSContext *ctx, JSValue this_val, int argc,
+                                 JSValue *argv) {
+  size_t offset, length, element_size;
+  if (argc != 1) {
+    return JS_ThrowTypeError(ctx, "reserveNodeIds requires 1 argument: ids");
   }
-
-  // 解包父节点和子节点
-  TreeNode *parent = unwrap_node(ctx, argv[0]);
-  TreeNode *child = unwrap_node(ctx, argv[1]);
-
-  if (!parent) {
-    return JS_ThrowTypeError(ctx, "Invalid parent node");
+  JSValue buffer =
+      JS_GetTypedArrayBuffer(ctx, argv[0], &offset, &length, &element_size);
+  if (JS_IsException(buffer)) {
+    return JS_EXCEPTION;
   }
-  if (!child) {
-    return JS_ThrowTypeError(ctx, "Invalid child node");
+  size_t size;
+  uint8_t *bytes = JS_GetArrayBuffer(ctx, &size, buffer);
+  JS_FreeValue(ctx, buffer);
+  if (!bytes) {
+    return JS_EXCEPTION;
   }
-
-  // 执行添加操作
-  if (append_child(parent, child)) {
-    return JS_UNDEFINED;
-  } else {
-    return JS_ThrowInternalError(ctx, "Failed to append child");
+  if (element_size != sizeof(int32_t)) {
+    return JS_ThrowTypeError(ctx, "reserveNodeIds expects an Int32Array");
+  }
+  int32_t *ids = (int32_t *)(bytes + offset);
+  size_t count = length / sizeof(int32_t);
+  for (size_t i = 0; i < count; i++) {
+    int id = node_id_reserve();
+    if (id < 0) {
+      // 已经填入的 id 不会交给调用方，全部归还
+      for (size_t j = 0; j < i; j++)
+        node_id_unreserve(ids[j]);
+      return JS_ThrowRangeError(ctx, "reserveNodeIds: too many live nodes");
+    }
+    ids[i] = id;
   }
+  return JS_NewInt32(ctx, (int32_t)count);
 }
 
-// JS 绑定的 addEventListener
-static JSValue js_addEventListener(JSContext *ctx, JSValueConst this_val,
-                                   int argc, JSValueConst *argv) {
-  if (argc != 3) {
-    return JS_ThrowTypeError(
-        ctx, "addEventListener requires 3 arguments: node & type & callback");
+// releaseNodeIds(ids)：归还 reserveNodeIds 取得但不再使用的 id，
+// 已经创建了节点的 id 不受影响。丢弃未用完的一批 id 时调用
+static JSValue js_releaseNodeIds(JSContext *ctx, JSValue this_val, int argc,
+                                 JSValue *argv) {
+  size_t offset, length, element_size;
+  if (argc != 1) {
+    return JS_ThrowTypeError(ctx, "releaseNodeIds requires 1 argument: ids");
   }
-  TreeNode *node = unwrap_node(ctx, argv[0]);
-  const char *event_type = JS_ToCString(ctx, argv[1]);
-  JSValue callback = argv[2];
-
-  // 调用 C 函数时传递 ctx
-  add_listener(ctx, node, event_type, callback);
-  JS_FreeCString(ctx, event_type);
+  JSValue buffer =
+      JS_GetTypedArrayBuffer(ctx, argv[0], &offset, &length, &element_size);
+  if (JS_IsException(buffer)) {
+    return JS_EXCEPTION;
+  }
+  size_t size;
+  uint8_t *bytes = JS_GetArrayBuffer(ctx, &size, buffer);
+  JS_FreeValue(ctx, buffer);
+  if (!bytes) {
+    return JS_EXCEPTION;
+  }
+  if (element_size != sizeof(int32_t)) {
+    return JS_ThrowTypeError(ctx, "releaseNodeIds expects an Int32Array");
+  }
+  const int32_t *ids = (const int32_t *)(bytes + offset);
+  for (size_t i = 0; i < length / sizeof(int32_t); i++)
+    node_id_unreserve(ids[i]);
   return JS_UNDEFINED;
 }
 
-// JS 绑定的 removeEventListener
-static JSValue js_removeEventListener(JSContext *ctx, JSValueConst this_val,
-                                      int argc, JSValueConst *argv) {
-  if (argc != 3) {
-    return JS_ThrowTypeError(
-        ctx,
-        "removeEventListener requires 3 arguments: node & type & callback");
+static JSValue js_internString(JSContext *ctx, JSValue this_val, int argc,
+                               JSValue *argv) {
+  if (argc != 1) {
+    return JS_ThrowTypeError(ctx, "internString requires 1 argument: string");
   }
-  TreeNode *node = unwrap_node(ctx, argv[0]);
-  const char *event_type = JS_ToCString(ctx, argv[1]);
-  JSValue callback = argv[2];
-
-  // 调用 C 函数时传递 ctx
-  remove_listener(ctx, node, event_type, callback);
-  JS_FreeCString(ctx, event_type);
-  return JS_UNDEFINED;
+  const char *text = JS_ToCString(ctx, argv[0]);
+  if (!text) {
+    return JS_EXCEPTION;
+  }
+  int index = mutation_string_intern(text);
+  JS_FreeCString(ctx, text);
+  return JS_NewInt32(ctx, index);
 }
 
-static JSValue js_dispatchEvent(JSContext *ctx, JSValueConst this_val, int argc,
-                                JSValueConst *argv) {
-  if (argc != 2) {
+// isKeywordAttribute(name)：该属性的取值是否是有限的关键字
+// （枚举样式、class、layer），只有这些取值适合 internString
+static JSValue js_isKeywordAttribute(JSContext *ctx, JSValue this_val,
+                                     int argc, JSValue *argv) {
+  if (argc != 1) {
     return JS_ThrowTypeError(ctx,
-                             "dispatchEvent requires 2 arguments: node & type");
+                             "isKeywordAttribute requires 1 argument: name");
   }
-  TreeNode *node = unwrap_node(ctx, argv[0]);
-  const char *event_type = JS_ToCString(ctx, argv[1]);
-
-  // 调用 C 层函数
-  dispatch_event(ctx, node, event_type);
-
-  JS_FreeCString(ctx, event_type);
-  return JS_UNDEFINED;
+  const char *name = JS_ToCString(ctx, argv[0]);
+  if (!name) {
+    return JS_EXCEPTION;
+  }
+  const StyleProperty *prop = style_property_lookup(name);
+  int keyword = prop ? prop->kind == STYLE_ENUM
+                     : strcmp(name, "class") == 0 || strcmp(name, "layer") == 0;
+  JS_FreeCString(ctx, name);
+  return JS_NewBool(ctx, keyword);
 }
 
-static JSValue js_removeChild(JSContext *ctx, JSValue this_val, int argc,
-                              JSValue *argv) {
-  // 参数必须为2个：parent 和 child
-  if (argc != 2) {
+// flushMutations(buffer, length, values)：执行 buffer 中前 length 个 32 位指令字；
+// 失败时抛出的异常带有 orphanedIds，见 mutations_apply
+static JSValue js_flushMutations(JSContext *ctx, JSValue this_val, int argc,
+                                 JSValue *argv) {
+  if (argc < 2) {
     return JS_ThrowTypeError(
-        ctx, "appendChild requires 2 arguments: parent and child");
+        ctx, "flushMutations requires arguments: buffer, length[, values]");
   }
-
-  // 解包父节点和子节点
-  TreeNode *parent = unwrap_node(ctx, argv[0]);
-  TreeNode *child = unwrap_node(ctx, argv[1]);
-
-  if (!parent) {
-    return JS_ThrowTypeError(ctx, "Invalid parent node");
+  size_t size;
+  uint8_t *bytes = JS_GetArrayBuffer(ctx, &size, argv[0]);
+  if (!bytes) {
+    return JS_EXCEPTION;
   }
-  if (!child) {
-    return JS_ThrowTypeError(ctx, "Invalid child node");
+  int64_t length;
+  if (JS_ToInt64(ctx, &length, argv[1]) != 0) {
+    return JS_EXCEPTION;
   }
-
-  // 执行添加操作
-  if (remove_child(ctx, parent, child)) {
-    return JS_UNDEFINED;
-  } else {
-    return JS_ThrowInternalError(ctx, "Failed to remove child");
+  if (length < 0 || (uint64_t)length > size / sizeof(int32_t)) {
+    return JS_ThrowRangeError(ctx, "flushMutations: length out of range");
+  }
+  JSValueConst values = argc > 2 ? argv[2] : JS_UNDEFINED;
+  if (mutations_apply(ctx, (const int32_t *)bytes, (size_t)length, values) !=
+      0) {
+    return JS_EXCEPTION;
   }
+  return JS_UNDEFINED;
 }
 
-static JSValue js_insertBefore(JSContext *ctx, JSValue this_val, int argc,
-                               JSValue *argv) {
-  // 参数必须为3个：parent 和 child, ref
-  if (argc != 3) {
-    return JS_ThrowTypeError(
-        ctx, "appendChild requires 3 arguments: parent and child");
+// 指令中只有节点 id，JS 侧需要时用它换取节点对象
+static JSValue js_getNodeById(JSContext *ctx, JSValue this_val, int argc,
+                              JSValue *argv) {
+  int32_t id;
+  if (argc != 1 || JS_ToInt32(ctx, &id, argv[0]) != 0) {
+    return JS_ThrowTypeError(ctx, "getNodeById requires 1 argument: id");
   }
+  TreeNode *node = find_node_by_id(id);
+  return node ? wrap_node(ctx, node) : JS_NULL;
+}
 
-  // 解包父节点和子节点
-  TreeNode *parent = unwrap_node(ctx, argv[0]);
-  TreeNode *child = unwrap_node(ctx, argv[1]);
-  TreeNode *ref = unwrap_node(ctx, argv[2]);
-
-  if (!parent) {
-    return JS_ThrowTypeError(ctx, "Invalid parent node");
+static JSValue js_getNodeId(JSContext *ctx, JSValue this_val, int argc,
+                            JSValue *argv) {
+  if (argc != 1) {
+    return JS_ThrowTypeError(ctx, "getNodeId requires 1 argument: node");
   }
-  if (!child) {
-    return JS_ThrowTypeError(ctx, "Invalid child node");
+  TreeNode *node = unwrap_node(ctx, argv[0]);
+  if (!node) {
+    return JS_ThrowTypeError(ctx, "Invalid node");
   }
+  return JS_NewInt32(ctx, node->id);
+}
 
-  // 执行添加操作
-  if (insert_before(parent, child, ref)) {
-    return JS_UNDEFINED;
-  } else {
-    return JS_ThrowInternalError(ctx, "Failed to insert child");
+static JSValue js_setTextCacheBudget(JSContext *ctx, JSValue this_val,
+                                     int argc, JSValue *argv) {
+  if (argc != 1) {
+    return JS_ThrowTypeError(ctx,
+                             "setTextCacheBudget requires 1 argument: bytes");
   }
+  int64_t bytes;
+  if (JS_ToInt64(ctx, &bytes, argv[0]) != 0) {
+    return JS_EXCEPTION;
+  }
+  if (bytes < 0) {
+    return JS_ThrowRangeError(ctx, "Invalid text cache budget");
+  }
+  // 文字位图都在字形图集中，预算作用于图集页
+  glyph_atlas_set_budget((size_t)bytes);
+  return JS_UNDEFINED;
 }
 
-static JSValue js_setAttribute(JSContext *ctx, JSValue this_val, int argc,
-                               JSValue *argv) {
-  // 参数必须为3个：node 和 key, value
-  if (argc != 3) {
-    return JS_ThrowTypeError(
-        ctx, "appendChild requires 3 arguments: parent and child");
-  }
+/*-------------------------------------
+ * 内存统计
+ * 节点、监听器、包装对象用创建/释放时维护的计数，字节数在查询时遍历
+ * 节点 id 表等现有结构得到。yoda.memory() 返回快照，SIGUSR1 把快照打印到
+ * stderr，正常退出时检查仍未释放的对象
+ *-----------------------------------*/
+typedef struct {
+  size_t count;
+  size_t bytes;
+} MemoryEntry;
 
-  // 解包父节点和子节点
-  TreeNode *node = unwrap_node(ctx, argv[0]);
+typedef struct {
+  MemoryEntry elements;
+  MemoryEntry texts;
+  MemoryEntry node_ids;
+  MemoryEntry styles;
+  MemoryEntry listeners;
+  MemoryEntry wrappers;
+  MemoryEntry timers;
+  MemoryEntry glyph_pages;
+  MemoryEntry layers;
+  MemoryEntry workers;
+  MemoryEntry slabs;
+  JSMemoryUsage js;
+} MemoryReport;
+
+static const struct {
+  const char *name;
+  size_t offset;
+} memory_report_fields[] = {
+    {"elements", offsetof(MemoryReport, elements)},
+    {"texts", offsetof(MemoryReport, texts)},
+    {"nodeIds", offsetof(MemoryReport, node_ids)},
+    {"styles", offsetof(MemoryReport, styles)},
+    {"listeners", offsetof(MemoryReport, listeners)},
+    {"wrappers", offsetof(MemoryReport, wrappers)},
+    {"timers", offsetof(MemoryReport, timers)},
+    {"glyphPages", offsetof(MemoryReport, glyph_pages)},
+    {"layers", offsetof(MemoryReport, layers)},
+    {"workers", offsetof(MemoryReport, workers)},
+    {"slabs", offsetof(MemoryReport, slabs)},
+};
+
+#define MEMORY_REPORT_FIELD_COUNT                                              \
+  (sizeof(memory_report_fields) / sizeof(memory_report_fields[0]))
+
+static JSRuntime *memory_runtime; // 统计 JS 堆用
+static uv_signal_t memory_signal;
+static int memory_signal_open = 0;
+
+static MemoryEntry *memory_report_entry(MemoryReport *report, size_t i) {
+  return (MemoryEntry *)((char *)report + memory_report_fields[i].offset);
+}
 
-  if (!node) {
-    return JS_ThrowTypeError(ctx, "Invalid node parameter");
+static void memory_collect_node(MemoryReport *report, TreeNode *node) {
+  MemoryEntry *entry =
+      node->node_type == TEXT ? &report->texts : &report->elements;
+  entry->count++;
+  entry->bytes += sizeof(TreeNode) + sizeof(TreeNode *) * node->childCount;
+  if (node->text)
+    entry->bytes += strlen(node->text) + 1;
+
+  report->listeners.bytes +=
+      sizeof(ListenerBucket) * (size_t)node->listener_bucket_count;
+  for (int b = 0; b < node->listener_bucket_count; b++) {
+    ListenerBucket *bucket = &node->listener_buckets[b];
+    report->listeners.count += bucket->count;
+    report->listeners.bytes += sizeof(EventListener) * bucket->capacity;
   }
+}
 
-  // 转换属性名（第二个参数）
-  const char *attr = JS_ToCString(ctx, argv[1]);
-  if (!attr) {
-    return JS_ThrowTypeError(ctx, "Invalid attribute name");
+void memory_collect(MemoryReport *report) {
+  memset(report, 0, sizeof(*report));
+  for (uint32_t i = 0; i < node_slots.dense_count; i++)
+    memory_collect_node(report, node_slots.dense[i]);
+  report->node_ids.count = node_slots.dense_count;
+  report->node_ids.bytes = node_slots.slot_capacity * sizeof(NodeSlot) +
+                           node_slots.dense_capacity * sizeof(TreeNode *);
+  if (style_table) {
+    report->styles.count = g_hash_table_size(style_table);
+    report->styles.bytes = report->styles.count * sizeof(NodeStyle);
   }
+  report->wrappers.count = (size_t)memory_counters.wrappers;
 
-  // 转换属性值（第三个参数）
-  const char *value = JS_ToCString(ctx, argv[2]);
-  if (!value) {
-    JS_FreeCString(ctx, attr); // 释放已分配的属性名
-    return JS_ThrowTypeError(ctx, "Invalid attribute value");
+  for (uint32_t i = 0; i < timers.record_count; i++) {
+    if (timers.records[i].state != TIMER_FREE)
+      report->timers.count++;
+  }
+  report->timers.bytes =
+      (size_t)timers.capacity * (sizeof(TimerRecord) + sizeof(uint32_t)) +
+      (size_t)timers.batch_capacity * sizeof(int64_t);
+
+  report->glyph_pages.count = (size_t)glyph_atlas.page_count;
+  report->glyph_pages.bytes =
+      (size_t)glyph_atlas.page_count * GLYPH_ATLAS_PAGE_BYTES;
+  for (Layer *layer = layer_cache.lru_head; layer; layer = layer->next)
+    report->layers.count++;
+  report->layers.bytes = layer_cache.bytes;
+  for (Worker *w = workers; w; w = w->next) {
+    report->workers.count++;
+    report->workers.bytes += sizeof(Worker);
   }
 
-  // 调用底层设置属性逻辑
-  int ret = set_attribute(node, attr, value);
+  const Slab *slabs[] = {&node_slab, &listener_slab, &text_slab};
+  for (size_t i = 0; i < sizeof(slabs) / sizeof(slabs[0]); i++) {
+    report->slabs.count += slabs[i]->chunk_count;
+    report->slabs.bytes += slab_bytes(slabs[i]);
+  }
 
-  // 释放字符串资源
-  JS_FreeCString(ctx, attr);
-  JS_FreeCString(ctx, value);
+  if (memory_runtime)
+    JS_ComputeMemoryUsage(memory_runtime, &report->js);
+}
 
-  // 处理操作结果
-  if (ret == 1) {
-    return JS_UNDEFINED;
-  } else {
-    return JS_ThrowInternalError(ctx, "Failed to set attribute '%s'", attr);
+void memory_report_print(FILE *f, const MemoryReport *report) {
+  fprintf(f, "memory:\n");
+  for (size_t i = 0; i < MEMORY_REPORT_FIELD_COUNT; i++) {
+    const MemoryEntry *entry =
+        memory_report_entry((MemoryReport *)report, i);
+    fprintf(f, "  %-12s %8zu %12zu bytes\n", memory_report_fields[i].name,
+            entry->count, entry->bytes);
   }
+  fprintf(f, "  %-12s %8" PRId64 " %12" PRId64 " bytes (%" PRId64
+             " objects, %" PRId64 " strings)\n",
+          "jsHeap", report->js.malloc_count, report->js.malloc_size,
+          report->js.obj_count, report->js.str_count);
 }
 
-static JSValue js_setTextContent(JSContext *ctx, JSValue this_val, int argc,
-                                 JSValue *argv) {
-  // 检查参数数量
-  if (argc != 2) {
-    return JS_ThrowTypeError(
-        ctx, "setTextContent requires exactly 2 arguments: node and text");
-  }
+static void memory_signal_cb(uv_signal_t *handle, int signum) {
+  MemoryReport report;
+  memory_collect(&report);
+  memory_report_print(stderr, &report);
+}
 
-  // 解包 TreeNode
-  TreeNode *node = unwrap_node(ctx, argv[0]);
-  if (!node) {
-    return JS_ThrowTypeError(ctx, "Invalid node parameter");
+// SIGUSR1 打印内存快照；信号句柄不让事件循环保持运行
+void memory_monitor_init(JSRuntime *rt, uv_loop_t *loop) {
+  memory_runtime = rt;
+#ifdef SIGUSR1
+  if (uv_signal_init(loop, &memory_signal) == 0) {
+    uv_signal_start(&memory_signal, memory_signal_cb, SIGUSR1);
+    uv_unref((uv_handle_t *)&memory_signal);
+    memory_signal_open = 1;
   }
+#endif
+}
 
-  // 检查节点类型是否为 TEXT
-  if (node->node_type != TEXT) {
-    return JS_ThrowTypeError(ctx, "Node is not a TEXT node");
+// 需要在 uv_loop_close 之前调用
+void memory_monitor_close(void) {
+  memory_runtime = NULL;
+  if (memory_signal_open) {
+    uv_signal_stop(&memory_signal);
+    uv_close((uv_handle_t *)&memory_signal, NULL);
+    memory_signal_open = 0;
   }
+}
 
-  // 获取新的文字内容
-  const char *new_text = JS_ToCString(ctx, argv[1]);
-  if (!new_text) {
-    return JS_ThrowTypeError(ctx, "Invalid text parameter");
+// 退出时节点树、运行时都已释放，仍有计数的对象即为泄漏
+int memory_leak_check(void) {
+  int leaks = 0;
+  for (int type = 0; type < NODE_TYPE_COUNT; type++) {
+    if (memory_counters.nodes[type] != 0) {
+      fprintf(stderr, "leak: %d %s nodes still allocated\n",
+              memory_counters.nodes[type], type == TEXT ? "text" : "element");
+      leaks++;
+    }
   }
+  if (node_slots.dense_count > 0) {
+    fprintf(stderr, "leak: %u entries left in node id table\n",
+            node_slots.dense_count);
+    leaks++;
+  }
+  if (memory_counters.listeners != 0) {
+    fprintf(stderr, "leak: %d event listeners still registered\n",
+            memory_counters.listeners);
+    leaks++;
+  }
+  if (memory_counters.wrappers != 0) {
+    fprintf(stderr, "leak: %d node wrappers not finalized\n",
+            memory_counters.wrappers);
+    leaks++;
+  }
+  if (layer_cache.bytes != 0) {
+    fprintf(stderr, "leak: %zu bytes of layer textures\n", layer_cache.bytes);
+    leaks++;
+  }
+  if (workers) {
+    fprintf(stderr, "leak: workers still running\n");
+    leaks++;
+  }
+  return leaks;
+}
 
-  // 更新节点的文字内容
-  set_node_text(node, new_text);
-
-  // 释放 C 字符串资源
-  JS_FreeCString(ctx, new_text);
-
-  return JS_UNDEFINED;
+static JSValue js_memory(JSContext *ctx, JSValue this_val, int argc,
+                         JSValue *argv) {
+  MemoryReport report;
+  memory_collect(&report);
+  JSValue result = JS_NewObject(ctx);
+  for (size_t i = 0; i < MEMORY_REPORT_FIELD_COUNT; i++) {
+    const MemoryEntry *entry = memory_report_entry(&report, i);
+    JSValue item = JS_NewObject(ctx);
+    JS_SetPropertyStr(ctx, item, "count",
+                      JS_NewFloat64(ctx, (double)entry->count));
+    JS_SetPropertyStr(ctx, item, "bytes",
+                      JS_NewFloat64(ctx, (double)entry->bytes));
+    JS_SetPropertyStr(ctx, result, memory_report_fields[i].name, item);
+  }
+  JSValue js = JS_NewObject(ctx);
+  JS_SetPropertyStr(ctx, js, "mallocSize",
+                    JS_NewFloat64(ctx, (double)report.js.malloc_size));
+  JS_SetPropertyStr(ctx, js, "mallocCount",
+                    JS_NewFloat64(ctx, (double)report.js.malloc_count));
+  JS_SetPropertyStr(ctx, js, "memoryUsed",
+                    JS_NewFloat64(ctx, (double)report.js.memory_used_size));
+  JS_SetPropertyStr(ctx, js, "objects",
+                    JS_NewFloat64(ctx, (double)report.js.obj_count));
+  JS_SetPropertyStr(ctx, js, "strings",
+                    JS_NewFloat64(ctx, (double)report.js.str_count));
+  JS_SetPropertyStr(ctx, js, "functions",
+                    JS_NewFloat64(ctx, (double)report.js.js_func_count));
+  JS_SetPropertyStr(ctx, result, "jsHeap", js);
+  return result;
 }
 
 /*-------------------------------------
@@ -890,8 +7291,41 @@ static JSValue js_setTextContent(JSContext *ctx, JSValue this_val, int argc,
  *-----------------------------------*/
 int main(int argc, char *argv[]) {
 
-  if (argc < 2) {
-    fprintf(stderr, "Usage: %s <js-file>\n", argv[0]);
+  // 命令行参数
+  const char *script_path = NULL;
+  int headless = 0;             // 不创建窗口，使用软件渲染后端
+  const char *dump_dir = NULL;  // 无窗口模式下把每帧写入该目录
+  int max_frames = 0;           // 运行指定帧数后退出，0 表示不限
+  int raster_stats = 0;         // 退出时输出软件光栅化耗时
+  int precompile = 0;           // 只把脚本编译为字节码缓存后退出
+  int use_bytecode_cache = 1;
+  const char *cache_arg = NULL; // 字节码缓存路径，默认为脚本路径加 .qbc
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--headless") == 0) {
+      headless = 1;
+    } else if (strcmp(argv[i], "--dump-frames") == 0 && i + 1 < argc) {
+      dump_dir = argv[++i];
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      max_frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--raster-stats") == 0) {
+      raster_stats = 1;
+    } else if (strcmp(argv[i], "--precompile") == 0) {
+      precompile = 1;
+    } else if (strcmp(argv[i], "--bytecode-cache") == 0 && i + 1 < argc) {
+      cache_arg = argv[++i];
+    } else if (strcmp(argv[i], "--no-bytecode-cache") == 0) {
+      use_bytecode_cache = 0;
+    } else if (!script_path) {
+      script_path = argv[i];
+    }
+  }
+
+  if (!script_path) {
+    fprintf(stderr,
+            "Usage: %s [--headless] [--dump-frames <dir>] [--frames <n>] "
+            "[--raster-stats] [--precompile] [--bytecode-cache <file>] [--no-bytecode-cache] "
+            "<js-file>\n",
+            argv[0]);
     return 1;
   }
 
@@ -901,24 +7335,36 @@ int main(int argc, char *argv[]) {
   uv_loop_t *loop = uv_default_loop();
   JSValue val = JS_UNDEFINED;
 
-  // 读取文件
-  int len = readfile(argv[1], &code);
-  if (len == -1) {
-    fprintf(stderr, "Error reading file: %s\n", argv[1]);
+  char *cache_path = NULL;
+  if (precompile || use_bytecode_cache) {
+    cache_path =
+        cache_arg ? strdup(cache_arg) : bytecode_cache_path(script_path);
+  }
+
+  // 读取文件；只部署了字节码缓存时允许源码缺失
+  int len = readfile(script_path, &code);
+  if (len == -1 &&
+      (!cache_path || precompile || access(cache_path, R_OK) != 0)) {
+    fprintf(stderr, "Error reading file: %s\n", script_path);
+    free(cache_path);
     cleanup_resources(NULL, NULL, loop, code, val);
     return 1;
   }
 
-  nodeIdMap = g_hash_table_new(g_int_hash, g_int_equal);
+  style_registry_init();
+  style_table_init();
   root_data = create_node(NODE, NULL, 1.0f, 10.0f, YGFlexDirectionRow,
                           YGJustifyFlexStart);
-  root_data->style->backgroundColor = parse_color("#F0F0F0"); // 根节点浅灰背景
+  set_attribute(root_data, "backgroundColor", "#F0F0F0"); // 根节点浅灰背景
+  node_rebase_style(root_data);
   yogaRoot = root_data->yogaNode;
 
   // 初始化 QuickJS 运行时
   rt = JS_NewRuntime();
-  if (!rt) {
+  if (!rt || tree_node_class_init(rt) != 0 || worker_class_init(rt) != 0) {
     fprintf(stderr, "Error creating JS runtime\n");
+    if (rt)
+      JS_FreeRuntime(rt);
     cleanup_resources(NULL, NULL, loop, code, val);
     return 1;
   }
@@ -930,11 +7376,29 @@ int main(int argc, char *argv[]) {
     cleanup_resources(rt, NULL, loop, code, val);
     return 1;
   }
+  events_init(ctx);
+
+  animation_frames_init();
 
   // 初始化标准库
   js_std_init_handlers(rt);
   js_std_add_helpers(ctx, 0, NULL);
 
+  if (precompile) {
+    int ret = precompile_script(ctx, script_path, cache_path, code, len);
+    if (ret == 0)
+      printf("Wrote bytecode cache: %s\n", cache_path);
+    free(cache_path);
+    events_free(ctx);
+    cleanup_resources(rt, ctx, loop, code, val);
+    return ret == 0 ? 0 : 1;
+  }
+
+  timers_init(&timers, ctx, loop);
+  scheduler_init(rt);
+  workers_init(ctx);
+  memory_monitor_init(rt, loop);
+
   JSValue js_document = wrap_node(ctx, root_data);
 
   // 注册全局函数
@@ -973,54 +7437,133 @@ int main(int argc, char *argv[]) {
                     JS_NewCFunction(ctx, js_clearTimer, "clearTimeout", 1));
   JS_SetPropertyStr(ctx, global, "clearInterval",
                     JS_NewCFunction(ctx, js_clearTimer, "clearInterval", 1));
+  JS_SetPropertyStr(
+      ctx, global, "setTextCacheBudget",
+      JS_NewCFunction(ctx, js_setTextCacheBudget, "setTextCacheBudget", 1));
+  JS_SetPropertyStr(ctx, global, "setLayerBudget",
+                    JS_NewCFunction(ctx, js_setLayerBudget, "setLayerBudget", 1));
+  JS_SetPropertyStr(ctx, global, "getLayout",
+                    JS_NewCFunction(ctx, js_getLayout, "getLayout", 1));
+  JS_SetPropertyStr(ctx, global, "defineStyle",
+                    JS_NewCFunction(ctx, js_defineStyle, "defineStyle", 2));
+  JS_SetPropertyStr(ctx, global, "setStyle",
+                    JS_NewCFunction(ctx, js_setStyle, "setStyle", 2));
+  JS_SetPropertyStr(
+      ctx, global, "reserveNodeIds",
+      JS_NewCFunction(ctx, js_reserveNodeIds, "reserveNodeIds", 1));
+  JS_SetPropertyStr(
+      ctx, global, "releaseNodeIds",
+      JS_NewCFunction(ctx, js_releaseNodeIds, "releaseNodeIds", 1));
+  JS_SetPropertyStr(ctx, global, "internString",
+                    JS_NewCFunction(ctx, js_internString, "internString", 1));
+  JS_SetPropertyStr(
+      ctx, global, "isKeywordAttribute",
+      JS_NewCFunction(ctx, js_isKeywordAttribute, "isKeywordAttribute", 1));
+  JS_SetPropertyStr(
+      ctx, global, "flushMutations",
+      JS_NewCFunction(ctx, js_flushMutations, "flushMutations", 3));
+  JS_SetPropertyStr(ctx, global, "getNodeById",
+                    JS_NewCFunction(ctx, js_getNodeById, "getNodeById", 1));
+  JS_SetPropertyStr(ctx, global, "getNodeId",
+                    JS_NewCFunction(ctx, js_getNodeId, "getNodeId", 1));
+  JS_SetPropertyStr(ctx, global, "requestAnimationFrame",
+                    JS_NewCFunction(ctx, js_requestAnimationFrame,
+                                    "requestAnimationFrame", 1));
+  JS_SetPropertyStr(ctx, global, "cancelAnimationFrame",
+                    JS_NewCFunction(ctx, js_cancelAnimationFrame,
+                                    "cancelAnimationFrame", 1));
+  JSValue performance = JS_NewObject(ctx);
+  JS_SetPropertyStr(ctx, performance, "now",
+                    JS_NewCFunction(ctx, js_performanceNow, "now", 0));
+  JS_SetPropertyStr(ctx, global, "performance", performance);
+  JS_SetPropertyStr(ctx, global, "requestIdleCallback",
+                    JS_NewCFunction(ctx, js_requestIdleCallback,
+                                    "requestIdleCallback", 2));
+  JS_SetPropertyStr(ctx, global, "cancelIdleCallback",
+                    JS_NewCFunction(ctx, js_cancelIdleCallback,
+                                    "cancelIdleCallback", 1));
+  JSValue yoda = JS_NewObject(ctx);
+  JS_SetPropertyStr(ctx, yoda, "memory",
+                    JS_NewCFunction(ctx, js_memory, "memory", 0));
+  JS_SetPropertyStr(ctx, global, "yoda", yoda);
   JS_FreeValue(ctx, global);
 
   // 执行脚本
-  val = JS_Eval(ctx, code, len, argv[1], JS_EVAL_TYPE_MODULE);
+  val = eval_script(ctx, script_path, cache_path, code,
+                    len == -1 ? 0 : (size_t)len);
+  free(cache_path);
   if (JS_IsException(val)) {
     js_std_dump_error(ctx);
+    workers_shutdown();
+    timers_close(&timers);
+    uv_run(loop, UV_RUN_NOWAIT);
+    animation_frames_free(ctx);
+    scheduler_free(ctx);
+    events_free(ctx);
+    transfer_views_free(ctx);
+    memory_monitor_close();
     cleanup_resources(rt, ctx, loop, code, val);
+    workers_free();
     return 1;
   }
 
-  SDL_Init(SDL_INIT_VIDEO);
+  // 无窗口模式只需要事件子系统（用于接收退出信号）
+  SDL_Init(headless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO);
   TTF_Init();
-  TTF_Font *font = TTF_OpenFont("Arial.ttf", 24);
+  TTF_Font *font = TTF_OpenFont("Arial.ttf", FONT_SIZE);
   if (!font) {
     SDL_Log("TTF_OpenFont failed: %s", TTF_GetError());
     TTF_Quit();
     SDL_Quit();
     return 1;
   }
-  SDL_Window *window = SDL_CreateWindow(
-      "树形布局编辑器 - A:添加 D:删除 I:插入 F:切换方向 1-3:颜色 R:重置 "
-      "N:高亮下一节点 S:设置属性",
-      SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, VIEW_WIDTH, VIEW_HEIGHT,
-      SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
-  SDL_Renderer *renderer =
-      SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+  SDL_Window *window = NULL;
+  SDL_Renderer *renderer = NULL;
+  RenderBackend *backend = NULL;
+  if (headless) {
+    backend = software_backend_create(VIEW_WIDTH, VIEW_HEIGHT, dump_dir,
+                                      raster_stats);
+  } else {
+    window = SDL_CreateWindow(
+        "树形布局编辑器 - A:添加 D:删除 I:插入 F:切换方向 1-3:颜色 R:重置 "
+        "N:高亮下一节点 S:设置属性",
+        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, VIEW_WIDTH,
+        VIEW_HEIGHT, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+    renderer = SDL_CreateRenderer(
+        window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
+    backend = sdl_backend_create(renderer, VIEW_WIDTH, VIEW_HEIGHT);
+  }
+  if (!backend) {
+    SDL_Log("Failed to create render backend");
+    TTF_CloseFont(font);
+    TTF_Quit();
+    SDL_Quit();
+    return 1;
+  }
+  // 主字体缺少的字形（中文等）回退到楷体，缺少字体文件时只用主字体
+  TTF_Font *fallback_font = TTF_OpenFont("SimKai.ttf", FONT_SIZE);
+  if (!fallback_font) {
+    SDL_Log("TTF_OpenFont SimKai.ttf failed: %s", TTF_GetError());
+  }
+  glyph_atlas_init(backend, fallback_font);
+  text_measure_init(font);
+  layout_worker_init();
+  int needs_present = 1;
+  int frame_count = 0;
+  damage_all(); // 首帧整屏绘制
 
   int quit = 0;
   while (!quit) {
-    // 处理JavaScript异步任务
-    int js_pending;
-    do {
-      JSContext *ctx;
-      js_pending = JS_ExecutePendingJob(rt, &ctx);
-      if (js_pending < 0) {
-        js_std_dump_error(ctx);
-        quit = 1; // JS执行出错时退出
-        break;
-      }
-    } while (js_pending > 0);
+    scheduler_begin_frame();
 
-    js_std_loop(ctx);
+    // 处理JavaScript异步任务，超出本帧预算的留到下一帧
+    if (scheduler_run_jobs(rt, scheduler.job_deadline) < 0)
+      break; // JS执行出错时退出
 
-    if (quit)
-      break;
-
-    // 处理libuv事件（非阻塞模式）
+    // 处理libuv事件（非阻塞模式），定时器回调同样受本帧预算限制
+    timers.deadline = scheduler.job_deadline;
     uv_run(loop, UV_RUN_NOWAIT);
+    timers.deadline = 0;
 
     // if (!uv_loop_alive(loop))
     //   break;
@@ -1029,7 +7572,7 @@ int main(int argc, char *argv[]) {
     while (SDL_PollEvent(&event)) {
       switch (event.type) {
       case SDL_QUIT:
-        uv_walk(loop, close_timers_cb, NULL);
+        timers_close(&timers);
         uv_run(loop, UV_RUN_NOWAIT);
         quit = 1;
         break;
@@ -1038,15 +7581,45 @@ int main(int argc, char *argv[]) {
         if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
           VIEW_WIDTH = event.window.data1;
           VIEW_HEIGHT = event.window.data2;
+          backend->resize(backend, VIEW_WIDTH, VIEW_HEIGHT);
+          damage_all();
           update_yoga_layout(1);
+        } else if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+          // 后端不一定保留了上一帧，整屏重绘最稳妥
+          damage_all();
+          needs_present = 1;
+        } else if (event.window.event == SDL_WINDOWEVENT_LEAVE) {
+          hover_mouse_leave(ctx);
+        }
+        break;
+
+      case SDL_MOUSEMOTION:
+        hover_mouse_move(ctx, event.motion.x, event.motion.y);
+        break;
+
+      case SDL_MOUSEWHEEL: {
+        int mx, my;
+        SDL_GetMouseState(&mx, &my);
+        int dx = -event.wheel.x * SCROLL_STEP;
+        int dy = -event.wheel.y * SCROLL_STEP;
+        if (event.wheel.direction == SDL_MOUSEWHEEL_FLIPPED) {
+          dx = -dx;
+          dy = -dy;
+        }
+        TreeNode *hit = find_node_at_position(mx, my);
+        TreeNode *container = find_scroll_container(hit, dx, dy);
+        if (container && scroll_node_by(container, dx, dy)) {
+          dispatch_event(ctx, container, events.scroll, 0, NULL);
         }
         break;
+      }
 
       case SDL_MOUSEBUTTONDOWN: {
         int x = event.button.x;
         int y = event.button.y;
-        selectedNode = find_node_at_position(root_data, yogaRoot, x, y);
-        dispatch_event(ctx, selectedNode, "click");
+        set_selected_node(find_node_at_position(x, y));
+        SDL_Point client = {x, y};
+        dispatch_event(ctx, selectedNode, events.click, 1, &client);
         break;
       }
 
@@ -1056,7 +7629,8 @@ int main(int argc, char *argv[]) {
           case SDLK_a: { // 添加子节点
             TreeNode *child = create_node(
                 NODE, NULL, 1.0f, 5.0f, YGFlexDirectionRow, YGJustifyFlexStart);
-            append_child(selectedNode, child);
+            if (child)
+              append_child(selectedNode, child);
             break;
           }
           case SDLK_d: {
@@ -1073,7 +7647,8 @@ int main(int argc, char *argv[]) {
               TreeNode *newNode =
                   create_node(NODE, NULL, 1.0f, 5.0f, YGFlexDirectionRow,
                               YGJustifyFlexStart);
-              insert_before(selectedNode->parent, newNode, selectedNode);
+              if (newNode)
+                insert_before(selectedNode->parent, newNode, selectedNode);
             }
             break;
           }
@@ -1083,10 +7658,8 @@ int main(int argc, char *argv[]) {
             set_attribute(selectedNode, "backgroundColor", "#FFA500");
             break;
           }
-          case SDLK_n: { // 高亮下一个创建的节点
-            TreeNode *targetNode =
-                find_node_by_id(selectedNode->id + 1); // 假设要查找ID为1的节点
-            selectedNode = targetNode;
+          case SDLK_n: { // 高亮 id 表中的下一个存活节点（顺序不固定）
+            set_selected_node(node_slots_next(selectedNode));
             break;
           }
           case SDLK_f: {
@@ -1117,21 +7690,71 @@ int main(int argc, char *argv[]) {
       }
     }
 
+    // 动画帧回调紧挨着布局和绘制执行，本帧的修改合并成一次布局
+    if (run_animation_frames(ctx) < 0)
+      break; // JS执行出错时退出
     update_yoga_layout(0);
-    SDL_SetRenderDrawColor(renderer, 240, 240, 240, 255);
-    SDL_RenderClear(renderer);
-    render_tree(font, renderer, root_data, 0, 0);
-    SDL_RenderPresent(renderer);
-    SDL_Delay(16);
+    hover_refresh(ctx);
+    // 没有任何变化时跳过整帧
+    if (render_frame(font, backend)) {
+      needs_present = 1;
+    }
+    if (needs_present) {
+      backend->present(backend);
+      needs_present = 0;
+    }
+    // 按循环次数计帧，静止的画面不呈现也照样计数
+    if (max_frames > 0 && ++frame_count >= max_frames) {
+      timers_close(&timers);
+      uv_run(loop, UV_RUN_NOWAIT);
+      quit = 1;
+    }
+    // 呈现之后的空闲时间：空闲回调、剩余的任务和 GC
+    if (scheduler_idle(ctx) < 0)
+      break;
+    // 无窗口模式同样按帧间隔休眠，没有垂直同步也不会空转占满 CPU
+    scheduler_end_frame();
   }
 
   // 正常退出时的清理
   free_tree(ctx, root_data);
+  layout_worker_destroy();
+  workers_shutdown();
+  timers_close(&timers);
+  uv_run(loop, UV_RUN_NOWAIT);
+  animation_frames_free(ctx);
+  scheduler_free(ctx);
+  events_free(ctx);
+  transfer_views_free(ctx);
+  memory_monitor_close();
   cleanup_resources(rt, ctx, loop, code, val);
-  g_hash_table_destroy(nodeIdMap);
+  workers_free();
+  memory_leak_check();
+  listener_counts_free();
+  node_slots_free();
+  slab_destroy(&node_slab);
+  slab_destroy(&listener_slab);
+  slab_destroy(&text_slab);
+  style_table_destroy();
+  mutation_strings_free();
+  text_measure_destroy();
+  glyph_atlas_destroy();
+  geometry_free();
+  spatial_free();
+  hover_free();
+  render_free();
+  draw_batch_free();
+  backend->destroy(backend);
+  if (fallback_font) {
+    TTF_CloseFont(fallback_font);
+  }
   TTF_CloseFont(font);
-  SDL_DestroyRenderer(renderer);
-  SDL_DestroyWindow(window);
+  if (renderer) {
+    SDL_DestroyRenderer(renderer);
+  }
+  if (window) {
+    SDL_DestroyWindow(window);
+  }
   TTF_Quit();
   SDL_Quit();
   return 0;